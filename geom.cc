@@ -21,6 +21,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <common/list.h>
 #include <act/act.h>
 #include <act/passes.h>
@@ -32,6 +33,7 @@
 
 bool Layout::_initdone = false;
 double Layout::_leak_adjust = 0.0;
+int Layout::_tile_merge = 0;
   
 void Layout::Init()
 {
@@ -48,252 +50,199 @@ void Layout::Init()
   else {
     _leak_adjust = 0;
   }
+
+  _nflavors = config_get_table_size ("act.dev_flavors");
+  Assert (_nflavors > 0, "Hmm");
+
+  if (config_exists ("lefdef.tile_locality")) {
+    Layer::setLocality (config_get_int ("lefdef.tile_locality"));
+  }
+  if (config_exists ("lefdef.tile_merge")) {
+    _tile_merge = config_get_int ("lefdef.tile_merge");
+  }
+
+  _initLayermap ();
 }
 
 
-Layout::Layout(netlist_t *_n)
+/*
+ * Material name -> layer map. This only depends on the technology,
+ * so it is built once and shared by all layouts. It holds every name
+ * that can appear in a .rect file: metals (m1, m2, ...), poly,
+ * $align, and all the base layer, via, well, and select materials.
+ */
+struct Hashtable *Layout::_lmap = NULL;
+int Layout::_nflavors = 0;
+
+static void _lmap_addname (struct Hashtable *H, const char *name,
+			   int l, int etype, int flavor, int lcase)
 {
   struct LayoutLayermap *lp;
   hash_bucket_t *b;
-  
-  Layout::Init();
-  
-  /*-- create all the layers --*/
-  Assert (Technology::T, "Initialization error");
-
-  N = _n;
-  _readrect = false;
 
-  lmap = hash_new (8);
+  NEW (lp, struct LayoutLayermap);
+  lp->l = l;
+  lp->etype = etype;
+  lp->flavor = flavor;
+  lp->lcase = lcase;
 
-  /* 1. base layer for diff, well, fets */
-  base = new Layer (Technology::T->poly, _n);
+  b = hash_add (H, name);
+  b->v = lp;
+}
 
-  /* 2. Also has #flavors*6 materials! */
-  int sz = config_get_table_size ("act.dev_flavors");
-  Assert (sz > 0, "Hmm");
+/*
+ * m<n>, poly, and $align take precedence over the other material
+ * names, so names that match those are never added as-is.
+ */
+static int _lmap_shadowed (const char *name)
+{
+  if (name[0] == 'm' && isdigit (name[1])) {
+    return 1;
+  }
+  if (strcmp (name, Technology::T->poly->getName()) == 0) {
+    return 1;
+  }
+  if (strcmp (name, "$align") == 0) {
+    return 1;
+  }
+  return 0;
+}
 
-  nflavors = sz;
-  nmetals = Technology::T->nmetals;
+static void _lmap_add (struct Hashtable *H, Material *m,
+		       int l, int etype, int flavor, int lcase)
+{
+  if (_lmap_shadowed (m->getName())) return;
+  _lmap_addname (H, m->getName(), l, etype, flavor, lcase);
+}
 
-  /* 3. extra layers
-        n_select, p_select, and two wells
-  */
-  MALLOC (extra, Layer *, Layout::extra_layers::NUM_EXTRA*sz);
-  for (int i=0; i < Layout::extra_layers::NUM_EXTRA*sz; i++) {
-    extra[i] = NULL;
-  }
+/* add a contact to the layer below it, unless we have already seen it */
+static void _lmap_addvia (struct Hashtable *H, Material *m,
+			  int l, int etype, int flavor)
+{
+  if (!m || !m->getUpC()) return;
+  if (hash_lookup (H, m->getUpC()->getName())) return;
+  _lmap_add (H, m->getUpC(), l, etype, flavor, LMAP_VIA);
+}
 
+void Layout::_initLayermap ()
+{
   int tl = Layout::extra_layers::NUM_EXTRA;
+  int types[2] = { EDGE_NFET, EDGE_PFET };
+  struct Hashtable *H;
 
-  base->allocOther (sz*6);
-  for (int i=0; i < sz; i++) {
-    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, FET_OFFSET),
-		    Technology::T->fet[EDGE_NFET][i]);
+  H = hash_new (8);
 
-    NEW (lp, struct LayoutLayermap);
-    lp->l = base;
-    lp->etype = EDGE_NFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_FET;
+  for (int i=0; i < _nflavors; i++) {
+    for (int k=0; k < 2; k++) {
+      int t = types[k];
+      _lmap_add (H, Technology::T->fet[t][i], LMAP_LAYER_BASE, t, i, LMAP_FET);
+    }
+    for (int k=0; k < 2; k++) {
+      int t = types[k];
+      _lmap_add (H, Technology::T->diff[t][i], LMAP_LAYER_BASE, t, i, LMAP_DIFF);
+      _lmap_addvia (H, Technology::T->diff[t][i], LMAP_LAYER_BASE, t, i);
+    }
+    for (int k=0; k < 2; k++) {
+      int t = types[k];
+      if (Technology::T->welldiff[t][i]) {
+	_lmap_add (H, Technology::T->welldiff[t][i], LMAP_LAYER_BASE,
+		   t, i, LMAP_WDIFF);
+	_lmap_addvia (H, Technology::T->welldiff[t][i], LMAP_LAYER_BASE, t, i);
+      }
+    }
 
-    b = hash_add (lmap, Technology::T->fet[EDGE_NFET][i]->getName());
-    b->v = lp;
-    
-    
-    base->setOther (TOTAL_OFFSET(i, EDGE_PFET, FET_OFFSET),
-		    Technology::T->fet[EDGE_PFET][i]);
+    /* wells and selects live on extra layers; if two flavors share
+       a material, the first flavor's layer is used */
+    if (Technology::T->well[EDGE_NFET][i] &&
+	!hash_lookup (H, Technology::T->well[EDGE_NFET][i]->getName())) {
+      _lmap_add (H, Technology::T->well[EDGE_NFET][i],
+		 Layout::extra_layers::NFET_WELL + i*tl,
+		 EDGE_NFET, i, LMAP_NFET_WELL);
+    }
+    if (Technology::T->well[EDGE_PFET][i] &&
+	!hash_lookup (H, Technology::T->well[EDGE_PFET][i]->getName())) {
+      _lmap_add (H, Technology::T->well[EDGE_PFET][i],
+		 Layout::extra_layers::PFET_WELL + i*tl,
+		 EDGE_PFET, i, LMAP_PFET_WELL);
+    }
+    if (Technology::T->sel[EDGE_NFET][i] &&
+	!hash_lookup (H, Technology::T->sel[EDGE_NFET][i]->getName())) {
+      _lmap_add (H, Technology::T->sel[EDGE_NFET][i],
+		 Layout::extra_layers::N_SELECT + i*tl,
+		 EDGE_NFET, i, LMAP_NSELECT);
+    }
+    if (Technology::T->sel[EDGE_PFET][i] &&
+	!hash_lookup (H, Technology::T->sel[EDGE_PFET][i]->getName())) {
+      _lmap_add (H, Technology::T->sel[EDGE_PFET][i],
+		 Layout::extra_layers::P_SELECT + i*tl,
+		 EDGE_PFET, i, LMAP_PSELECT);
+    }
+  }
 
-    NEW (lp, struct LayoutLayermap);
-    lp->l = base;
-    lp->etype = EDGE_PFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_FET;
+  _lmap_addvia (H, Technology::T->poly, LMAP_LAYER_BASE, -1, 0);
 
-    b = hash_add (lmap, Technology::T->fet[EDGE_PFET][i]->getName());
-    b->v = lp;
+  for (int i=0; i < Technology::T->nmetals; i++) {
+    if (Technology::T->metal[i]->getUpC()) {
+      _lmap_add (H, Technology::T->metal[i]->getUpC(), i, -1, 0, LMAP_VIA);
+    }
+  }
 
+  for (int i=0; i < Technology::T->nmetals; i++) {
+    char buf[16];
+    snprintf (buf, 16, "m%d", i+1);
+    _lmap_addname (H, buf, i, -1, 0, LMAP_METAL);
+  }
+  if (!(Technology::T->poly->getName()[0] == 'm' &&
+	isdigit (Technology::T->poly->getName()[1]))) {
+    _lmap_addname (H, Technology::T->poly->getName(), LMAP_LAYER_BASE,
+		   -1, 0, LMAP_POLY);
+  }
+  _lmap_addname (H, "$align", LMAP_LAYER_BASE, -1, 0, LMAP_ALIGN);
 
-    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, DIFF_OFFSET),
-		    Technology::T->diff[EDGE_NFET][i]);
+  _lmap = H;
+}
 
-    NEW (lp, struct LayoutLayermap);
-    lp->l = base;
-    lp->etype = EDGE_NFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_DIFF;
 
-    b = hash_add (lmap, Technology::T->diff[EDGE_NFET][i]->getName());
-    b->v = lp;
+Layout::Layout(netlist_t *_n)
+{
+  Layout::Init();
+  
+  /*-- create all the layers --*/
+  Assert (Technology::T, "Initialization error");
 
-    /* add via */
-    if (Technology::T->diff[EDGE_NFET][i]->getUpC()) {
+  N = _n;
+  _readrect = false;
 
-      if (!hash_lookup (lmap, Technology::T->diff[EDGE_NFET][i]->getUpC()->getName())) {
-	NEW (lp, struct LayoutLayermap);
-	lp->l = base;
-	lp->etype = EDGE_NFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_VIA;
+  nflavors = _nflavors;
+  nmetals = Technology::T->nmetals;
 
-	b = hash_add (lmap, Technology::T->diff[EDGE_NFET][i]->getUpC()->getName());
-	b->v = lp;
-      }
-    }
+  /* 1. base layer for diff, well, fets */
+  base = new Layer (Technology::T->poly, _n);
 
-    
+  /* 2. Also has #flavors*6 materials! */
+  base->allocOther (nflavors*6);
+  for (int i=0; i < nflavors; i++) {
+    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, FET_OFFSET),
+		    Technology::T->fet[EDGE_NFET][i]);
+    base->setOther (TOTAL_OFFSET(i, EDGE_PFET, FET_OFFSET),
+		    Technology::T->fet[EDGE_PFET][i]);
+    base->setOther (TOTAL_OFFSET(i, EDGE_NFET, DIFF_OFFSET),
+		    Technology::T->diff[EDGE_NFET][i]);
     base->setOther (TOTAL_OFFSET(i, EDGE_PFET, DIFF_OFFSET),
 		    Technology::T->diff[EDGE_PFET][i]);
-
-    NEW (lp, struct LayoutLayermap);
-    lp->l = base;
-    lp->etype = EDGE_PFET;
-    lp->flavor = i;
-    lp->lcase = LMAP_DIFF;
-
-    b = hash_add (lmap, Technology::T->diff[EDGE_PFET][i]->getName());
-    b->v = lp;
-
-    if (Technology::T->diff[EDGE_PFET][i]->getUpC()) {
-      if (!hash_lookup (lmap,
-			Technology::T->diff[EDGE_PFET][i]->getUpC()->getName())) {
-      
-	NEW (lp, struct LayoutLayermap);
-	lp->l = base;
-	lp->etype = EDGE_PFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_VIA;
-
-	b = hash_add (lmap, Technology::T->diff[EDGE_PFET][i]->getUpC()->getName());
-	b->v = lp;
-      }
-    }
-
-    
-
     base->setOther (TOTAL_OFFSET(i, EDGE_NFET, WDIFF_OFFSET),
 		    Technology::T->welldiff[EDGE_NFET][i]);
-
-    if (Technology::T->welldiff[EDGE_NFET][i]) {
-      NEW (lp, struct LayoutLayermap);
-      lp->l = base;
-      lp->etype = EDGE_NFET;
-      lp->flavor = i;
-      lp->lcase = LMAP_WDIFF;
-
-      b = hash_add (lmap, Technology::T->welldiff[EDGE_NFET][i]->getName());
-      b->v = lp;
-
-      if (Technology::T->welldiff[EDGE_NFET][i]->getUpC()) {
-	if (!hash_lookup (lmap, Technology::T->welldiff[EDGE_NFET][i]->getUpC()->getName())) {
-	  NEW (lp, struct LayoutLayermap);
-	  lp->l = base;
-	  lp->etype = EDGE_NFET;
-	  lp->flavor = i;
-	  lp->lcase = LMAP_VIA;
-
-	  b = hash_add (lmap, Technology::T->welldiff[EDGE_NFET][i]->getUpC()->getName());
-	  b->v = lp;
-	}
-      }
-    }
-
     base->setOther (TOTAL_OFFSET(i, EDGE_PFET, WDIFF_OFFSET),
 		    Technology::T->welldiff[EDGE_PFET][i]);
-
-    if (Technology::T->welldiff[EDGE_PFET][i]) {
-      NEW (lp, struct LayoutLayermap);
-      lp->l = base;
-      lp->etype = EDGE_PFET;
-      lp->flavor = i;
-      lp->lcase = LMAP_WDIFF;
-
-      b = hash_add (lmap, Technology::T->welldiff[EDGE_PFET][i]->getName());
-      b->v = lp;
-
-      if (Technology::T->welldiff[EDGE_PFET][i]->getUpC()) {
-	if (!hash_lookup (lmap, Technology::T->welldiff[EDGE_PFET][i]->getUpC()->getName())) {
-	  NEW (lp, struct LayoutLayermap);
-	  lp->l = base;
-	  lp->etype = EDGE_PFET;
-	  lp->flavor = i;
-	  lp->lcase = LMAP_VIA;
-
-	  b = hash_add (lmap, Technology::T->welldiff[EDGE_PFET][i]->getUpC()->getName());
-	  b->v = lp;
-	}
-      }
-    }
-    if (Technology::T->well[EDGE_NFET][i]) {
-      if (!hash_lookup (lmap, Technology::T->well[EDGE_NFET][i]->getName())) {
-	Assert (!extra[Layout::extra_layers::NFET_WELL+i*tl], "What?");
-	extra[Layout::extra_layers::NFET_WELL + i*tl] =
-	  new Layer (Technology::T->well[EDGE_NFET][i], _n);
-	NEW (lp, struct LayoutLayermap);
-	lp->l = extra[Layout::extra_layers::NFET_WELL+i*tl];
-	lp->etype = EDGE_NFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_NFET_WELL;
-	b = hash_add (lmap, Technology::T->well[EDGE_NFET][i]->getName());
-	b->v = lp;
-      }
-    }
-    if (Technology::T->well[EDGE_PFET][i]) {
-      if (!hash_lookup (lmap, Technology::T->well[EDGE_PFET][i]->getName())) {
-	Assert (!extra[Layout::extra_layers::PFET_WELL+i*tl], "What?");
-	extra[Layout::extra_layers::PFET_WELL+i*tl] =
-	  new Layer (Technology::T->well[EDGE_PFET][i], _n);
-	NEW (lp, struct LayoutLayermap);
-	lp->l = extra[Layout::extra_layers::PFET_WELL+i*tl];
-	lp->etype = EDGE_PFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_PFET_WELL;
-	b = hash_add (lmap, Technology::T->well[EDGE_PFET][i]->getName());
-	b->v = lp;
-      }
-    }
-    if (Technology::T->sel[EDGE_NFET][i]) {
-      if (!hash_lookup (lmap, Technology::T->sel[EDGE_NFET][i]->getName())) {
-	Assert (!extra[Layout::extra_layers::N_SELECT+i*tl], "What?");
-	extra[Layout::extra_layers::N_SELECT + i*tl] =
-	  new Layer (Technology::T->sel[EDGE_NFET][i], _n);
-	NEW (lp, struct LayoutLayermap);
-	lp->l = extra[Layout::extra_layers::N_SELECT+i*tl];
-	lp->etype = EDGE_NFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_NSELECT;
-	b = hash_add (lmap, Technology::T->sel[EDGE_NFET][i]->getName());
-	b->v = lp;
-      }
-    }
-    if (Technology::T->sel[EDGE_PFET][i]) {
-      if (!hash_lookup (lmap, Technology::T->sel[EDGE_PFET][i]->getName())) {
-	Assert (!extra[Layout::extra_layers::P_SELECT+i*tl], "What?");
-	extra[Layout::extra_layers::P_SELECT + i*tl] =
-	  new Layer (Technology::T->sel[EDGE_PFET][i], _n);
-	NEW (lp, struct LayoutLayermap);
-	lp->l = extra[Layout::extra_layers::P_SELECT+i*tl];
-	lp->etype = EDGE_PFET;
-	lp->flavor = i;
-	lp->lcase = LMAP_PSELECT;
-	b = hash_add (lmap, Technology::T->sel[EDGE_PFET][i]->getName());
-	b->v = lp;
-      }
-    }
   }
 
-  Layer *prev = base;
-
-  if (!hash_lookup (lmap, Technology::T->poly->getUpC()->getName())) {
-    NEW (lp, struct LayoutLayermap);
-    lp->l = base;
-    lp->etype = -1;
-    lp->flavor = 0;
-    lp->lcase = LMAP_VIA;
+  /* 3. extra layers
+        n_select, p_select, and two wells; these are only used by
+        .rect files, and are created on first use
+  */
+  extra = NULL;
 
-    b = hash_add (lmap, Technology::T->poly->getUpC()->getName());
-    b->v = lp;
-  }
+  Layer *prev = base;
 
   MALLOC (metals, Layer *, Technology::T->nmetals);
 
@@ -302,26 +251,9 @@ Layout::Layout(netlist_t *_n)
     metals[i] = new Layer (Technology::T->metal[i], _n);
     metals[i]->setDownLink (prev);
     prev = metals[i];
-
-    if (Technology::T->metal[i]->getUpC()) {
-      NEW (lp, struct LayoutLayermap);
-      lp->l = metals[i];
-      lp->etype = -1;
-      lp->flavor = 0;
-      lp->lcase = LMAP_VIA;
-
-      b = hash_add (lmap, Technology::T->metal[i]->getUpC()->getName());
-      b->v = lp;
-    }
   }
 
 
-  _rect_inpath = NULL;
-  if (config_exists ("lefdef.rect_inpath")) {
-    _rect_inpath = path_init ();
-    path_add (_rect_inpath, config_get_string ("lefdef.rect_inpath"));
-  }
-
   _le = new LayoutEdgeAttrib();
 }
 
@@ -337,18 +269,76 @@ Layout::~Layout()
     delete l;
   }
 
-  hash_free (lmap);
-
-  if (_rect_inpath) {
-    path_free (_rect_inpath);
-    _rect_inpath = NULL;
+  /* extra layers are not part of the up/down chain */
+  if (extra) {
+    for (int i=0; i < Layout::extra_layers::NUM_EXTRA*nflavors; i++) {
+      if (extra[i]) {
+	delete extra[i];
+      }
+    }
+    FREE (extra);
   }
+  FREE (metals);
 
   if (_le) {
     delete _le;
   }
 }
 
+Layer *Layout::_getExtra (int idx)
+{
+  int tl = Layout::extra_layers::NUM_EXTRA;
+
+  Assert (0 <= idx && idx < tl*nflavors, "Extra layer out of range");
+
+  if (!extra) {
+    MALLOC (extra, Layer *, tl*nflavors);
+    for (int i=0; i < tl*nflavors; i++) {
+      extra[i] = NULL;
+    }
+  }
+  if (!extra[idx]) {
+    int flavor = idx / tl;
+    Material *m;
+
+    switch (idx % tl) {
+    case Layout::extra_layers::N_SELECT:
+      m = Technology::T->sel[EDGE_NFET][flavor];
+      break;
+    case Layout::extra_layers::P_SELECT:
+      m = Technology::T->sel[EDGE_PFET][flavor];
+      break;
+    case Layout::extra_layers::NFET_WELL:
+      m = Technology::T->well[EDGE_NFET][flavor];
+      break;
+    default:
+      m = Technology::T->well[EDGE_PFET][flavor];
+      break;
+    }
+    Assert (m, "Extra layer without a material?");
+    extra[idx] = new Layer (m, N);
+  }
+  return extra[idx];
+}
+
+Layer *Layout::_lmapLayer (struct LayoutLayermap *lm)
+{
+  switch (lm->lcase) {
+  case LMAP_NSELECT:
+  case LMAP_PSELECT:
+  case LMAP_NFET_WELL:
+  case LMAP_PFET_WELL:
+    return _getExtra (lm->l);
+
+  default:
+    if (lm->l == LMAP_LAYER_BASE) {
+      return base;
+    }
+    Assert (0 <= lm->l && lm->l < nmetals, "What?");
+    return metals[lm->l];
+  }
+}
+
 
 FetMat *Layout::getFet (int type, int flavor)
 {
@@ -482,34 +472,35 @@ int Layout::DrawVia (int num, long llx, long lly, unsigned long wx, unsigned lon
 }
 
 
-void Layout::PrintRect (FILE *fp, TransformMat *t, bool istopcell)
+void Layout::PrintRect (RectWriter *w, TransformMat *t, bool istopcell)
 {
-  int sz = config_get_table_size ("act.dev_flavors");
-  base->PrintRect (fp, t);
+  base->PrintRect (w, t);
 
   /* print extra layers */
-  for (int i=0; i < sz*Layout::extra_layers::NUM_EXTRA; i++) {
+  for (int i=0; extra && i < nflavors*Layout::extra_layers::NUM_EXTRA; i++) {
     if (extra[i]) {
-      extra[i]->PrintRect (fp, t);
+      extra[i]->PrintRect (w, t);
     }
   }
 
   for (int i=0; i < nmetals; i++) {
-    metals[i]->PrintRect (fp, t);
+    metals[i]->PrintRect (w, t);
   }
   if (!_rbox.empty()) {
-    fprintf (fp, "sbox %ld %ld %ld %ld\n", _rbox.llx(),
-	     _rbox.lly(), _rbox.urx()+1, _rbox.ury()+1);
+    w->box (RECT_REC_SBOX, _rbox.llx(), _rbox.lly(),
+	    _rbox.urx()+1, _rbox.ury()+1);
   }
   if (istopcell) {
     Assert(t == NULL, "printing alignment with a global transformation matrix is not supported yet");
     if (!_abutbox.empty()) {
-      fprintf (fp, "rect # $align %ld %ld %ld %ld\n", _abutbox.llx(),
-	       _abutbox.lly(), _abutbox.urx()+1, _abutbox.ury()+1);
+      w->rect (RECT_REC_RECT, NULL, "$align",
+	       _abutbox.llx(), _abutbox.lly(),
+	       _abutbox.urx()+1, _abutbox.ury()+1);
     }
     LayoutEdgeAttrib::attrib_list *l;
 
     long llx, lly, urx, ury;
+    char buf[1024];
 
     if (_abutbox.empty()) {
       llx = 0;
@@ -526,20 +517,20 @@ void Layout::PrintRect (FILE *fp, TransformMat *t, bool istopcell)
 
     if (_le) {
       for (l = _le->left(); l; l = l->next) {
-        fprintf (fp, "rect $l:%s $align %ld %ld %ld %ld\n",
-	         l->name, llx, l->offset, llx, l->offset);
+	snprintf (buf, 1024, "$l:%s", l->name);
+	w->rect (RECT_REC_RECT, buf, "$align", llx, l->offset, llx, l->offset);
       }
       for (l = _le->right(); l; l = l->next) {
-        fprintf (fp, "rect $r:%s $align %ld %ld %ld %ld\n",
-	         l->name, urx, l->offset, urx, l->offset);
+	snprintf (buf, 1024, "$r:%s", l->name);
+	w->rect (RECT_REC_RECT, buf, "$align", urx, l->offset, urx, l->offset);
       }
       for (l = _le->top(); l; l = l->next) {
-        fprintf (fp, "rect $t:%s $align %ld %ld %ld %ld\n",
-	         l->name, l->offset, ury, l->offset, ury);
+	snprintf (buf, 1024, "$t:%s", l->name);
+	w->rect (RECT_REC_RECT, buf, "$align", l->offset, ury, l->offset, ury);
       }
       for (l = _le->bot(); l; l = l->next) {
-        fprintf (fp, "rect $b:%s $align %ld %ld %ld %ld\n",
-	         l->name, l->offset, lly, l->offset, lly);
+	snprintf (buf, 1024, "$b:%s", l->name);
+	w->rect (RECT_REC_RECT, buf, "$align", l->offset, lly, l->offset, lly);
       }
     }
   }
@@ -728,17 +719,68 @@ static void printtile (FILE *fp, Tile *t)
 	  t->geturx(), t->getury());
 }
 
+/*
+  Disjoint-set forest over tile indices, used for net propagation
+*/
+static int _uf_find (int *parent, int x)
+{
+  int r = x;
+
+  while (parent[r] != r) {
+    r = parent[r];
+  }
+  /* path compression */
+  while (parent[x] != r) {
+    int nx = parent[x];
+    parent[x] = r;
+    x = nx;
+  }
+  return r;
+}
+
+static void _uf_union (int *parent, int *rank, int x, int y)
+{
+  x = _uf_find (parent, x);
+  y = _uf_find (parent, y);
+  if (x == y) return;
+
+  if (rank[x] < rank[y]) {
+    parent[x] = y;
+  }
+  else if (rank[x] > rank[y]) {
+    parent[y] = x;
+  }
+  else {
+    parent[y] = x;
+    rank[x]++;
+  }
+}
+
 /*
   Propagate net labels across the layout
+
+  All the non-space tiles on all layers are numbered and placed in a
+  disjoint-set forest. Tiles are merged with their connected
+  neighbors within a layer, and via tiles are merged with the tiles
+  above and below them. Each connected component then receives the
+  net of the first labelled tile in it, and any other net found in
+  the same component is reported as a short.
 */
 void Layout::propagateAllNets ()
 {
   Layer *L;
   listitem_t *li;
-  int flag;
-  int rep;
-
   list_t **tl;
+  int ntiles;
+  
+  Tile **tiles;			// tile for each index
+  int *tlayer;			// layer # for each index
+  int *parent, *rank;		// disjoint-set forest
+  void **cnet;			// net for each component root
+  int *clayer;			// layer # where the net was found
+  struct pHashtable *tidx;	// tile to index map
+  struct pHashtable *shorts;	// net to component already reported
+  phash_bucket_t *b;
 
   // No netlist, so there are no nets to propagate! Quit here
   if (!N || !N->bN) return;
@@ -764,195 +806,174 @@ void Layout::propagateAllNets ()
     }
   }
 
-  do {
-    rep = 0;
-    L = base;
+  ntiles = 0;
+  for (int i=0; i < 2*nmetals + 1; i++) {
+    ntiles += list_length (tl[i]);
+  }
+
+  if (ntiles == 0) {
     for (int i=0; i < 2*nmetals + 1; i++) {
-      Assert (L, "What?");
-      if ((i & 1) == 0) {
-	/* a horizontal layer; propagate within the layer */
-	do {
-	  flag = 0;
-	  for (li = list_first (tl[i]); li; li = list_next (li)) {
-	    Tile *t = (Tile *) list_value (li);
-	    Tile *neighbors[4];
-	    neighbors[0] = t->llxTile();
-	    neighbors[1] = t->llyTile();
-	    neighbors[2] = t->urxTile();
-	    neighbors[3] = t->uryTile();
-	    if (t->getNet()) {
-	      for (int k=0; k < 4; k++) {
-		if (Tile::isConnected (L, t, neighbors[k])) {
-		  if (neighbors[k]->getNet()) {
-		    if (t->getNet() != neighbors[k]->getNet()) {
-		      //warning ("[%s] Layer::propagateNet(): Tile at (%ld,%d)\n\t connected neighbor (dir=%d) with different net", N->bN->p->getName(),
-		      //t->getllx(), t->getlly(), k);
-		      warning ("[%s] Net propagation detected two nets are shorted.", N->bN->p->getName());
-		      fprintf (stderr, "\tnet1: ");
-		      ActNetlistPass::emit_node (N, stderr, (node_t *)t->getNet(), NULL, NULL);
-		      fprintf (stderr, "; net2: ");
-		      ActNetlistPass::emit_node (N, stderr, (node_t *)neighbors[k]->getNet(), NULL, NULL);
-		      fprintf (stderr, "\n");
-		    }
-		  }
-		  else {
-		    neighbors[k]->setNet (t->getNet());
-		    flag = 1;
-		    rep = 1;
-		  }
-		}
-	      }
-	    }
-	    else {
-	      for (int k=0; k < 4; k++) {
-		if (Tile::isConnected (L, t, neighbors[k])) {
-		  if (neighbors[k]->getNet()) {
-		    t->setNet (neighbors[k]->getNet());
-		    flag = 1;
-		    rep = 1;
-		    break;
-		  }
-		}
-	      }
+      list_free (tl[i]);
+    }
+    FREE (tl);
+    return;
+  }
+
+  /* number the tiles */
+  MALLOC (tiles, Tile *, ntiles);
+  MALLOC (tlayer, int, ntiles);
+  MALLOC (parent, int, ntiles);
+  MALLOC (rank, int, ntiles);
+  tidx = phash_new (8);
+
+  ntiles = 0;
+  for (int i=0; i < 2*nmetals + 1; i++) {
+    for (li = list_first (tl[i]); li; li = list_next (li)) {
+      Tile *t = (Tile *) list_value (li);
+      tiles[ntiles] = t;
+      tlayer[ntiles] = i;
+      parent[ntiles] = ntiles;
+      rank[ntiles] = 0;
+      b = phash_add (tidx, t);
+      b->i = ntiles;
+      ntiles++;
+    }
+  }
+
+  /* merge connected tiles */
+  L = base;
+  for (int i=0; i < 2*nmetals + 1; i++) {
+    Assert (L, "What?");
+    if ((i & 1) == 0) {
+      /* a horizontal layer; connect tiles within the layer */
+      for (li = list_first (tl[i]); li; li = list_next (li)) {
+	Tile *t = (Tile *) list_value (li);
+	Tile *neighbors[4];
+	int idx;
+	neighbors[0] = t->llxTile();
+	neighbors[1] = t->llyTile();
+	neighbors[2] = t->urxTile();
+	neighbors[3] = t->uryTile();
+
+	b = phash_lookup (tidx, t);
+	Assert (b, "What?");
+	idx = b->i;
+	
+	for (int k=0; k < 4; k++) {
+	  if (neighbors[k] && Tile::isConnected (L, t, neighbors[k])) {
+	    b = phash_lookup (tidx, neighbors[k]);
+	    if (b) {
+	      _uf_union (parent, rank, idx, b->i);
 	    }
 	  }
-	} while (flag);
+	}
       }
-      else {
-	/* via layer: look at layers above and below and
-	   inherit/propagate labels to directly connected tiles */
-	for (li = list_first (tl[i]); li; li = list_next (li)) {
-	  Tile *t = (Tile *) list_value (li);
-	  Tile *up, *dn;
-	  Assert (L->up, "What?");
-	  Assert (L, "What?");
-	  up = L->up->find (t->getllx(), t->getlly());
-	  dn = L->find (t->getllx(), t->getlly());
-
-	  if (up->isSpace()) {
-	    warning ("[%s] Missing upper metal %d layer at (%ld,%ld)?",
+    }
+    else {
+      /* via layer: connect each via to the tiles directly above and
+	 below it */
+      for (li = list_first (tl[i]); li; li = list_next (li)) {
+	Tile *t = (Tile *) list_value (li);
+	Tile *up, *dn;
+	int idx;
+	Assert (L->up, "What?");
+	up = L->up->find (t->getllx(), t->getlly());
+	dn = L->find (t->getllx(), t->getlly());
+
+	if (up->isSpace()) {
+	  warning ("[%s] Missing upper metal %d layer at (%ld,%ld)?",
+		   N->bN->p->getName(),
+		   (i+1)/2, t->getllx(), t->getlly ());
+	  continue;
+	}
+	if (dn->isSpace()) {
+	  if (i == 1) {
+	    warning ("[%s] Missing lower base layer at (%ld,%ld)?",
 		     N->bN->p->getName(),
-		     (i+1)/2, t->getllx(), t->getlly ());
-	    continue;
+		     t->getllx(), t->getlly());
 	  }
-	  if (dn->isSpace()) {
-	    if (i == 1) {
-	      warning ("[%s] Missing lower base layer at (%ld,%ld)?",
-		       N->bN->p->getName(),
-		       t->getllx(), t->getlly());
-	    }
-	    else {
-	      warning ("[%s] Missing lower metal %d layer at (%ld,%ld)?",
-		       N->bN->p->getName(),
-		       (i-1)/2, t->getllx(), t->getlly ());
-	    }
-	    continue;
+	  else {
+	    warning ("[%s] Missing lower metal %d layer at (%ld,%ld)?",
+		     N->bN->p->getName(),
+		     (i-1)/2, t->getllx(), t->getlly ());
 	  }
+	  continue;
+	}
 
-#define CHK_EQUAL(x,y)  ((x)->getNet() == (y)->getNet())
-	  
-#if 0
-	  fprintf (stderr, "[%s] here %d, via=%d, up=%d, dn=%d ", 
-		   N->bN->p->getName(), i,
-		   t->getNet() ? 1 : 0,
-		   up->getNet() ? 1 : 0,
-		   dn->getNet() ? 1 : 0);
-	  printtile (stderr, t);
-#endif
-
-	  if (!(CHK_EQUAL(dn,t) && CHK_EQUAL (up,t) && CHK_EQUAL (up,dn))) {
-	    void *propnet = NULL;
-	    if (dn->getNet()) {
-	      propnet = dn->getNet();
-	    }
-	    if (up->getNet()) {
-	      if (propnet && propnet != up->getNet()) {
-		//warning ("[%s] Layer::propagateNet(): Tile at (%ld,%d) has connected neighbor (dir=up) with different net", N->bN->p->getName(),
-		//t->getllx(), t->getlly());
-		warning ("[%s] Net propagation detected two nets are shorted across layers.", N->bN->p->getName());
-		fprintf (stderr, "\tnet1: ");
-		ActNetlistPass::emit_node (N, stderr, (node_t *)propnet, NULL, NULL);
-		fprintf (stderr, "; net2: ");
-		ActNetlistPass::emit_node (N, stderr, (node_t *)up->getNet(), NULL, NULL);
-		fprintf (stderr, "\n");
-	      }
-	      else {
-		propnet = up->getNet();
-	      }
-	    }
-	    if (t->getNet()) {
-	      if (propnet && propnet != t->getNet()) {
-		//warning ("[%s] Layer::propagateNet(): Via tile at (%ld,%d) has connected neighbor with different net", N->bN->p->getName(),
-		//t->getllx(), t->getlly());
-		warning ("[%s] Net propagation detected two nets are shorted.", N->bN->p->getName());
-		fprintf (stderr, "\tnet1: ");
-		ActNetlistPass::emit_node (N, stderr, (node_t *)propnet, NULL, NULL);
-		fprintf (stderr, "; net2: ");
-		ActNetlistPass::emit_node (N, stderr, (node_t *)t->getNet(), NULL, NULL);
-		fprintf (stderr, "\n");
-	      }
-	      else {
-		propnet = t->getNet();
-	      }
-	    }
+	b = phash_lookup (tidx, t);
+	Assert (b, "What?");
+	idx = b->i;
 
-	    if (propnet) {
-#if 0	      
-	      fprintf (stderr, "[%s] propnet: ", N->bN->p->getName());
-	      ActNetlistPass::emit_node (N, stderr, (node_t *)propnet, NULL, NULL);
-#endif	      
-	      if (!dn->getNet()) {
-#if 0		
-		fprintf (stderr, " dn");
-#endif
-		dn->setNet(propnet);
-		rep = 1;
-	      }
-	      if (!t->getNet()) {
-#if 0		
-		fprintf (stderr, " via");
-#endif		
-		t->setNet (propnet);
-		rep = 1;
-	      }
-	      if (!up->getNet()) {
-#if 0		
-		fprintf (stderr, " up");
-#endif		
-		up->setNet (propnet);
-		rep = 1;
-	      }
-#if 0	      
-	      fprintf (stderr, "\n");
-#endif	      
-	    }
-	  }
-	  else {
-#if 0	    
-	    fprintf (stderr, "  -> nothing to do\n");
-	    if (t->getNet()) {
-	      fprintf (stderr, "  via:");
-	      ActNetlistPass::emit_node (N, stderr, (node_t *)t->getNet(), NULL, NULL);
-	      printtile (stderr, t);
-	    }
-	    if (up->getNet()) {
-	      fprintf (stderr, " up:");
-	      ActNetlistPass::emit_node (N, stderr, (node_t *)up->getNet(), NULL, NULL);
-	      printtile (stderr, up);
-	    }
-	    if (dn->getNet()) {
-	      fprintf (stderr, " dn:");
-	      ActNetlistPass::emit_node (N, stderr, (node_t *)dn->getNet(), NULL, NULL);
-	      printtile (stderr, dn);
-	    }
-	    fprintf (stderr, "\n");
-#endif	    
-	  }
+	b = phash_lookup (tidx, up);
+	if (b) {
+	  _uf_union (parent, rank, idx, b->i);
 	}
-	L = L->up;
+	b = phash_lookup (tidx, dn);
+	if (b) {
+	  _uf_union (parent, rank, idx, b->i);
+	}
+      }
+      L = L->up;
+    }
+  }
+
+  /* pick a net for each component, and report shorts */
+  MALLOC (cnet, void *, ntiles);
+  MALLOC (clayer, int, ntiles);
+  for (int k=0; k < ntiles; k++) {
+    cnet[k] = NULL;
+    clayer[k] = -1;
+  }
+  shorts = NULL;
+
+  for (int k=0; k < ntiles; k++) {
+    void *net = tiles[k]->getNet();
+    int r;
+    if (!net) continue;
+
+    r = _uf_find (parent, k);
+    if (!cnet[r]) {
+      cnet[r] = net;
+      clayer[r] = tlayer[k];
+    }
+    else if (cnet[r] != net) {
+      /* only report each net once per component */
+      if (!shorts) {
+	shorts = phash_new (4);
+      }
+      b = phash_lookup (shorts, net);
+      if (b && b->i == r) {
+	continue;
+      }
+      if (!b) {
+	b = phash_add (shorts, net);
+      }
+      b->i = r;
+      
+      if (clayer[r] != tlayer[k]) {
+	warning ("[%s] Net propagation detected two nets are shorted across layers.", N->bN->p->getName());
       }
+      else {
+	warning ("[%s] Net propagation detected two nets are shorted.", N->bN->p->getName());
+      }
+      fprintf (stderr, "\tnet1: ");
+      ActNetlistPass::emit_node (N, stderr, (node_t *)cnet[r], NULL, NULL);
+      fprintf (stderr, "; net2: ");
+      ActNetlistPass::emit_node (N, stderr, (node_t *)net, NULL, NULL);
+      fprintf (stderr, "\n");
     }
-  } while (rep);
+  }
+
+  /* label all the unlabelled tiles */
+  for (int k=0; k < ntiles; k++) {
+    if (!tiles[k]->getNet()) {
+      tiles[k]->setNet (cnet[_uf_find (parent, k)]);
+    }
+  }
+  base->_gen++;
+  for (int i=0; i < nmetals; i++) {
+    metals[i]->_gen++;
+  }
 
 #if 1
   for (int i=0; i < nmetals; i++) {
@@ -966,12 +987,56 @@ void Layout::propagateAllNets ()
   }
 #endif  
 
+  if (shorts) {
+    phash_free (shorts);
+  }
+  phash_free (tidx);
+  FREE (cnet);
+  FREE (clayer);
+  FREE (tiles);
+  FREE (tlayer);
+  FREE (parent);
+  FREE (rank);
+
   for (int i=0; i < 2*nmetals + 1; i++) {
     list_free (tl[i]);
   }
   FREE (tl);
 }
 
+void Layout::getTileStats (struct layout_tile_stats *s)
+{
+  s->ntiles = 0;
+  s->peak = 0;
+  s->bytes = 0;
+  s->nfind = 0;
+  s->nhops = 0;
+  s->nmerged = 0;
+
+  base->addTileStats (s);
+  for (int i=0; extra && i < Layout::extra_layers::NUM_EXTRA*nflavors; i++) {
+    if (extra[i]) {
+      extra[i]->addTileStats (s);
+    }
+  }
+  for (int i=0; i < nmetals; i++) {
+    metals[i]->addTileStats (s);
+  }
+}
+
+void Layout::mergeTiles ()
+{
+  base->mergeTiles ();
+  for (int i=0; extra && i < Layout::extra_layers::NUM_EXTRA*nflavors; i++) {
+    if (extra[i]) {
+      extra[i]->mergeTiles ();
+    }
+  }
+  for (int i=0; i < nmetals; i++) {
+    metals[i]->mergeTiles ();
+  }
+}
+
 list_t *Layout::searchAllMetal ()
 {
   list_t *ret = list_new ();
@@ -1097,8 +1162,8 @@ void TransformMat::mirror45()
   _flipy = 1 - _flipy;
 
   tmp = _dx;
-  _dx = _dy;
-  _dy = tmp;
+  _dx = -_dy;
+  _dy = -tmp;
 }
 
 void TransformMat::translate (long dx, long dy)
@@ -1120,19 +1185,40 @@ void TransformMat::apply (long inx, long iny, long *outx, long *outy) const
   }
 }
 
+/*
+ * Compose: the result is this transformation followed by t. The
+ * orientation of the result is read off the images of the unit
+ * vectors, so any combination of flips and swaps composes
+ * correctly.
+ */
 void TransformMat::applyMat (const TransformMat &t)
 {
-  if (t._swap) {
-    mirror45();
+  long ox, oy, ax, ay, bx, by, x, y;
+
+  t.apply (_dx, _dy, &ox, &oy);
+  apply (1, 0, &x, &y);
+  t.apply (x, y, &ax, &ay);
+  apply (0, 1, &x, &y);
+  t.apply (x, y, &bx, &by);
+  ax -= ox;
+  ay -= oy;
+  bx -= ox;
+  by -= oy;
+
+  if (ax != 0) {
+    /* x stays x */
+    _swap = 0;
+    _flipx = (ax < 0);
+    _flipy = (by < 0);
   }
-  if (t._flipx) {
-    mirrorLR();
-  }
-  if (t._flipy) {
-    mirrorTB();
+  else {
+    /* x goes to y */
+    _swap = 1;
+    _flipx = (ay < 0);
+    _flipy = (bx < 0);
   }
-  _dx += t._dx;
-  _dy += t._dy;
+  _dx = ox;
+  _dy = oy;
 }
 
 Rectangle TransformMat::applyBox (const Rectangle &r) const
@@ -1161,6 +1247,47 @@ Rectangle TransformMat::applyBox (const Rectangle &r) const
   return ret;
 }
 
+void TransformMat::applyInverse (long inx, long iny,
+				 long *outx, long *outy) const
+{
+  inx -= _dx;
+  iny -= _dy;
+  if (_swap) {
+    *outx = _flipx ? -iny : iny;
+    *outy = _flipy ? -inx : inx;
+  }
+  else {
+    *outx = _flipx ? -inx : inx;
+    *outy = _flipy ? -iny : iny;
+  }
+}
+
+Rectangle TransformMat::applyInverseBox (const Rectangle &r) const
+{
+  long llx, lly, urx, ury;
+  Rectangle ret;
+
+  if (r.empty()) {
+    return ret;
+  }
+
+  applyInverse (r.llx(), r.lly(), &llx, &lly);
+  applyInverse (r.urx(), r.ury(), &urx, &ury);
+
+  if (llx > urx) {
+    long tmp = llx;
+    llx = urx;
+    urx = tmp;
+  }
+  if (lly > ury) {
+    long tmp = lly;
+    lly = ury;
+    ury = tmp;
+  }
+  ret.setRect (llx, lly, urx - llx + 1, ury - lly + 1);
+  return ret;
+}
+
 void TransformMat::Print (FILE *fp) const
 {
   fprintf (fp, "{");
@@ -1176,7 +1303,7 @@ void TransformMat::Print (FILE *fp) const
   fprintf (fp, " dx=%ld dy=%ld }", _dx, _dy);
 }
 
-void TransformMat::PrintRect (FILE *fp) const
+void TransformMat::sPrintRect (char *buf, int sz) const
 {
   // bit vector is flipx flipy swap
   //  000 = N
@@ -1190,7 +1317,8 @@ void TransformMat::PrintRect (FILE *fp) const
   const char *val[] =
     { "N", "FW", "FS", "W", "FN", "E", "S", "FE" };
 
-  fprintf (fp, "%s %ld %ld", val[_swap|(_flipy << 1)|(_flipx<<2)], _dx, _dy);
+  snprintf (buf, sz, "%s %ld %ld", val[_swap|(_flipy << 1)|(_flipx<<2)],
+	    _dx, _dy);
 }
 
 
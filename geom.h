@@ -29,6 +29,8 @@
 #include "tile.h"
 #include "attrib.h"
 
+class BufWriter;
+class RectWriter;
 
 /*
  * Geometry transformation matrix
@@ -54,10 +56,21 @@ public:
 
   Rectangle applyBox (const Rectangle &r) const;
 
+  // inverse of apply()/applyBox()
+  void applyInverse (long inx, long iny, long *outx, long *outy) const;
+  Rectangle applyInverseBox (const Rectangle &r) const;
+
   void applyMat (const TransformMat &t);
 
+  bool operator== (const TransformMat &t) const {
+    return _dx == t._dx && _dy == t._dy && _flipx == t._flipx &&
+      _flipy == t._flipy && _swap == t._swap;
+  }
+
   void Print (FILE *fp) const;
-  void PrintRect (FILE *fp) const;
+
+  // .rect format: "<orientation> <dx> <dy>"
+  void sPrintRect (char *buf, int sz) const;
 
   // reads transform matrix
   static TransformMat ReadRect (FILE *fp);
@@ -68,6 +81,32 @@ public:
 };
 
 
+/*
+ * Tile allocation and point-location statistics
+ */
+struct layout_tile_stats {
+  unsigned long ntiles;		// # of tiles in use
+  unsigned long peak;		// peak # of tiles in use
+  unsigned long bytes;		// memory held by the tile pools
+  unsigned long nfind;		// # of point-location queries
+  unsigned long nhops;		// # of tile stitches followed by them
+  unsigned long nmerged;	// # of tiles removed by merging
+};
+
+
+/*
+ * A rectangle to be drawn by Layer::DrawBatch()
+ */
+struct layer_rect {
+  long llx, lly;
+  unsigned long wx, wy;
+  void *net;
+  int attr;
+  unsigned int via:1;		// 1 = via plane, 0 = material plane
+  unsigned int ok:1;		// set to 1 if the rectangle was drawn
+};
+
+
 /*
  * One abstract layer
  */
@@ -80,6 +119,20 @@ protected:
 
   Tile *vhint;			// tile layer containing vias to the
  				// next (upper) layer
+
+  TilePool *pool;		// storage for all tiles in hint and vhint
+
+  Tile *_last, *_vlast;		// last tile drawn/found in hint and
+				// vhint; used as the starting point
+				// for the next point-location query
+
+  unsigned long _nfind, _nhops;	// point-location statistics
+  unsigned long _nmerged;	// # of tiles removed by mergeTiles()
+  unsigned long _gen;		// incremented whenever the tiles change
+
+  static int _use_locality;	// 0 = always search from hint/vhint
+
+  int _paint (Tile *x, void *net, int attr);
   
   Layer *up, *down;		/* layer above and below */
   
@@ -88,13 +141,17 @@ protected:
 
   netlist_t *N;
 
-  unsigned int bbox:1;		// 1 if bbox below is valid
+  unsigned int bbox:1;		// 1 if bbox below is valid; it is
+				// extended as tiles are painted
   long _llx, _lly, _urx, _ury;
   long _bllx, _blly, _burx, _bury; // bloated bbox
   /* BBox with spacing on all sides 
      This bloats the bounding box by ceil(minimum spacing/2) on all sides.
   */
 
+  long _bloat (unsigned int attr);
+  void _addBBox (Tile *t);
+
  public:
   Layer (Material *, netlist_t *);
   ~Layer ();
@@ -107,6 +164,10 @@ protected:
   int Draw (long llx, long lly, unsigned long wx, unsigned long wy, int type = 0);
   int DrawVirt (int flavor, int type, long llx, long lly, unsigned long wx, unsigned long wy);
 
+  /* draw n rectangles in the order given; sets r[i].ok and returns
+     the number of rectangles drawn */
+  int DrawBatch (int n, struct layer_rect *r);
+
   int drawVia (long llx, long lly, unsigned long wx, unsigned long wy, void *net, int type = 0);
   int drawVia (long llx, long lly, unsigned long wx, unsigned long wy, int type = 0);
 
@@ -125,7 +186,7 @@ protected:
   void getBBox (long *llx, long *lly, long *urx, long *ury);
   void getBloatBBox (long *llx, long *lly, long *urx, long *ury);
 
-  void PrintRect (FILE *fp, TransformMat *t = NULL);
+  void PrintRect (RectWriter *w, TransformMat *t = NULL);
 
   const char *getRouteName() {
     RoutingMat *rmat = dynamic_cast<RoutingMat *> (mat);
@@ -140,11 +201,20 @@ protected:
 
   Tile *find (long x, long y);
 
+  /* merge tiles into maximal horizontal strips */
+  void mergeTiles ();
+
+  /* accumulate tile statistics into s */
+  void addTileStats (struct layout_tile_stats *s);
+
+  static void setLocality (int v) { _use_locality = v; }
+
   friend class Layout;
   friend class LayoutBlob;
 };
 
 class LayoutBlob;
+struct LayoutLayermap;
 
 class Layout {
 public:
@@ -203,7 +273,7 @@ public:
   void getBBox (long *llx, long *lly, long *urx, long *ury);
   void getBloatBBox (long *llx, long *lly, long *urx, long *ury);
 
-  void PrintRect (FILE *fp, TransformMat *t = NULL, bool istopcell=true);
+  void PrintRect (RectWriter *w, TransformMat *t = NULL, bool istopcell=true);
 
   list_t *search (void *net);
   list_t *search (int attr);
@@ -211,6 +281,14 @@ public:
 
   void propagateAllNets();
 
+  /* tile statistics, summed over all layers */
+  void getTileStats (struct layout_tile_stats *s);
+
+  /* merge tiles on all layers into maximal horizontal strips; this
+     is done after construction if lefdef.tile_merge is set */
+  void mergeTiles ();
+  static int mergeEnabled () { return _tile_merge; }
+
   bool readRectangles() { return _readrect; }
 
   void flushBBox() { _rbox.clear(); }
@@ -239,17 +317,24 @@ private:
   LayoutEdgeAttrib *_le;	// alignment information
 
   Layer *base;
-  Layer **extra;      // extra layers, used for pass-through materials
+  Layer **extra;      // extra layers, used for pass-through
+		      // materials; created on first use
   Layer **metals;
   int nflavors;
   int nmetals;
   netlist_t *N;
-  struct Hashtable *lmap;	// map from layer string to base layer
-				// name
 
-  path_info_t *_rect_inpath;	// input path for rectangles, if any
+  Layer *_getExtra (int idx);	// extra layer, allocated if needed
+  Layer *_lmapLayer (struct LayoutLayermap *lm);
 
   static double _leak_adjust;
+  static int _tile_merge;
+
+  static int _nflavors;
+  static struct Hashtable *_lmap; // map from material name to
+				  // LayoutLayermap, shared by all
+				  // layouts
+  static void _initLayermap ();
 
   friend class LayoutBlob;
 };
@@ -285,6 +370,30 @@ struct tile_listentry {
 		      list of tiles  */
 };
 
+/*
+ * Flattened search results: the transformed rectangles for a net or
+ * attribute, in the same order as LayoutBlob::search(). Rectangles
+ * from the same Layout have the same blk number.
+ */
+struct blob_rect {
+  long llx, lly, urx, ury;	// llx <= urx, lly <= ury
+  Tile *t;
+  Layer *l;
+  int blk;
+  unsigned int via:1;		// 1 if the tile is on the via plane
+};
+
+struct blob_rects {
+  A_DECL (struct blob_rect, r);
+
+  /* for nets: total fet and diffusion area on the base layer, in
+     square microns (for LEF antenna information) */
+  double gate_area, diff_area;
+};
+
+struct blob_index;
+struct blob_query;
+
 
 class LayoutBlob {
 private:
@@ -315,7 +424,16 @@ private:
 
   bool readRect;
 
-  void _printRect (FILE *fp, TransformMat *t, bool istopcell = true);
+  struct blob_index *_idx;	// cached search index, if any
+
+  void _printRect (RectWriter *w, TransformMat *t, bool istopcell = true);
+
+  void _indexStamp (unsigned long *gen, int *nblk);
+  void _indexBuild (struct blob_index *I, TransformMat *m, int *blk);
+  struct blob_index *_getIndex (TransformMat *m);
+  void _freeIndex ();
+
+  void _query (struct blob_query *q, TransformMat *m);
   
 public:
   LayoutBlob (blob_type type, Layout *l = NULL);
@@ -337,7 +455,9 @@ public:
   void markRead () { readRect = true; }
   bool getRead() { return readRect; }
   
+  /* the FILE version writes the text format */
   void PrintRect (FILE *fp, TransformMat *t = NULL, bool istopcell = true);
+  void PrintRect (RectWriter *w, TransformMat *t = NULL, bool istopcell = true);
 
   /**
    * Computes the actual bounding box of the layout blob
@@ -365,7 +485,8 @@ public:
    *  @param m should not be used at the top-level, but provides the
    *  current transformatiom matrix used by the recursive call to the
    *  search function.
-   *  @return a list_t of tile_listentry tiles.
+   *  @return a list_t of tile_listentry tiles. Subcell arrays
+   *  contribute one entry per array element.
    */
   list_t *search (void *net, TransformMat *m = NULL);
   list_t *search (int type, TransformMat *m = NULL); // this is for
@@ -380,6 +501,34 @@ public:
 			  long *bury);
   static void searchFree (list_t *tiles);
 
+  /**
+   * Same as search(), but the results come from an index of the
+   * blob that is built on the first call and kept until the blob
+   * (or the transformation matrix) changes. The result must not be
+   * freed, and is valid until the blob is modified.
+   */
+  const struct blob_rects *searchIndex (void *net, TransformMat *m = NULL);
+  const struct blob_rects *searchIndex (int type, TransformMat *m = NULL);
+  static void searchBBox (const struct blob_rects *r, long *bllx, long *blly,
+			  long *burx, long *bury);
+
+  /**
+   * Region query: calls f(cookie, r) for every non-space tile on the
+   * base and metal layers that overlaps window. r is the tile
+   * transformed into the coordinates of this blob, and r->blk
+   * numbers the layouts visited by this query. Children whose
+   * bounding box does not overlap the window are skipped, and within
+   * a layout only the tiles under the window are visited.
+   */
+  void query (const Rectangle &window, void *cookie,
+	      void (*f) (void *, const struct blob_rect *));
+  template<class F>
+  void query (const Rectangle &window, F f) {
+    query (window, &f, [] (void *cookie, const struct blob_rect *r) {
+	(*(F *)cookie) (r);
+      });
+  }
+
   /**
    * Get abutment box
    */
@@ -393,9 +542,12 @@ public:
   /**
    * Stats 
    */
-  void incCount () { count++; }
+  void incCount (unsigned long n = 1) { count += n; }
   unsigned long getCount () { return count; }
 
+  /* tile statistics; does not descend into subcells */
+  void getTileStats (struct layout_tile_stats *s);
+
   /**
    * Alignment markers
    */
@@ -464,11 +616,189 @@ public:
 #define LMAP_NSELECT 6
 #define LMAP_PSELECT 7
 
+#define LMAP_METAL 8		// m<n>
+#define LMAP_POLY 9
+#define LMAP_ALIGN 10		// $align
+
+#define LMAP_LAYER_BASE -1
+
 struct LayoutLayermap {
-  Layer *l;
+  int l;			/* vias: layer below the via,
+				   LMAP_LAYER_BASE or metal index;
+				   metals: metal index;
+				   wells/selects: extra layer index */
   int etype;			/* n/p, if needed */
   int flavor;			/* flavor */
-  unsigned int lcase:3;  // LMAP_<what> is it?
+  unsigned int lcase:4;  // LMAP_<what> is it?
+};
+
+
+/*
+ * Buffered output for the .rect/LEF/DEF writers. Numbers are
+ * formatted directly into the buffer; putfixed() produces the same
+ * text as "%.6f". Node names are formatted once and cached.
+ */
+#define BUFWRITER_SIZE (1 << 16)
+
+class BufWriter {
+ private:
+  FILE *_fp;
+  char *_buf;
+  int _sz;
+  int _n;			// bytes in the buffer
+
+  struct pHashtable *_names;	// node_t * -> cached name
+
+  void _fixed_slow (double v);
+
+ public:
+  BufWriter (FILE *fp, int sz = BUFWRITER_SIZE);
+  ~BufWriter ();		// flushes the buffer; the file is not closed
+
+  void put (char c) {
+    if (_n == _sz) {
+      flush ();
+    }
+    _buf[_n++] = c;
+  }
+  void put (const char *s);
+  void putlong (long v);
+  void putfixed (double v);
+
+  /* " llx lly urx ury" */
+  void putcoords (long llx, long lly, long urx, long ury) {
+    put (' '); putlong (llx);
+    put (' '); putlong (lly);
+    put (' '); putlong (urx);
+    put (' '); putlong (ury);
+  }
+
+  /* name-mangled string */
+  void putmangle (Act *a, const char *s);
+
+  /* same format as the netlist dump: id, Vdd, GND, or #<num> */
+  void putnode (netlist_t *N, node_t *n);
+  const char *nodename (netlist_t *N, node_t *n); // valid until the
+						   // writer is deleted
+
+  void printf (const char *fmt, ...);
+
+  void flush ();
+  FILE *file () { return _fp; }
+};
+
+
+/*
+ * .rect files come in two formats: text (.rect) and binary
+ * (.rectb). The format is chosen by the file name extension.
+ *
+ * Binary format: the 8-byte header "ACTRECT\001", followed by
+ * records that start with a one-byte tag. Integers are LEB128
+ * varints; signed values are zigzag encoded.
+ *
+ *   STR  len bytes[len]        defines the next string id (1, 2, ...)
+ *   RECT/INRECT/OUTRECT  net mat dllx dlly wx wy rest
+ *                              net/mat/rest are string ids (0 = none);
+ *                              dllx/dlly are deltas from the previous
+ *                              rectangle's lower left corner
+ *   BBOX/SBOX  llx lly urx ury
+ *   CELL celltype inst rest    string ids; rest is the transform
+ *   END  ncells offset[ncells] byte offsets of all CELL records
+ */
+#define RECT_REC_RECT    0
+#define RECT_REC_INRECT  1
+#define RECT_REC_OUTRECT 2
+#define RECT_REC_BBOX    3
+#define RECT_REC_SBOX    4
+#define RECT_REC_CELL    5
+
+struct rect_record {
+  int type;			// RECT_REC_<type>
+  char *net;			// net name, NULL = none; cell: type
+  char *mat;			// material; cell: instance name
+  long llx, lly, urx, ury;
+  char *rest;			// rest of the line, NULL = none;
+				// cell: transform and array spec
+};
+
+class RectReader {
+ private:
+  const char *_name;		// file name, for error messages
+  char *_buf;			// the entire file
+  long _len;
+  long _pos;
+  int _binary;
+  int _line;			// line number (text)
+
+  char **_strs;			// string table (binary)
+  int _nstrs, _maxstrs;
+  long _px, _py;		// previous lower left corner (binary)
+
+  int _nextText (struct rect_record *r);
+  int _nextBinary (struct rect_record *r);
+  unsigned long _uvar ();
+  long _svar ();
+  char *_str ();
+
+ public:
+  RectReader ();
+  ~RectReader ();
+
+  /* returns 0 if the file could not be read */
+  int open (const char *file);
+  int open (FILE *fp, int binary, const char *name = "-");
+
+  /* returns 0 at the end of the file. Strings in r remain valid
+     until the reader is deleted */
+  int next (struct rect_record *r);
+
+  long size () { return _len; }
+
+  /* 1 if the file name has the binary extension */
+  static int isBinary (const char *file);
+};
+
+class RectWriter {
+ private:
+  FILE *_fp;
+  BufWriter *_w;
+  int _binary;
+  long _pos;			// bytes written
+
+  struct Hashtable *_strs;	// string table (binary)
+  int _nstrs;
+  long _px, _py;
+  long *_cells;			// offsets of cell records
+  int _ncells, _maxcells;
+
+  void _byte (int c);
+  void _uvar (unsigned long v);
+  void _svar (long v);
+  unsigned long _str (const char *s);
+
+ public:
+  RectWriter (FILE *fp, int binary);
+  ~RectWriter ();
+
+  void write (struct rect_record *r);
+
+  /* shorthands for write(); net == NULL means no net */
+  void rect (int type, const char *net, const char *mat,
+	     long llx, long lly, long urx, long ury,
+	     const char *rest = NULL);
+  void box (int type, long llx, long lly, long urx, long ury);
+  void cell (const char *celltype, const char *inst, const char *rest);
+
+  /* net name, as used by BufWriter::putnode */
+  const char *nodename (netlist_t *N, node_t *n) {
+    return _w->nodename (N, n);
+  }
+
+  /* copy all the records from rd; returns the number copied */
+  int writeAll (RectReader *rd);
+
+  /* write the trailer; the file is not closed */
+  void finish ();
 };
   
 
@@ -60,12 +60,14 @@ LayoutBlob::LayoutBlob (ExternMacro *m)
     }
     _abutbox.clear ();
     _le = new LayoutEdgeAttrib();
+    _idx = NULL;
 }
 
 LayoutBlob::LayoutBlob (blob_type type, Layout *lptr)
 {
     t = type;
     readRect = false;
+    _idx = NULL;
 
     count = 0;
 
@@ -129,6 +131,7 @@ LayoutBlob::LayoutBlob (SubcellInst *cell)
     t = BLOB_CELL;
 
     readRect = false;
+    _idx = NULL;
     count = 0;
 
     Assert (cell, "What?");
@@ -562,12 +565,12 @@ void LayoutBlob::appendBlob (LayoutBlob *b, blob_compose c, long gap, bool flip)
 }
 
 
-void LayoutBlob::_printRect (FILE *fp, TransformMat *mat, bool istopcell)
+void LayoutBlob::_printRect (RectWriter *w, TransformMat *mat, bool istopcell)
 {
   switch(t) {
   case BLOB_BASE:
     if (base.l) {
-      base.l->PrintRect (fp, mat, istopcell);
+      base.l->PrintRect (w, mat, istopcell);
     }
     break;
 
@@ -578,7 +581,7 @@ void LayoutBlob::_printRect (FILE *fp, TransformMat *mat, bool istopcell)
       if (mat) {
 	m.applyMat (*mat);
       }
-      bl->b->_printRect (fp, &m, false);
+      bl->b->_printRect (w, &m, false);
     }
     break;
 
@@ -593,7 +596,7 @@ void LayoutBlob::_printRect (FILE *fp, TransformMat *mat, bool istopcell)
       if (mat) {
 	m = *mat;
       }
-      subcell->PrintRect (fp, &m);
+      subcell->PrintRect (w, &m);
     }
     break;
   }
@@ -601,35 +604,41 @@ void LayoutBlob::_printRect (FILE *fp, TransformMat *mat, bool istopcell)
 
 
 void LayoutBlob::PrintRect (FILE *fp, TransformMat *mat, bool istopcell)
+{
+  RectWriter w (fp, 0);
+  PrintRect (&w, mat, istopcell);
+  w.finish ();
+}
+
+void LayoutBlob::PrintRect (RectWriter *w, TransformMat *mat, bool istopcell)
 {
     long bllx, blly, burx, bury;
-    long x, y;
+    long x, y, bx, by;
     Rectangle bloatbox = getBloatBBox ();
     Rectangle abutbox = getAbutBox ();
-    fprintf (fp, "bbox ");
     if(mat) {
         mat->apply (bloatbox.llx(), bloatbox.lly(), &x, &y);
-        fprintf (fp, "%ld %ld", x, y);
-        mat->apply (bloatbox.urx()+1, bloatbox.ury()+1, &x, &y);
-        fprintf (fp, " %ld %ld\n", x, y);
+        mat->apply (bloatbox.urx()+1, bloatbox.ury()+1, &bx, &by);
+        w->box (RECT_REC_BBOX, x, y, bx, by);
         // mat->apply (abutbox.llx(), abutbox.lly(), &x, &y);
         // fprintf (fp, "rect # $align %ld %ld", x, y);
         // mat->apply (abutbox.urx()+1, abutbox.ury()+1, &x, &y);
         // fprintf (fp, " %ld %ld\n", x, y);
     }
     else {
-        fprintf (fp, "%ld %ld %ld %ld\n",
-            bloatbox.llx(), bloatbox.lly(),
-            bloatbox.urx()+1, bloatbox.ury()+1);
+        w->box (RECT_REC_BBOX, bloatbox.llx(), bloatbox.lly(),
+		bloatbox.urx()+1, bloatbox.ury()+1);
 
         if(istopcell) {
             if(!_abutbox.empty()) {
-                fprintf (fp, "rect # $align %ld %ld %ld %ld\n", _abutbox.llx(),
-                    _abutbox.lly(), _abutbox.urx()+1, _abutbox.ury()+1);
+                w->rect (RECT_REC_RECT, NULL, "$align",
+			 _abutbox.llx(), _abutbox.lly(),
+			 _abutbox.urx()+1, _abutbox.ury()+1);
             }
             LayoutEdgeAttrib::attrib_list *l;
 
             long llx, lly, urx, ury;
+            char buf[1024];
 
             if(_abutbox.empty()) {
 	      llx = 0;
@@ -646,29 +655,33 @@ void LayoutBlob::PrintRect (FILE *fp, TransformMat *mat, bool istopcell)
 
             if(_le) {
 	      for(l = _le->left(); l; l = l->next) {
-		fprintf (fp, "rect $l:%s $align %ld %ld %ld %ld\n",
-			 l->name, llx, l->offset, llx, l->offset);
+		snprintf (buf, 1024, "$l:%s", l->name);
+		w->rect (RECT_REC_RECT, buf, "$align",
+			 llx, l->offset, llx, l->offset);
 	      }
 	      for(l = _le->right(); l; l = l->next) {
-		fprintf (fp, "rect $r:%s $align %ld %ld %ld %ld\n",
-			 l->name, urx, l->offset, urx, l->offset);
+		snprintf (buf, 1024, "$r:%s", l->name);
+		w->rect (RECT_REC_RECT, buf, "$align",
+			 urx, l->offset, urx, l->offset);
 	      }
 	      for(l = _le->top(); l; l = l->next) {
-		fprintf (fp, "rect $t:%s $align %ld %ld %ld %ld\n",
-			 l->name, l->offset, ury, l->offset, ury);
+		snprintf (buf, 1024, "$t:%s", l->name);
+		w->rect (RECT_REC_RECT, buf, "$align",
+			 l->offset, ury, l->offset, ury);
 	      }
 	      for(l = _le->bot(); l; l = l->next) {
-		fprintf (fp, "rect $b:%s $align %ld %ld %ld %ld\n",
-			 l->name, l->offset, lly, l->offset, lly);
+		snprintf (buf, 1024, "$b:%s", l->name);
+		w->rect (RECT_REC_RECT, buf, "$align",
+			 l->offset, lly, l->offset, lly);
 	      }
             }
         }
     }
     if(_abutbox.empty()){
-        _printRect (fp, mat, istopcell);
+        _printRect (w, mat, istopcell);
     }
     else {
-        _printRect (fp, mat, false);
+        _printRect (w, mat, false);
     }
 }
 
@@ -719,6 +732,21 @@ list_t *LayoutBlob::search (void *net, TransformMat *m)
             list_free (tmp);
         }
     }
+    else if(t == BLOB_CELL) {
+        SubcellInst *s = subcell;
+        tiles = list_new ();
+
+        if(s->_b) {
+            for(int i=0; i < s->_nx; i++) {
+                for(int j=0; j < s->_ny; j++) {
+                    TransformMat e = s->elementMat (i, j, m);
+                    list_t *tmp = s->_b->search (net, &e);
+                    list_concat (tiles, tmp);
+                    list_free (tmp);
+                }
+            }
+        }
+    }
     else if(t == BLOB_MACRO) {
       /* nothing, macro */
         tiles = list_new ();
@@ -776,6 +804,21 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
             list_free (tmp);
         }
     }
+    else if(t == BLOB_CELL) {
+        SubcellInst *s = subcell;
+        tiles = list_new ();
+
+        if(s->_b) {
+            for(int i=0; i < s->_nx; i++) {
+                for(int j=0; j < s->_ny; j++) {
+                    TransformMat e = s->elementMat (i, j, m);
+                    list_t *tmp = s->_b->search (type, &e);
+                    list_concat (tiles, tmp);
+                    list_free (tmp);
+                }
+            }
+        }
+    }
     else if(t == BLOB_MACRO) {
         tiles = list_new ();
     }
@@ -790,6 +833,7 @@ list_t *LayoutBlob::search (int type, TransformMat *m)
 LayoutBlob::~LayoutBlob ()
 {
   /* XXX do something here! */
+  _freeIndex ();
 }
 
 
@@ -888,6 +932,443 @@ void LayoutBlob::searchFree (list_t *slist)
 }
 
 
+/*------------------------------------------------------------------------
+ *
+ *  Search index
+ *
+ *  All the tiles with a net, and all the base layer tiles by
+ *  attribute, are collected in one pass over the blob and stored as
+ *  transformed rectangles. The index is rebuilt if the transformation
+ *  matrix is different, or if any of the layers has changed since it
+ *  was built (tracked by the per-layer change counters).
+ *
+ *------------------------------------------------------------------------
+ */
+struct blob_index {
+  TransformMat m;
+  unsigned long gen;		// sum of layer change counters
+  int nblk;			// # of layouts
+  struct pHashtable *nets;	// net -> blob_rects
+  struct iHashtable *attrs;	// attribute -> blob_rects
+};
+
+static struct blob_rects _empty_rects;
+
+void LayoutBlob::_indexStamp (unsigned long *gen, int *nblk)
+{
+  if (t == BLOB_BASE) {
+    if (base.l) {
+      *gen += base.l->base->_gen;
+      for (int i=0; i < base.l->nmetals; i++) {
+        *gen += base.l->metals[i]->_gen;
+      }
+      (*nblk)++;
+    }
+  }
+  else if (t == BLOB_LIST) {
+    for (blob_list *bl = l.hd; bl; q_step (bl)) {
+      bl->b->_indexStamp (gen, nblk);
+    }
+  }
+  else if (t == BLOB_CELL) {
+    /* every array element is a separate layout # in the index */
+    if (subcell->_b) {
+      int k = *nblk;
+      subcell->_b->_indexStamp (gen, nblk);
+      *nblk = k + (*nblk - k)*subcell->_nx*subcell->_ny;
+    }
+  }
+}
+
+static void _index_add (struct blob_rects *R, Tile *t, Layer *l, int blk,
+                        int via, const TransformMat &m)
+{
+  struct blob_rect *r;
+  long x;
+
+  A_NEW (R->r, struct blob_rect);
+  r = &A_NEXT (R->r);
+  m.apply (t->getllx(), t->getlly(), &r->llx, &r->lly);
+  m.apply (t->geturx(), t->getury(), &r->urx, &r->ury);
+  if (r->llx > r->urx) {
+    x = r->llx;
+    r->llx = r->urx;
+    r->urx = x;
+  }
+  if (r->lly > r->ury) {
+    x = r->lly;
+    r->lly = r->ury;
+    r->ury = x;
+  }
+  r->t = t;
+  r->l = l;
+  r->blk = blk;
+  r->via = via;
+  A_INC (R->r);
+}
+
+static void _index_net (struct blob_index *I, Tile *t, Layer *l, int blk,
+                        int via, const TransformMat &m)
+{
+  phash_bucket_t *b;
+  struct blob_rects *R;
+
+  if (!t->getNet()) {
+    return;
+  }
+  b = phash_lookup (I->nets, t->getNet());
+  if (!b) {
+    b = phash_add (I->nets, t->getNet());
+    NEW (R, struct blob_rects);
+    A_INIT (R->r);
+    R->gate_area = 0;
+    R->diff_area = 0;
+    b->v = R;
+  }
+  R = (struct blob_rects *)b->v;
+  _index_add (R, t, l, blk, via, m);
+
+  /* antenna area */
+  if (!l->isMetal() && (t->isFet() || t->isDiff())) {
+    double scale = Technology::T->scale/1000.0;
+    struct blob_rect *r = &R->r[A_LEN (R->r)-1];
+    if (t->isFet()) {
+      R->gate_area += (r->urx-r->llx+1)*scale*(r->ury-r->lly+1)*scale;
+    }
+    else {
+      R->diff_area += (r->urx-r->llx+1)*scale*(r->ury-r->lly+1)*scale;
+    }
+  }
+}
+
+void LayoutBlob::_indexBuild (struct blob_index *I, TransformMat *m, int *blk)
+{
+    TransformMat tmat;
+
+    if(m) {
+        tmat = *m;
+    }
+    if(t == BLOB_BASE) {
+        if(base.l) {
+            Layout *L = base.l;
+            Layer *bl = L->base;
+            int k = (*blk)++;
+
+            bl->hint->visitAll ([&] (Tile *tile) {
+                ihash_bucket_t *ib;
+                _index_net (I, tile, bl, k, 0, tmat);
+                ib = ihash_lookup (I->attrs, tile->getAttr());
+                if(!ib) {
+                    struct blob_rects *R;
+                    ib = ihash_add (I->attrs, tile->getAttr());
+                    NEW (R, struct blob_rects);
+                    A_INIT (R->r);
+                    R->gate_area = 0;
+                    R->diff_area = 0;
+                    ib->v = R;
+                }
+                _index_add ((struct blob_rects *)ib->v, tile, bl, k, 0, tmat);
+            });
+            for(int i=0; i < L->nmetals; i++) {
+                Layer *ml = L->metals[i];
+                ml->hint->visitAll ([&] (Tile *tile) {
+                    _index_net (I, tile, ml, k, 0, tmat);
+                });
+                ml->vhint->visitAll ([&] (Tile *tile) {
+                    _index_net (I, tile, ml, k, 1, tmat);
+                });
+            }
+        }
+    }
+    else if(t == BLOB_LIST) {
+        for(blob_list *bl = l.hd; bl; q_step (bl)) {
+            if(m) {
+                tmat = *m;
+            }
+            else {
+                tmat.mkI();
+            }
+            tmat.applyMat (bl->T);
+            bl->b->_indexBuild (I, &tmat, blk);
+        }
+    }
+    else if(t == BLOB_CELL) {
+        SubcellInst *s = subcell;
+
+        if(s->_b) {
+            for(int i=0; i < s->_nx; i++) {
+                for(int j=0; j < s->_ny; j++) {
+                    TransformMat e = s->elementMat (i, j, m);
+                    s->_b->_indexBuild (I, &e, blk);
+                }
+            }
+        }
+    }
+    else if(t == BLOB_MACRO) {
+        /* nothing, macro */
+    }
+    else {
+        fatal_error ("New blob?");
+    }
+}
+
+struct blob_index *LayoutBlob::_getIndex (TransformMat *m)
+{
+    TransformMat tmat;
+    unsigned long gen = 0;
+    int nblk = 0;
+
+    if(m) {
+        tmat = *m;
+    }
+    _indexStamp (&gen, &nblk);
+    if(_idx && _idx->m == tmat && _idx->gen == gen && _idx->nblk == nblk) {
+        return _idx;
+    }
+    _freeIndex ();
+
+    NEW (_idx, struct blob_index);
+    _idx->m = tmat;
+    _idx->gen = gen;
+    _idx->nblk = nblk;
+    _idx->nets = phash_new (32);
+    _idx->attrs = ihash_new (8);
+
+    nblk = 0;
+    _indexBuild (_idx, m, &nblk);
+    return _idx;
+}
+
+void LayoutBlob::_freeIndex ()
+{
+    if(!_idx) {
+        return;
+    }
+
+    phash_iter_t it;
+    phash_bucket_t *b;
+    phash_iter_init (_idx->nets, &it);
+    while((b = phash_iter_next (_idx->nets, &it))) {
+        struct blob_rects *R = (struct blob_rects *)b->v;
+        A_FREE (R->r);
+        FREE (R);
+    }
+    phash_free (_idx->nets);
+
+    ihash_iter_t iit;
+    ihash_bucket_t *ib;
+    ihash_iter_init (_idx->attrs, &iit);
+    while((ib = ihash_iter_next (_idx->attrs, &iit))) {
+        struct blob_rects *R = (struct blob_rects *)ib->v;
+        A_FREE (R->r);
+        FREE (R);
+    }
+    ihash_free (_idx->attrs);
+
+    FREE (_idx);
+    _idx = NULL;
+}
+
+const struct blob_rects *LayoutBlob::searchIndex (void *net, TransformMat *m)
+{
+    struct blob_index *I;
+    phash_bucket_t *b;
+
+    Assert (net, "searchIndex() requires a net");
+    I = _getIndex (m);
+    b = phash_lookup (I->nets, net);
+    if(!b) {
+        return &_empty_rects;
+    }
+    return (struct blob_rects *)b->v;
+}
+
+const struct blob_rects *LayoutBlob::searchIndex (int type, TransformMat *m)
+{
+    struct blob_index *I;
+    ihash_bucket_t *b;
+
+    I = _getIndex (m);
+    b = ihash_lookup (I->attrs, type);
+    if(!b) {
+        return &_empty_rects;
+    }
+    return (struct blob_rects *)b->v;
+}
+
+void LayoutBlob::searchBBox (const struct blob_rects *R, long *bllx,
+                             long *blly, long *burx, long *bury)
+{
+    if(A_LEN (R->r) == 0) {
+        *bllx = 0;
+        *blly = 0;
+        *burx = -1;
+        *bury = -1;
+        return;
+    }
+    *bllx = R->r[0].llx;
+    *blly = R->r[0].lly;
+    *burx = R->r[0].urx;
+    *bury = R->r[0].ury;
+    for(int i=1; i < A_LEN (R->r); i++) {
+        *bllx = MIN (*bllx, R->r[i].llx);
+        *blly = MIN (*blly, R->r[i].lly);
+        *burx = MAX (*burx, R->r[i].urx);
+        *bury = MAX (*bury, R->r[i].ury);
+    }
+    (*burx)++;
+    (*bury)++;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Region query
+ *
+ *  The window stays in top-level coordinates. Children are pruned by
+ *  their transformed bounding box, and at each layout the window is
+ *  mapped back into layout coordinates so that only the tiles under
+ *  it are visited.
+ *
+ *------------------------------------------------------------------------
+ */
+struct blob_query {
+    Rectangle w;		// window, in top-level coordinates
+    const TransformMat *m;	// transform for the current layout
+    Layer *l;			// current layer
+    int blk;			// current layout #
+    int nblk;			// # of layouts visited so far
+    int via;			// 1 if we are on the via plane
+    void *cookie;
+    void (*f) (void *, const struct blob_rect *);
+};
+
+static void _query_tile (void *cookie, Tile *t)
+{
+    struct blob_query *q = (struct blob_query *)cookie;
+    struct blob_rect r;
+    long x;
+
+    if(t->isSpace()) {
+        return;
+    }
+    q->m->apply (t->getllx(), t->getlly(), &r.llx, &r.lly);
+    q->m->apply (t->geturx(), t->getury(), &r.urx, &r.ury);
+    if(r.llx > r.urx) {
+        x = r.llx;
+        r.llx = r.urx;
+        r.urx = x;
+    }
+    if(r.lly > r.ury) {
+        x = r.lly;
+        r.lly = r.ury;
+        r.ury = x;
+    }
+    r.t = t;
+    r.l = q->l;
+    r.blk = q->blk;
+    r.via = q->via;
+    (*q->f) (q->cookie, &r);
+}
+
+void LayoutBlob::_query (struct blob_query *q, TransformMat *m)
+{
+    TransformMat tmat;
+
+    if(m) {
+        tmat = *m;
+    }
+    if(t == BLOB_BASE) {
+        if(base.l) {
+            Layout *L = base.l;
+            Rectangle lw = tmat.applyInverseBox (q->w);
+
+            q->m = &tmat;
+            q->blk = q->nblk++;
+            q->l = L->base;
+            q->via = 0;
+            L->base->hint->applyTiles (lw, q, _query_tile);
+            for(int i=0; i < L->nmetals; i++) {
+                q->l = L->metals[i];
+                q->via = 0;
+                L->metals[i]->hint->applyTiles (lw, q, _query_tile);
+                q->via = 1;
+                L->metals[i]->vhint->applyTiles (lw, q, _query_tile);
+            }
+        }
+    }
+    else if(t == BLOB_LIST) {
+        for(blob_list *bl = l.hd; bl; q_step (bl)) {
+            if(m) {
+                tmat = *m;
+            }
+            else {
+                tmat.mkI();
+            }
+            tmat.applyMat (bl->T);
+            if(!bl->b->_bbox.empty() &&
+               !tmat.applyBox (bl->b->_bbox).overlaps (q->w)) {
+                continue;
+            }
+            bl->b->_query (q, &tmat);
+        }
+    }
+    else if(t == BLOB_CELL) {
+        SubcellInst *s = subcell;
+        int xlo, xhi, ylo, yhi;
+
+        if(!s->_b) {
+            return;
+        }
+        /* only visit the array elements under the window. Element
+           (i,j) is element (0,0) shifted by the pitch in the parent's
+           frame, so the range is found there: the window is mapped
+           back through m. */
+        if(s->_b->_bbox.empty()) {
+            xlo = 0;
+            xhi = s->_nx - 1;
+            ylo = 0;
+            yhi = s->_ny - 1;
+        }
+        else if(!s->arrayRange (s->_m.applyBox (s->_b->_bbox),
+                                tmat.applyInverseBox (q->w),
+                                &xlo, &xhi, &ylo, &yhi)) {
+            return;
+        }
+        for(int i=xlo; i <= xhi; i++) {
+            for(int j=ylo; j <= yhi; j++) {
+                TransformMat e = s->elementMat (i, j, m);
+                s->_b->_query (q, &e);
+            }
+        }
+    }
+    else if(t == BLOB_MACRO) {
+        /* nothing, macro */
+    }
+    else {
+        fatal_error ("New blob?");
+    }
+}
+
+void LayoutBlob::query (const Rectangle &window, void *cookie,
+                        void (*f) (void *, const struct blob_rect *))
+{
+    struct blob_query q;
+
+    if(window.empty()) {
+        return;
+    }
+    q.w = window;
+    q.m = NULL;
+    q.l = NULL;
+    q.blk = 0;
+    q.nblk = 0;
+    q.via = 0;
+    q.cookie = cookie;
+    q.f = f;
+    _query (&q, NULL);
+}
+
 LayoutBlob *LayoutBlob::delBBox (LayoutBlob *b)
 {
     if(!b) return NULL;
@@ -980,6 +1461,21 @@ list_t *LayoutBlob::searchAllMetal (TransformMat *m)
             list_free (tmp);
         }
     }
+    else if(t == BLOB_CELL) {
+        SubcellInst *s = subcell;
+        tiles = list_new ();
+
+        if(s->_b) {
+            for(int i=0; i < s->_nx; i++) {
+                for(int j=0; j < s->_ny; j++) {
+                    TransformMat e = s->elementMat (i, j, m);
+                    list_t *tmp = s->_b->searchAllMetal (&e);
+                    list_concat (tiles, tmp);
+                    list_free (tmp);
+                }
+            }
+        }
+    }
     else {
         tiles = NULL;
         fatal_error ("New blob?");
@@ -988,6 +1484,35 @@ list_t *LayoutBlob::searchAllMetal (TransformMat *m)
 }
 
 
+void LayoutBlob::getTileStats (struct layout_tile_stats *s)
+{
+    s->ntiles = 0;
+    s->peak = 0;
+    s->bytes = 0;
+    s->nfind = 0;
+    s->nhops = 0;
+    s->nmerged = 0;
+
+    if(t == BLOB_BASE) {
+        if(base.l) {
+            base.l->getTileStats (s);
+        }
+    }
+    else if(t == BLOB_LIST) {
+        blob_list *bl;
+        for(bl = l.hd; bl; q_step (bl)) {
+            struct layout_tile_stats tmp;
+            bl->b->getTileStats (&tmp);
+            s->ntiles += tmp.ntiles;
+            s->peak += tmp.peak;
+            s->bytes += tmp.bytes;
+            s->nfind += tmp.nfind;
+            s->nhops += tmp.nhops;
+            s->nmerged += tmp.nmerged;
+        }
+    }
+}
+
 
 Rectangle LayoutBlob::getAbutBox()
 {
@@ -1013,17 +1538,46 @@ Rectangle LayoutBlob::getAbutBox()
 }
 
 
+/*-- a rectangle from a .rect file, queued for Layer::DrawBatch() --*/
+struct rect_pending {
+  Layer *l;			// layer to draw on; NULL if drawn/rejected
+  struct layer_rect r;
+  int metal;			// metal # for the warning, -1 otherwise
+  const char *errname;		// material for the warning, NULL for poly
+  long urx, ury;		// original upper right corner
+};
+
+static void _queue_rect (struct rect_pending *rp, Layer *l,
+			 long llx, long lly, long urx, long ury,
+			 void *net, int attr, int via)
+{
+  rp->l = l;
+  rp->r.llx = llx;
+  rp->r.lly = lly;
+  rp->r.wx = urx - llx;
+  rp->r.wy = ury - lly;
+  rp->r.net = net;
+  rp->r.attr = attr;
+  rp->r.via = via;
+  rp->r.ok = 0;
+  rp->metal = -1;
+  rp->errname = NULL;
+  rp->urx = urx;
+  rp->ury = ury;
+}
+
 LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
 				  Rectangle& bbox, int mode)
 {
   LayoutBlob *ret;
-  FILE *fp;
-  char buf[10240];
-  int rtype = 0;
-  int offset;
+  RectReader rd;
+  struct rect_record rec;
   char *net;
   Process *p;
   Layout *L;
+  struct Hashtable *nets;
+  struct LayoutLayermap lmetal;
+  A_DECL (struct rect_pending, pend);
 
   bbox.clear ();
 
@@ -1036,8 +1590,7 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
     p = NULL;
   }
 
-  fp = fopen (file, "r");
-  if (!fp) {
+  if (!rd.open (file)) {
     return NULL;
   }
 
@@ -1048,72 +1601,43 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
   L = new Layout (nl);
   L->_readrect = true;
   L->_rbox.clear ();
-  
-  while (fgets (buf, 10240, fp)) {
-#if 0
-    printf ("BUF: %s", buf);
-#endif    
-    offset = 0;
-    for (int bx=0; bx < 10240 && buf[bx]; bx++) {
-      if (!isspace (buf[bx])) { break; }
-      offset++;
-    }
-    if (buf[offset] == '\0') continue;
-    if (buf[offset] == '#') continue;
-    if (strncmp (buf+offset, "inrect ", 7) == 0) {
-      offset += 7;
-      rtype = 1;
-    }
-    else if (strncmp (buf+offset, "outrect ", 8) == 0) {
-      offset += 8;
-      rtype = 2;
-    }
-    else if (strncmp (buf+offset, "rect ", 5) == 0) {
-      offset += 5;
-      rtype = 0;
-    }
-    else if (strncmp (buf+offset, "bbox ", 5) == 0) {
-      long rlx, rly, rux, ruy;
-      sscanf (buf+5, "%ld %ld %ld %ld", &rlx, &rly, &rux, &ruy);
+
+  A_INIT (pend);
+
+  /* net names are looked up once per name; material names are in
+     the shared layer map */
+  nets = hash_new (32);
+  lmetal.etype = -1;
+  lmetal.flavor = 0;
+  lmetal.lcase = LMAP_METAL;
+
+  while (rd.next (&rec)) {
+    struct LayoutLayermap *lm;
+    hash_bucket_t *b;
+    int badmetal, isalign;
+
+    if (rec.type == RECT_REC_BBOX) {
       // this is auto-generated, so ignore it.
-      bbox.setRect (rlx, rly, rux - rlx, ruy - rly);
+      bbox.setRect (rec.llx, rec.lly, rec.urx - rec.llx, rec.ury - rec.lly);
       continue;
     }
-    else if (strncmp (buf+offset, "sbox ", 5) == 0) {
+    else if (rec.type == RECT_REC_SBOX) {
       // this overrides the bbox definition, so keep it
-      long rlx, rly, rux, ruy;
-      sscanf (buf+5, "%ld %ld %ld %ld", &rlx, &rly, &rux, &ruy);
-      L->_rbox.setRect (rlx, rly, rux - rlx, ruy - rly);
+      L->_rbox.setRect (rec.llx, rec.lly, rec.urx - rec.llx, rec.ury - rec.lly);
       continue;
     }
-    else if (strncmp (buf+offset, "cell ", 5) == 0) {
-      char inst[10240], celltype[10240];
+    else if (rec.type == RECT_REC_CELL) {
       /* celltype id orientation dx dy [arr nx px ny py] */
-      offset += 5;
-      if (sscanf (buf+offset, "%s %s", celltype, inst) != 2) {
-	fatal_error ("Line: %s\ncell spec error", buf);
-      }
-      for (int skip=0; skip < 2; skip++) {
-	while (buf[offset] && isspace (buf[offset])) {
-	  offset++;
-	}
-	while (buf[offset] && !isspace (buf[offset])) {
-	  offset++;
-	}
-      }
       int skipamt = 0;
-      TransformMat mat = TransformMat::ReadRect (buf+offset, &skipamt);
-      offset += skipamt;
+      TransformMat mat = TransformMat::ReadRect (rec.rest ? rec.rest : (char *)"", &skipamt);
       int nx, px, ny, py;
-      if (sscanf (buf+offset, "arr %d %d %d %d", &nx, &px, &ny, &py) == 4) {
+      if (rec.rest &&
+	  sscanf (rec.rest + skipamt, "arr %d %d %d %d", &nx, &px, &ny, &py) == 4) {
 	// ok we have parsed the subcell instance!
       }
       else {
-	while (buf[offset]) {
-	  if (!isspace (buf[offset])) {
-	    fatal_error ("Line %s\ncell spec error", buf);
-	  }
-	  offset++;
+	if (rec.rest && rec.rest[skipamt]) {
+	  fatal_error ("%s: cell %s %s: cell spec error", file, rec.net, rec.mat);
 	}
 	nx = 1;
 	ny = 1;
@@ -1125,38 +1649,44 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
       Assert (0, "Process subcell instance!");
       continue;
     }
-    else {
-      fatal_error ("Line: %s\nNeeds inrect, outrect, rect, bbox, sbox, or cell", buf);
-    }
 
-    if (strncmp (buf+offset, "# ", 2) == 0) {
-      net = NULL;
-      offset += 2;
+    net = rec.net;
+
+    char *material;
+    material = rec.mat;
+
+    /* the common case is a single probe; anything else is an
+       unknown material or a metal spelled differently (m01) */
+    b = hash_lookup (Layout::_lmap, material);
+    badmetal = 0;
+    if (b) {
+      lm = (struct LayoutLayermap *) b->v;
     }
     else {
-      net = buf+offset;
-      while (buf[offset] && buf[offset] != ' ') {
-	offset++;
+      lm = NULL;
+      if (material[0] == 'm' && isdigit(material[1])) {
+	/* m# is a metal layer */
+	int l = atoi (material+1);
+	if (l < 1 || l > Technology::T->nmetals) {
+	  badmetal = 1;
+	}
+	else {
+	  lmetal.l = l-1;
+	  lm = &lmetal;
+	}
       }
-      Assert (buf[offset], "Long line");
-      buf[offset] = '\0';
-      offset++;
     }
+    isalign = (lm && lm->lcase == LMAP_ALIGN);
 
     node_t *n = NULL;
 
-    char *material;
-    material = buf+offset;
-
-    while (buf[offset] && buf[offset] != ' ') {
-      offset++;
-    }
-    Assert (buf[offset], "Long line");
-    buf[offset] = '\0';
-    offset++;
-
-    if (net && nl && (strcmp (material, "$align") != 0)) {
-      n = ActNetlistPass::string_to_node (nl, net);
+    if (net && nl && !isalign) {
+      b = hash_lookup (nets, net);
+      if (!b) {
+	b = hash_add (nets, net);
+	b->v = ActNetlistPass::string_to_node (nl, net);
+      }
+      n = (node_t *) b->v;
       if (!n) {
 	warning ("Could not find signal `%s' in netlist!", net);
       }
@@ -1164,53 +1694,43 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
     }
 
     long rllx, rlly, rurx, rury;
-    sscanf (buf+offset, "%ld %ld %ld %ld", &rllx, &rlly, &rurx, &rury);
+    rllx = rec.llx;
+    rlly = rec.lly;
+    rurx = rec.urx;
+    rury = rec.ury;
 
 #if 0
     printf ("[%s] rtype=%d, net=%s, (%ld, %ld) -> (%ld, %ld)\n", material,
-	    rtype, net ? net : "-none-", rllx, rlly, rurx, rury);
+	    rec.type, net ? net : "-none-", rllx, rlly, rurx, rury);
 #endif
 
-    if ((rllx >= rurx || rlly >= rury) && !( strcmp (material, "$align") == 0 && (rllx == rurx || rlly == rury))) {
+    if ((rllx >= rurx || rlly >= rury) && !(isalign && (rllx == rurx || rlly == rury))) {
       warning ("[%s] Empty rectangle (%ld,%ld) -> (%ld,%ld); skipped",
 	       material, rllx, rlly, rurx, rury);
       continue;
     }
 
     /* now find the material/layer, and draw it */
-    if (material[0] == 'm' && isdigit(material[1])) {
-      /* m# is a metal layer */
-      int l;
-      sscanf (material+1, "%d", &l);
-#if 0
-      printf ("metal %d\n", l);
-#endif
-
-      if (l < 1 || l > Technology::T->nmetals) {
-	warning ("Technology has %d metal layers; found `%s'; skipped",
-		 Technology::T->nmetals, material);
-      }
-      else {
-	/*--- draw metal ---*/
-	l--;
-	if (!L->DrawMetal (l, rllx, rlly, rurx - rllx, rury - rlly, n)) {
-	  warning ("Skipped rect: metal%d @ (%ld,%ld) -> (%ld,%ld)",
-		   l+1, rllx, rlly, rurx, rury);
-	}
-      }
+    if (badmetal) {
+      warning ("Technology has %d metal layers; found `%s'; skipped",
+	       Technology::T->nmetals, material);
     }
-    else if (strcmp (material, L->base->mat->getName()) == 0) {
-      /* poly */
-#if 0
-      printf ("poly\n");
-#endif
+    else if (lm && lm->lcase == LMAP_METAL) {
+      /*--- draw metal ---*/
+      A_NEW (pend, struct rect_pending);
+      _queue_rect (&A_NEXT (pend), L->metals[lm->l],
+		   rllx, rlly, rurx, rury, n, 0, 0);
+      A_NEXT (pend).metal = lm->l;
+      A_INC (pend);
+    }
+    else if (lm && lm->lcase == LMAP_POLY) {
       /*--- draw poly ---*/
-      if (!L->DrawPoly (rllx, rlly, rurx - rllx, rury - rlly, n)) {
-	warning ("Skipped rect: poly @ (%ld,%ld) -> (%ld,%ld)",
-		 rllx, rlly, rurx, rury);
-      }
+      A_NEW (pend, struct rect_pending);
+      _queue_rect (&A_NEXT (pend), L->base,
+		   rllx, rlly, rurx, rury, n, 0, 0);
+      A_INC (pend);
     }
-    else if (strcmp (material, "$align") == 0) {
+    else if (isalign) {
       LayoutEdgeAttrib::attrib_list *l;
       NEW (l, LayoutEdgeAttrib::attrib_list);
       l->next = NULL;
@@ -1285,59 +1805,49 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
       FREE (l); // don't free name: that gets used by the merge
     }
     else {
-      struct LayoutLayermap *lm;
-      hash_bucket_t *b;
-      b = hash_lookup (L->lmap, material);
-      if (b) {
-	const char *errname = NULL;
+      if (lm) {
+	struct rect_pending *rp;
 	/*--- draw base layer or via ---*/
-	lm = (struct LayoutLayermap *) b->v;
+	A_NEW (pend, struct rect_pending);
+	rp = &A_NEXT (pend);
 	switch (lm->lcase) {
 	case LMAP_DIFF:
-	  if (!L->DrawDiff (lm->flavor, lm->etype, rllx, rlly,
-			    rurx - rllx, rury - rlly, n)) {
-	    errname = "diffusion";
-	  }
+	  _queue_rect (rp, L->base, rllx, rlly, rurx, rury, n,
+		       1 + TOTAL_OFFSET (lm->flavor, lm->etype, DIFF_OFFSET), 0);
+	  rp->errname = "diffusion";
 	  break;
 	  
 	case LMAP_FET:
-	  if (!L->DrawFet (lm->flavor, lm->etype, rllx, rlly,
-			   rurx - rllx, rury - rlly, n)) {
-	    errname = "fet";
-	  }
+	  _queue_rect (rp, L->base, rllx, rlly, rurx, rury, n,
+		       1 + TOTAL_OFFSET (lm->flavor, lm->etype, FET_OFFSET), 0);
+	  rp->errname = "fet";
 	  break;
 	case LMAP_WDIFF:
-	  if (!L->DrawWellDiff (lm->flavor, lm->etype, rllx, rlly,
-				rurx - rllx, rury - rlly, n)) {
-	    errname = "welldiff";
-	  }
+	  _queue_rect (rp, L->base, rllx, rlly, rurx, rury, n,
+		       1 + TOTAL_OFFSET (lm->flavor, lm->etype, WDIFF_OFFSET), 0);
+	  rp->errname = "welldiff";
 	  break;
 	case LMAP_VIA:
-	  if (!lm->l->drawVia (rllx, rlly, rurx - rllx, rury - rlly, n, 0)) {
-	    errname = "via";
-	  }
+	  _queue_rect (rp, L->_lmapLayer (lm), rllx, rlly, rurx, rury, n, 0, 1);
+	  rp->errname = "via";
 	  break;
 
 	case LMAP_NSELECT:
 	case LMAP_PSELECT:
 	case LMAP_NFET_WELL:
 	case LMAP_PFET_WELL:
-	  if (!lm->l->Draw (rllx, rlly, rurx - rllx, rury - rlly, n, 0)) {
-	    if (lm->lcase == LMAP_NSELECT) {
-	      errname = "nselect";
-	    }
-	    else if (lm->lcase == LMAP_PSELECT) {
-	      errname = "pselect";
-	    }
-	    else if (lm->lcase == LMAP_NFET_WELL) {
-	      errname = "nwell";
-	    }
-	    else if (lm->lcase == LMAP_PFET_WELL) {
-	      errname = "pwell";
-	    }
-	    else {
-	      Assert (0, "Should not be here");
-	    }
+	  _queue_rect (rp, L->_lmapLayer (lm), rllx, rlly, rurx, rury, n, 0, 0);
+	  if (lm->lcase == LMAP_NSELECT) {
+	    rp->errname = "nselect";
+	  }
+	  else if (lm->lcase == LMAP_PSELECT) {
+	    rp->errname = "pselect";
+	  }
+	  else if (lm->lcase == LMAP_NFET_WELL) {
+	    rp->errname = "nwell";
+	  }
+	  else {
+	    rp->errname = "pwell";
 	  }
 	  break;
 	  
@@ -1345,10 +1855,13 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
 	  fatal_error ("Unknown lmap lcase %d?", lm->lcase);
 	  break;
 	}
-	if (errname) {
-	  warning ("Skipped rect %s: (%ld,%ld) -> (%ld,%ld)",
-		   errname, rllx, rlly, rurx, rury);
+	if ((lm->lcase == LMAP_DIFF || lm->lcase == LMAP_FET ||
+	     lm->lcase == LMAP_WDIFF) &&
+	    (lm->flavor < 0 || lm->flavor >= L->nflavors)) {
+	  /* unknown flavor: nothing to draw */
+	  rp->l = NULL;
 	}
+	A_INC (pend);
       }
       else {
 	warning ("Unknown material `%s'; skipped", material);
@@ -1377,9 +1890,61 @@ LayoutBlob *LayoutBlob::ReadRect (const char *file, netlist_t *nl,
 #endif
     }
   }
-  fclose (fp);
+  hash_free (nets);
+
+  /* 
+     Draw the rectangles one layer at a time. The order within a
+     layer is the file order, so the tiles are the same as drawing
+     each rectangle as it is read.
+  */
+  if (A_LEN (pend) > 0) {
+    struct layer_rect *batch;
+    int *idx;
+    MALLOC (batch, struct layer_rect, A_LEN (pend));
+    MALLOC (idx, int, A_LEN (pend));
+    for (int i=0; i < A_LEN (pend); i++) {
+      Layer *lay = pend[i].l;
+      int nb = 0;
+      if (!lay) continue;
+      for (int j=i; j < A_LEN (pend); j++) {
+	if (pend[j].l == lay) {
+	  batch[nb] = pend[j].r;
+	  idx[nb] = j;
+	  nb++;
+	  pend[j].l = NULL;
+	}
+      }
+      lay->DrawBatch (nb, batch);
+      for (int k=0; k < nb; k++) {
+	pend[idx[k]].r.ok = batch[k].ok;
+      }
+    }
+    FREE (batch);
+    FREE (idx);
+  }
+
+  for (int i=0; i < A_LEN (pend); i++) {
+    struct rect_pending *rp = &pend[i];
+    if (rp->r.ok) continue;
+    if (rp->metal >= 0) {
+      warning ("Skipped rect: metal%d @ (%ld,%ld) -> (%ld,%ld)",
+	       rp->metal+1, rp->r.llx, rp->r.lly, rp->urx, rp->ury);
+    }
+    else if (!rp->errname) {
+      warning ("Skipped rect: poly @ (%ld,%ld) -> (%ld,%ld)",
+	       rp->r.llx, rp->r.lly, rp->urx, rp->ury);
+    }
+    else {
+      warning ("Skipped rect %s: (%ld,%ld) -> (%ld,%ld)",
+	       rp->errname, rp->r.llx, rp->r.lly, rp->urx, rp->ury);
+    }
+  }
+  A_FREE (pend);
 
   L->propagateAllNets ();
+  if (Layout::mergeEnabled ()) {
+    L->mergeTiles ();
+  }
   L->markPins();
   
   ret = new LayoutBlob (BLOB_BASE, L);
@@ -42,6 +42,8 @@
 #endif
 
 
+int Layer::_use_locality = 1;
+
 Layer::Layer (Material *m, netlist_t *_n)
 {
   mat = m;
@@ -51,10 +53,27 @@ Layer::Layer (Material *m, netlist_t *_n)
   down = NULL;
   other = NULL;
   nother = 0;
-  bbox = 0;
 
-  hint = new Tile();
-  vhint = new Tile();
+  /* empty layer: valid, empty bbox */
+  bbox = 1;
+  _llx = 0;
+  _lly = 0;
+  _urx = -1;
+  _ury = -1;
+  _bllx = 0;
+  _blly = 0;
+  _burx = -1;
+  _bury = -1;
+  _gen = 0;
+
+  pool = new TilePool ();
+  hint = pool->alloc ();
+  vhint = pool->alloc ();
+  _last = hint;
+  _vlast = vhint;
+  _nfind = 0;
+  _nhops = 0;
+  _nmerged = 0;
 
   //hint->up = vhint;
   //vhint->down = hint;
@@ -62,7 +81,16 @@ Layer::Layer (Material *m, netlist_t *_n)
 
 Layer::~Layer()
 {
-  /* XXX: delete all tiles! */
+  /* all the tiles live in the pool */
+  delete pool;
+  pool = NULL;
+  hint = NULL;
+  vhint = NULL;
+  _last = NULL;
+  _vlast = NULL;
+  if (other) {
+    FREE (other);
+  }
 }
 
 void Layer::allocOther (int sz)
@@ -98,27 +126,21 @@ int Layer::drawVia (long llx, long lly, unsigned long wx, unsigned long wy,
 		    void *net, int attr)
 {
   Tile *x;
+  unsigned long f0 = Tile::_nfind;
+  unsigned long h0 = Tile::_nhops;
 
-  bbox = 0;
+  /* the via plane is not included in the bbox */
+  _gen++;
 
-  x = vhint->addRect (llx, lly, wx, wy);
+  x = (_use_locality ? _vlast : vhint)->addRect (pool, llx, lly, wx, wy);
+  _nfind += Tile::_nfind - f0;
+  _nhops += Tile::_nhops - h0;
   if (!x) return 0;
 
-  if (!x->space) {
-    /* overwriting a net */
-    if (x->net && net && x->net != net) {
-      return 0;
-    }
-    if (x->attr != attr) {
-      return 0;
-    }
-  }
-  x->space = 0;
-  x->attr = attr;
-  if (net) {
-    x->net = net;
-  }
-  return 1;
+  /* the old _vlast may have been deleted by addRect */
+  _vlast = x;
+
+  return _paint (x, net, attr);
 }
 
 int Layer::isMetal ()
@@ -138,12 +160,78 @@ int Layer::Draw (long llx, long lly, unsigned long wx, unsigned long wy,
 		 void *net, int attr)
 {
   Tile *x;
+  unsigned long f0 = Tile::_nfind;
+  unsigned long h0 = Tile::_nhops;
 
-  bbox = 0;
+  _gen++;
 
-  x = hint->addRect (llx, lly, wx, wy);
+  x = (_use_locality ? _last : hint)->addRect (pool, llx, lly, wx, wy);
+  _nfind += Tile::_nfind - f0;
+  _nhops += Tile::_nhops - h0;
   if (!x) return 0;
 
+  /* the old _last may have been deleted by addRect */
+  _last = x;
+
+  if (!_paint (x, net, attr)) {
+    return 0;
+  }
+  if (bbox) {
+    _addBBox (x);
+  }
+  return 1;
+}
+
+/*
+  Rectangles are drawn in the order given: the tiles produced by
+  addRect() depend on the insertion order, as does the outcome when
+  two rectangles disagree on net or attribute. Each point location
+  starts from the tile drawn last on the same plane, so a batch
+  that is spatially coherent (like a .rect file) is close to linear.
+*/
+int Layer::DrawBatch (int n, struct layer_rect *r)
+{
+  Tile *x;
+  int count = 0;
+  unsigned long f0 = Tile::_nfind;
+  unsigned long h0 = Tile::_nhops;
+
+  _gen++;
+
+  for (int i=0; i < n; i++) {
+    if (r[i].via) {
+      x = (_use_locality ? _vlast : vhint)->addRect (pool, r[i].llx, r[i].lly,
+						      r[i].wx, r[i].wy);
+      if (x) {
+	_vlast = x;
+      }
+    }
+    else {
+      x = (_use_locality ? _last : hint)->addRect (pool, r[i].llx, r[i].lly,
+						    r[i].wx, r[i].wy);
+      if (x) {
+	_last = x;
+      }
+    }
+    if (x && _paint (x, r[i].net, r[i].attr)) {
+      r[i].ok = 1;
+      count++;
+      if (bbox && !r[i].via) {
+	_addBBox (x);
+      }
+    }
+    else {
+      r[i].ok = 0;
+    }
+  }
+  _nfind += Tile::_nfind - f0;
+  _nhops += Tile::_nhops - h0;
+  return count;
+}
+
+/* paint a tile returned by addRect() */
+int Layer::_paint (Tile *x, void *net, int attr)
+{
   if (!x->space) {
     /* overwriting a net */
     if (x->net && net && x->net != net) {
@@ -164,8 +252,31 @@ int Layer::Draw (long llx, long lly, unsigned long wx, unsigned long wy,
 int Layer::DrawVirt (int flavor, int type,
 		     long llx, long lly, unsigned long wx, unsigned long wy)
 {
-  bbox = 0;
-  return hint->addVirt (flavor, type, llx, lly, wx, wy);
+  int ret;
+  unsigned long f0 = Tile::_nfind;
+  unsigned long h0 = Tile::_nhops;
+
+  _gen++;
+  /* addVirt only splits tiles, so _last remains valid */
+  ret = (_use_locality ? _last : hint)->addVirt (pool, flavor, type,
+						  llx, lly, wx, wy);
+  _nfind += Tile::_nfind - f0;
+  _nhops += Tile::_nhops - h0;
+
+  /* space becomes virtual diffusion, which is not part of the bbox;
+     routing tiles become fets, which leaves the bbox unchanged but
+     can change their bloat. That only matters if the rectangle is
+     close enough to the edge of the bloated bbox. */
+  if (bbox && _bllx <= _burx) {
+    long b = MAX (_bloat (0),
+		  _bloat (TILE_FLGS_TO_ATTR (flavor, type, FET_OFFSET)));
+    if (!(_bllx < llx - b && _blly < lly - b &&
+	  llx + (signed long)wx - 1 + b < _burx &&
+	  lly + (signed long)wy - 1 + b < _bury)) {
+      bbox = 0;
+    }
+  }
+  return ret;
 }
 
 int Layer::Draw (long llx, long lly, unsigned long wx, unsigned long wy,
@@ -178,10 +289,10 @@ void Layer::markPins (void *net, int isinput)
 {
   if (!net) return;
 
-  list_t *l = searchMat (net);
-
-  for (listitem_t *li = list_first (l); li; li = list_next (li)) {
-    Tile *t = (Tile *) list_value (li);
+  hint->visitAll ([&] (Tile *t) {
+    if (t->getNet () != net) {
+      return;
+    }
 #if 0
     printf ("  (%ld,%ld) -> (%ld,%ld)\n", t->getllx(), t->getlly(), t->geturx(), t->getury());
 #endif    
@@ -189,69 +300,23 @@ void Layer::markPins (void *net, int isinput)
     if (!isinput) {
       TILE_ATTR_MKOUTPUT (t->attr);
     }
-  }
-  list_free (l);
-}
-
-static void append_nonspacetile (void *cookie, Tile *t)
-{
-  list_t *l = (list_t *) cookie;
-
-  if (!t->isSpace()) {
-    list_append (l, t);
-  }
-}
-
-static void append_nonspacebasetile (void *cookie, Tile *t)
-{
-  list_t *l = (list_t *) cookie;
-
-  if (!t->isBaseSpace()) {
-    list_append (l, t);
-  }
-}
-
-
-static void dump_node (FILE *fp, netlist_t *N, node_t *n)
-{
-  if (n->v) {
-    ActId *tmp = n->v->v->id->toid();
-    tmp->Print (fp);
-    delete tmp;
-  }
-  else {
-    if (n == N->Vdd) {
-      fprintf (fp, "Vdd");
-    }
-    else if (n == N->GND) {
-      fprintf (fp, "GND");
-    }
-    else {
-      fprintf (fp, "#%d", n->i);
-    }
-  }
+  });
+  _gen++;
 }
 
 
-void Layer::PrintRect (FILE *fp, TransformMat *t)
+void Layer::PrintRect (RectWriter *w, TransformMat *t)
 {
-  list_t *l;
-
-  l = list_new ();
+  TileStack l;
 
-  //debug_apply = 1;
-  
-  hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		    l, append_nonspacetile);
+  hint->visitAll ([&] (Tile *x) { if (!x->isSpace()) l.push (x); });
 
   //hint->printall();
-  
-  //debug_apply = 0;
 
-
-  while (!list_isempty (l)) {
-    Tile *tmp = (Tile *) list_delete_tail (l);
+  while (!l.empty()) {
+    Tile *tmp = l.pop ();
+    int type;
+    const char *net, *mname, *rest;
 
     if (tmp->virt && TILE_ATTR_ISDIFF (tmp->getAttr())) {
       /* this is actually a space tile (virtual diff) */
@@ -260,31 +325,31 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
 
     if (mat != Technology::T->poly && tmp->isPin()) {
       if (TILE_ATTR_ISOUTPUT(tmp->attr)) {
-	fprintf (fp, "outrect ");
+	type = RECT_REC_OUTRECT;
       }
       else {
-	fprintf (fp, "inrect ");
+	type = RECT_REC_INRECT;
       }
     }
     else {
-      fprintf (fp, "rect ");
+      type = RECT_REC_RECT;
     }
 
     if (tmp->net) {
-      dump_node (fp, N, (node_t *)tmp->net);
+      net = w->nodename (N, (node_t *)tmp->net);
     }
     else {
-      fprintf (fp, "#");
+      net = NULL;
     }
 
     if ((tmp->virt && TILE_ATTR_ISFET(tmp->getAttr()))) {
-      fprintf (fp, " %s", mat->getName());
+      mname = mat->getName();
     }
     else if (TILE_ATTR_ISROUTE(tmp->getAttr()) || (nother == 0)) {
-      fprintf (fp, " %s", mat->getName());
+      mname = mat->getName();
     }
     else {
-      fprintf (fp, " %s", other[TILE_ATTR_NONPOLY(tmp->getAttr())]->getName());
+      mname = other[TILE_ATTR_NONPOLY(tmp->getAttr())]->getName();
     }
     
     long llx, lly, urx, ury;
@@ -311,9 +376,8 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
       ury = tmp->getury();
     }
     
-    fprintf (fp, " %ld %ld %ld %ld", llx, lly, urx+1, ury+1);
-
     /*-- now if there is a fet to the right or the left then print it! --*/
+    rest = NULL;
     if (tmp->net) {
       Tile *tllx, *turx;
       int fet_left, fet_right;
@@ -334,51 +398,46 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
       }
 
       if (fet_left && fet_right) {
-	fprintf (fp, " center");
+	rest = "center";
       }
       else if (fet_right) {
-	fprintf (fp, " left");
+	rest = "left";
       }
       else if (fet_left) {
-	fprintf (fp, " right");
+	rest = "right";
       }
     }
-    fprintf (fp, "\n");
+    w->rect (type, net, mname, llx, lly, urx+1, ury+1, rest);
   }    
-  list_free (l);
 
   if (vhint) {
-    l = list_new ();
-    
-    vhint->applyTiles (MIN_VALUE, MIN_VALUE,
-		       (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		       l, append_nonspacetile);
+    vhint->visitAll ([&] (Tile *x) { if (!x->isSpace()) l.push (x); });
 
-    while (!list_isempty (l)) {
-      Tile *tmp = (Tile *) list_delete_tail (l);
+    while (!l.empty()) {
+      Tile *tmp = l.pop ();
+      const char *net, *mname;
 
-      fprintf (fp, "rect ");
       if (tmp->net) {
-	dump_node (fp, N, (node_t *)tmp->net);
+	net = w->nodename (N, (node_t *)tmp->net);
       }
       else {
-	fprintf (fp, "#");
+	net = NULL;
       }
 
       if (nother == 0) {
-	fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
+	mname = ((RoutingMat *)mat)->getUpC()->getName();
       }
       else {
 	// we need to look at what is below
 	Tile *dn;
 	dn = find (tmp->getllx(), tmp->getlly());
 	if (dn->isSpace() || TILE_ATTR_ISROUTE(dn->getAttr())) {
-	  fprintf (fp, " %s", ((RoutingMat *)mat)->getUpC()->getName());
+	  mname = ((RoutingMat *)mat)->getUpC()->getName();
 	}
 	else {
 	  Assert (TILE_ATTR_NONPOLY(dn->getAttr()) < nother, "What?");
 	  Material *tm = other[TILE_ATTR_NONPOLY(dn->getAttr())];
-	  fprintf (fp, " %s", ((DiffMat *)tm)->getUpC()->getName());
+	  mname = ((DiffMat *)tm)->getUpC()->getName();
 	}
       }
 
@@ -405,9 +464,8 @@ void Layer::PrintRect (FILE *fp, TransformMat *t)
 	urx = tmp->geturx();
 	ury = tmp->getury();
       }
-      fprintf (fp, " %ld %ld %ld %ld\n", llx, lly, urx+1, ury+1);
+      w->rect (RECT_REC_RECT, net, mname, llx, lly, urx+1, ury+1);
     }    
-    list_free (l);
   }
 }
 
@@ -423,184 +481,157 @@ void Layer::getBloatBBox (long *llx, long *lly, long *urx, long *ury)
   *ury = _bury;
 }
 
-void Layer::getBBox (long *llx, long *lly, long *urx, long *ury)
+/*
+ * Half the spacing needed around a tile with attribute attr; round
+ * up so that you can mirror the cells. If mirroring is not allowed
+ * during placement, we can change this to two different bloats:
+ * left/bot could be floor(bloat/2), and right/top could be
+ * ceil(bloat/2).
+ */
+long Layer::_bloat (unsigned int attr)
 {
-  list_t *l;
-  long xllx, xlly, xurx, xury;
-  long bxllx, bxlly, bxurx, bxury;
-  int first = 1;
   long bloat;
 
-  if (bbox) {
-    /* cached */
-    *llx = _llx;
-    *lly = _lly;
-    *urx = _urx;
-    *ury = _ury;
-    return;
+  if (TILE_ATTR_ISROUTE(attr)) {
+    bloat = ((RoutingMat *)mat)->minSpacing();
   }
-
-  l = list_new ();
-  
-  hint->applyTiles (MIN_VALUE+1, MIN_VALUE+1,
-		    (unsigned long)MAX_VALUE - (MIN_VALUE + 1), (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
-		    l, append_nonspacetile);
-
-  xllx = 0;
-  xlly = 0;
-  xurx = -1;
-  xury = -1;
-  bxllx = 0;
-  bxlly = 0;
-  bxurx = -1;
-  bxury = -1;
-
-  while (!list_isempty (l)) {
-    Tile *tmp = (Tile *) list_delete_tail (l);
-    long tllx, tlly, turx, tury;
-
-    if (tmp->virt && TILE_ATTR_ISDIFF (tmp->getAttr())) {
-      /* this is actually a space tile (virtual diff) */
-      continue;
-    }
-
-    tllx = tmp->getllx ();
-    tlly = tmp->getlly ();
-    turx = tmp->geturx ();
-    tury = tmp->getury ();
-
-    /* compute bloat for the tile */
-    if (TILE_ATTR_ISROUTE(tmp->getAttr())) {
-      bloat = ((RoutingMat *)mat)->minSpacing();
-    }
-    else if (nother == 0 && TILE_ATTR_ISPIN(tmp->getAttr())) {
-      bloat = ((RoutingMat *)mat)->minSpacing();
-    }
-    else {
-      Material *mo;
-      Assert (nother > 0, "What?");
-      Assert (TILE_ATTR_ISROUTE(tmp->getAttr()) < nother, "What?");
-      mo = other[TILE_ATTR_NONPOLY(tmp->getAttr())];
-      Assert (mo, "What?");
-
-      if (TILE_ATTR_ISFET (tmp->getAttr())) {
-	bloat = ((FetMat *)mo)->getSpacing(0);
-      }
-      else if (TILE_ATTR_ISDIFF(tmp->getAttr()) ||
-	       TILE_ATTR_ISWDIFF(tmp->getAttr())) {
-	bloat = Technology::T->getMaxSameDiffSpacing();
-      }
-      else {
-	fatal_error ("Bad attributes?!");
-      }
+  else if (nother == 0 && TILE_ATTR_ISPIN(attr)) {
+    bloat = ((RoutingMat *)mat)->minSpacing();
+  }
+  else {
+    Material *mo;
+    Assert (nother > 0, "What?");
+    Assert (TILE_ATTR_ISROUTE(attr) < nother, "What?");
+    mo = other[TILE_ATTR_NONPOLY(attr)];
+    Assert (mo, "What?");
+
+    if (TILE_ATTR_ISFET (attr)) {
+      bloat = ((FetMat *)mo)->getSpacing(0);
     }
-
-    /* half bloat of min spacing; round up so that you can mirror the
-       cells; if mirroring is not allowed during placement, we can
-       change this to two different bloats: left/bot could be 
-       floor(bloat/2), and right/top could be ceil(bloat/2).
-    */
-    bloat = (bloat + 1)/2;
-
-    if (first) {
-      xllx = tllx;
-      xlly = tlly;
-      xurx = turx;
-      xury = tury;
-      bxllx = tllx - bloat;
-      bxlly = tlly - bloat;
-      bxurx = turx + bloat;
-      bxury = tury + bloat;
-      first = 0;
+    else if (TILE_ATTR_ISDIFF(attr) || TILE_ATTR_ISWDIFF(attr)) {
+      bloat = Technology::T->getMaxSameDiffSpacing();
     }
     else {
-      xllx = MIN(xllx, tllx);
-      xlly = MIN(xlly, tlly);
-      xurx = MAX(xurx, turx);
-      xury = MAX(xury, tury);
-
-      bxllx = MIN(bxllx, tllx - bloat);
-      bxlly = MIN(bxlly, tlly - bloat);
-      bxurx = MAX(bxurx, turx + bloat);
-      bxury = MAX(bxury, tury + bloat);
+      fatal_error ("Bad attributes?!");
     }
   }
-  list_free (l);
-  
-  *llx = xllx;
-  *lly = xlly;
-  *urx = xurx;
-  *ury = xury;
-
-  bbox = 1;
-  _llx = xllx;
-  _lly = xlly;
-  _urx = xurx;
-  _ury = xury;
-  _bllx = bxllx;
-  _blly = bxlly;
-  _burx = bxurx;
-  _bury = bxury;
+  return (bloat + 1)/2;
 }
 
-
-static void *_searchnet = NULL;
-static void appendnet (void *cookie, Tile *t)
+/*
+ * Add a tile to the bbox and bloated bbox
+ */
+void Layer::_addBBox (Tile *tmp)
 {
-  list_t *l = (list_t *)cookie;
-  if (t->getNet () == _searchnet) {
-    list_append (l, t);
+  long tllx, tlly, turx, tury;
+  long bloat;
+
+  if (tmp->isSpace()) {
+    return;
+  }
+
+  if (tmp->virt && TILE_ATTR_ISDIFF (tmp->getAttr())) {
+    /* this is actually a space tile (virtual diff) */
+    return;
+  }
+
+  tllx = tmp->getllx ();
+  tlly = tmp->getlly ();
+  turx = tmp->geturx ();
+  tury = tmp->getury ();
+
+  bloat = _bloat (tmp->getAttr());
+
+  if (_llx > _urx) {
+    _llx = tllx;
+    _lly = tlly;
+    _urx = turx;
+    _ury = tury;
+    _bllx = tllx - bloat;
+    _blly = tlly - bloat;
+    _burx = turx + bloat;
+    _bury = tury + bloat;
+  }
+  else {
+    _llx = MIN(_llx, tllx);
+    _lly = MIN(_lly, tlly);
+    _urx = MAX(_urx, turx);
+    _ury = MAX(_ury, tury);
+
+    _bllx = MIN(_bllx, tllx - bloat);
+    _blly = MIN(_blly, tlly - bloat);
+    _burx = MAX(_burx, turx + bloat);
+    _bury = MAX(_bury, tury + bloat);
   }
 }
 
-static int _searchtype = -1;
-static void appendtype (void *cookie, Tile *t)
+void Layer::getBBox (long *llx, long *lly, long *urx, long *ury)
 {
-  list_t *l = (list_t *)cookie;
-  if (t->getAttr() == _searchtype) {
-    list_append (l, t);
+  if (!bbox) {
+    /* re-compute from scratch */
+    _llx = 0;
+    _lly = 0;
+    _urx = -1;
+    _ury = -1;
+    _bllx = 0;
+    _blly = 0;
+    _burx = -1;
+    _bury = -1;
+
+    hint->visitTiles (MIN_VALUE+1, MIN_VALUE+1,
+		      (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		      (unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		      [&] (Tile *tmp) { _addBBox (tmp); });
+    bbox = 1;
   }
+  *llx = _llx;
+  *lly = _lly;
+  *urx = _urx;
+  *ury = _ury;
 }
 
+
 list_t *Layer::searchMat (void *net)
 {
   list_t *l = list_new ();
-  _searchnet = net;
-  hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendnet);
-  _searchnet = NULL;
+  hint->visitAll ([&] (Tile *t) {
+    if (t->getNet () == net) {
+      list_append (l, t);
+    }
+  });
   return l;
 }
 
 list_t *Layer::searchMat (int type)
 {
   list_t *l = list_new ();
-  _searchtype = type;
-  hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendtype);
+  hint->visitAll ([&] (Tile *t) {
+    if (t->getAttr () == (unsigned int)type) {
+      list_append (l, t);
+    }
+  });
   return l;
 }
 
 list_t *Layer::searchVia (void *net)
 {
   list_t *l = list_new ();
-  _searchnet = net;
-  vhint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendnet);
-  _searchnet = NULL;
+  vhint->visitAll ([&] (Tile *t) {
+    if (t->getNet () == net) {
+      list_append (l, t);
+    }
+  });
   return l;
 }
 
 list_t *Layer::searchVia (int type)
 {
   list_t *l = list_new ();
-  _searchtype = type;
-  vhint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l, appendtype);
+  vhint->visitAll ([&] (Tile *t) {
+    if (t->getAttr () == (unsigned int)type) {
+      list_append (l, t);
+    }
+  });
   return l;
 }
 
@@ -609,16 +640,18 @@ list_t *Layer::allNonSpaceMat ()
   list_t *l = list_new ();
 
   if (isMetal()) {
-    hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
-		      append_nonspacetile);
+    hint->visitAll ([&] (Tile *t) {
+      if (!t->isSpace()) {
+	list_append (l, t);
+      }
+    });
   }
   else {
-    hint->applyTiles (MIN_VALUE, MIN_VALUE,
-		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		      (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
-		      append_nonspacebasetile);
+    hint->visitAll ([&] (Tile *t) {
+      if (!t->isBaseSpace()) {
+	list_append (l, t);
+      }
+    });
   }
   return l;
 }
@@ -626,17 +659,54 @@ list_t *Layer::allNonSpaceMat ()
 list_t *Layer::allNonSpaceVia ()
 {
   list_t *l = list_new ();
-  vhint->applyTiles (MIN_VALUE, MIN_VALUE,
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1),
-		    (unsigned long)MAX_VALUE + -(MIN_VALUE + 1), l,
-		    append_nonspacetile);
+  vhint->visitAll ([&] (Tile *t) {
+    if (!t->isSpace()) {
+      list_append (l, t);
+    }
+  });
   return l;
 }
 
 
 Tile *Layer::find (long llx, long lly)
 {
-  return hint->find (llx, lly);
+  Tile *t;
+  unsigned long h0 = Tile::_nhops;
+
+  if (_use_locality) {
+    t = _last->find (llx, lly);
+    _last = t;
+  }
+  else {
+    t = hint->find (llx, lly);
+  }
+  _nfind++;
+  _nhops += Tile::_nhops - h0;
+  return t;
+}
+
+void Layer::addTileStats (struct layout_tile_stats *s)
+{
+  s->ntiles += pool->numTiles ();
+  s->peak += pool->peakTiles ();
+  s->bytes += pool->numBytes ();
+  s->nfind += _nfind;
+  s->nhops += _nhops;
+  s->nmerged += _nmerged;
+}
+
+void Layer::mergeTiles ()
+{
+  unsigned long n = pool->numTiles ();
+
+  hint->mergeStrips (pool);
+  vhint->mergeStrips (pool);
+  _nmerged += n - pool->numTiles ();
+
+  /* hint and vhint are never deleted by a merge */
+  _last = hint;
+  _vlast = vhint;
+  _gen++;
 }
 
 
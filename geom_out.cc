@@ -0,0 +1,224 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <common/misc.h>
+#include <common/hash.h>
+#include "geom.h"
+
+BufWriter::BufWriter (FILE *fp, int sz)
+{
+  Assert (sz > 32, "BufWriter: buffer too small");
+  _fp = fp;
+  _sz = sz;
+  _n = 0;
+  MALLOC (_buf, char, _sz);
+  _names = NULL;
+}
+
+BufWriter::~BufWriter ()
+{
+  flush ();
+  FREE (_buf);
+  if (_names) {
+    phash_iter_t it;
+    phash_bucket_t *b;
+    phash_iter_init (_names, &it);
+    while ((b = phash_iter_next (_names, &it))) {
+      FREE (b->v);
+    }
+    phash_free (_names);
+  }
+}
+
+void BufWriter::flush ()
+{
+  if (_n > 0) {
+    fwrite (_buf, 1, _n, _fp);
+    _n = 0;
+  }
+}
+
+void BufWriter::put (const char *s)
+{
+  while (*s) {
+    int k = 0;
+    while (_n < _sz && s[k]) {
+      _buf[_n++] = s[k++];
+    }
+    s += k;
+    if (_n == _sz) {
+      flush ();
+    }
+  }
+}
+
+void BufWriter::putlong (long v)
+{
+  char tmp[24];
+  int k = sizeof (tmp);
+  unsigned long u;
+
+  if (_sz - _n < (int)sizeof (tmp)) {
+    flush ();
+  }
+  if (v < 0) {
+    _buf[_n++] = '-';
+    u = -(unsigned long)v;
+  }
+  else {
+    u = v;
+  }
+  do {
+    tmp[--k] = '0' + (u % 10);
+    u /= 10;
+  } while (u);
+  memcpy (_buf + _n, tmp + k, sizeof (tmp) - k);
+  _n += sizeof (tmp) - k;
+}
+
+/*
+ * Equivalent to printf ("%.6f", v). The value is scaled to an integer
+ * number of millionths; this matches the correctly rounded decimal
+ * unless the scaled value is (nearly) halfway between two integers or
+ * too large to be represented exactly, in which case we use printf.
+ */
+void BufWriter::putfixed (double v)
+{
+  double x = fabs (v) * 1e6;
+  double f;
+  unsigned long u;
+  int k;
+
+  if (!(x < 1e12)) {
+    _fixed_slow (v);
+    return;
+  }
+  f = x - floor (x);
+  if (f > 0.499 && f < 0.501) {
+    _fixed_slow (v);
+    return;
+  }
+  u = (unsigned long) (x + 0.5);
+
+  if (_sz - _n < 32) {
+    flush ();
+  }
+  if (signbit (v)) {
+    _buf[_n++] = '-';
+  }
+
+  char tmp[24];
+  k = sizeof (tmp);
+  for (int i=0; i < 6; i++) {
+    tmp[--k] = '0' + (u % 10);
+    u /= 10;
+  }
+  tmp[--k] = '.';
+  do {
+    tmp[--k] = '0' + (u % 10);
+    u /= 10;
+  } while (u);
+  memcpy (_buf + _n, tmp + k, sizeof (tmp) - k);
+  _n += sizeof (tmp) - k;
+}
+
+void BufWriter::_fixed_slow (double v)
+{
+  printf ("%.6f", v);
+}
+
+void BufWriter::printf (const char *fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start (ap, fmt);
+  len = vsnprintf (_buf + _n, _sz - _n, fmt, ap);
+  va_end (ap);
+
+  if (len < _sz - _n) {
+    _n += len;
+    return;
+  }
+  flush ();
+
+  va_start (ap, fmt);
+  len = vsnprintf (_buf, _sz, fmt, ap);
+  va_end (ap);
+
+  if (len < _sz) {
+    _n = len;
+    return;
+  }
+
+  /* longer than the whole buffer */
+  va_start (ap, fmt);
+  vfprintf (_fp, fmt, ap);
+  va_end (ap);
+}
+
+void BufWriter::putmangle (Act *a, const char *s)
+{
+  char buf[10240];
+  a->msnprintf (buf, 10240, "%s", s);
+  put (buf);
+}
+
+void BufWriter::putnode (netlist_t *N, node_t *n)
+{
+  put (nodename (N, n));
+}
+
+const char *BufWriter::nodename (netlist_t *N, node_t *n)
+{
+  phash_bucket_t *b;
+  char buf[10240];
+
+  if (!n->v) {
+    if (n == N->Vdd) {
+      return "Vdd";
+    }
+    if (n == N->GND) {
+      return "GND";
+    }
+  }
+  if (!_names) {
+    _names = phash_new (32);
+  }
+  b = phash_lookup (_names, n);
+  if (!b) {
+    if (n->v) {
+      ActId *tmp = n->v->v->id->toid();
+      tmp->sPrint (buf, 10240);
+      delete tmp;
+    }
+    else {
+      snprintf (buf, 10240, "#%ld", (long) n->i);
+    }
+    b = phash_add (_names, n);
+    b->v = Strdup (buf);
+  }
+  return (const char *) b->v;
+}
@@ -0,0 +1,622 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <common/misc.h>
+#include <common/hash.h>
+#include "geom.h"
+
+/* binary record tags */
+#define RB_STR     1
+#define RB_RECT    2		// RB_RECT + RECT_REC_<type> for rects
+#define RB_INRECT  3
+#define RB_OUTRECT 4
+#define RB_BBOX    5
+#define RB_SBOX    6
+#define RB_CELL    7
+#define RB_END     8
+
+static const char _rb_header[] = "ACTRECT\001";
+#define RB_HEADER_LEN 8
+
+static const char *_rect_keyword[] =
+  { "rect", "inrect", "outrect", "bbox", "sbox", "cell" };
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Text tokenizer: lines and tokens are NUL-terminated in place
+ *
+ *------------------------------------------------------------------------
+ */
+static char *_rect_skip (char *s)
+{
+  while (*s && isspace (*s)) {
+    s++;
+  }
+  return s;
+}
+
+static char *_rect_token (char **s)
+{
+  char *tok = _rect_skip (*s);
+  char *e = tok;
+
+  while (*e && !isspace (*e)) {
+    e++;
+  }
+  if (*e) {
+    *e = '\0';
+    e++;
+  }
+  *s = e;
+  return tok;
+}
+
+/* parses a decimal integer; returns 0 if there isn't one */
+static int _rect_long (char **s, long *v)
+{
+  char *t = _rect_skip (*s);
+  int neg = 0;
+  long x = 0;
+
+  if (*t == '-' || *t == '+') {
+    neg = (*t == '-');
+    t++;
+  }
+  if (!isdigit (*t)) {
+    return 0;
+  }
+  while (isdigit (*t)) {
+    x = 10*x + (*t - '0');
+    t++;
+  }
+  *v = neg ? -x : x;
+  *s = t;
+  return 1;
+}
+
+/* the rest of the line, without surrounding blanks; NULL if empty */
+static char *_rect_rest (char *s)
+{
+  char *e;
+
+  s = _rect_skip (s);
+  if (!*s) {
+    return NULL;
+  }
+  e = s + strlen (s);
+  while (e > s && isspace (e[-1])) {
+    e--;
+  }
+  *e = '\0';
+  return s;
+}
+
+
+RectReader::RectReader ()
+{
+  _name = NULL;
+  _buf = NULL;
+  _len = 0;
+  _pos = 0;
+  _binary = 0;
+  _line = 0;
+  _strs = NULL;
+  _nstrs = 0;
+  _maxstrs = 0;
+  _px = 0;
+  _py = 0;
+}
+
+RectReader::~RectReader ()
+{
+  if (_buf) {
+    FREE (_buf);
+  }
+  for (int i=0; i < _nstrs; i++) {
+    FREE (_strs[i]);
+  }
+  if (_strs) {
+    FREE (_strs);
+  }
+}
+
+int RectReader::isBinary (const char *file)
+{
+  int len = strlen (file);
+  if (len >= 6 && strcmp (file + len - 6, ".rectb") == 0) {
+    return 1;
+  }
+  return 0;
+}
+
+int RectReader::open (const char *file)
+{
+  FILE *fp;
+  int ret;
+
+  fp = fopen (file, "rb");
+  if (!fp) {
+    return 0;
+  }
+  ret = open (fp, isBinary (file), file);
+  fclose (fp);
+  return ret;
+}
+
+/*
+  Reads the rest of fp into memory.
+*/
+int RectReader::open (FILE *fp, int binary, const char *name)
+{
+  long start, end;
+
+  Assert (!_buf, "RectReader::open() called twice");
+
+  _name = name;
+  _binary = binary;
+
+  start = ftell (fp);
+  if (start < 0 || fseek (fp, 0, SEEK_END) != 0) {
+    warning ("%s: could not read .rect file", _name);
+    return 0;
+  }
+  end = ftell (fp);
+  fseek (fp, start, SEEK_SET);
+
+  _len = end - start;
+  MALLOC (_buf, char, _len + 1);
+  _len = fread (_buf, 1, _len, fp);
+  _buf[_len] = '\0';
+  _pos = 0;
+
+  if (_binary) {
+    if (_len < RB_HEADER_LEN ||
+	memcmp (_buf, _rb_header, RB_HEADER_LEN) != 0) {
+      warning ("%s: not a binary .rect file", _name);
+      return 0;
+    }
+    _pos = RB_HEADER_LEN;
+  }
+  return 1;
+}
+
+int RectReader::next (struct rect_record *r)
+{
+  r->net = NULL;
+  r->mat = NULL;
+  r->rest = NULL;
+  r->llx = 0;
+  r->lly = 0;
+  r->urx = 0;
+  r->ury = 0;
+
+  if (_binary) {
+    return _nextBinary (r);
+  }
+  else {
+    return _nextText (r);
+  }
+}
+
+int RectReader::_nextText (struct rect_record *r)
+{
+  char *line, *s, *tok, *e;
+
+  while (_pos < _len) {
+    line = _buf + _pos;
+    e = (char *) memchr (line, '\n', _len - _pos);
+    if (e) {
+      *e = '\0';
+      _pos = e - _buf + 1;
+    }
+    else {
+      _pos = _len;
+    }
+    _line++;
+
+    s = _rect_skip (line);
+    if (*s == '\0' || *s == '#') continue;
+
+    tok = _rect_token (&s);
+    if (strcmp (tok, "rect") == 0) {
+      r->type = RECT_REC_RECT;
+    }
+    else if (strcmp (tok, "inrect") == 0) {
+      r->type = RECT_REC_INRECT;
+    }
+    else if (strcmp (tok, "outrect") == 0) {
+      r->type = RECT_REC_OUTRECT;
+    }
+    else if (strcmp (tok, "bbox") == 0 || strcmp (tok, "sbox") == 0) {
+      r->type = (tok[0] == 'b' ? RECT_REC_BBOX : RECT_REC_SBOX);
+      if (!_rect_long (&s, &r->llx) || !_rect_long (&s, &r->lly) ||
+	  !_rect_long (&s, &r->urx) || !_rect_long (&s, &r->ury)) {
+	fatal_error ("%s, line %d: %s spec error", _name, _line, tok);
+      }
+      return 1;
+    }
+    else if (strcmp (tok, "cell") == 0) {
+      /* celltype id orientation dx dy [arr nx px ny py] */
+      r->type = RECT_REC_CELL;
+      r->net = _rect_token (&s);
+      r->mat = _rect_token (&s);
+      r->rest = _rect_rest (s);
+      if (!*r->net || !*r->mat) {
+	fatal_error ("%s, line %d: cell spec error", _name, _line);
+      }
+      return 1;
+    }
+    else {
+      fatal_error ("%s, line %d: needs inrect, outrect, rect, bbox, sbox, or cell", _name, _line);
+    }
+
+    r->net = _rect_token (&s);
+    if (strcmp (r->net, "#") == 0) {
+      r->net = NULL;
+    }
+    r->mat = _rect_token (&s);
+    if (!*r->mat ||
+	!_rect_long (&s, &r->llx) || !_rect_long (&s, &r->lly) ||
+	!_rect_long (&s, &r->urx) || !_rect_long (&s, &r->ury)) {
+      fatal_error ("%s, line %d: rect spec error", _name, _line);
+    }
+    r->rest = _rect_rest (s);
+    return 1;
+  }
+  return 0;
+}
+
+
+#define RB_CORRUPT fatal_error ("%s: corrupt binary .rect file (offset %ld)", _name, _pos)
+
+unsigned long RectReader::_uvar ()
+{
+  unsigned long v = 0;
+  int shift = 0;
+  unsigned char c;
+
+  do {
+    if (_pos >= _len || shift > 63) {
+      RB_CORRUPT;
+    }
+    c = _buf[_pos++];
+    v |= (unsigned long)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return v;
+}
+
+long RectReader::_svar ()
+{
+  unsigned long v = _uvar ();
+  return (v & 1) ? ~(long)(v >> 1) : (long)(v >> 1);
+}
+
+char *RectReader::_str ()
+{
+  unsigned long id = _uvar ();
+  if (id == 0) {
+    return NULL;
+  }
+  if (id > (unsigned long)_nstrs) {
+    RB_CORRUPT;
+  }
+  return _strs[id-1];
+}
+
+int RectReader::_nextBinary (struct rect_record *r)
+{
+  unsigned long n;
+
+  while (_pos < _len) {
+    int tag = (unsigned char)_buf[_pos++];
+    switch (tag) {
+    case RB_STR:
+      n = _uvar ();
+      if (n > (unsigned long)(_len - _pos)) {
+	RB_CORRUPT;
+      }
+      if (_nstrs == _maxstrs) {
+	_maxstrs = (_maxstrs == 0 ? 32 : 2*_maxstrs);
+	REALLOC (_strs, char *, _maxstrs);
+      }
+      MALLOC (_strs[_nstrs], char, n + 1);
+      memcpy (_strs[_nstrs], _buf + _pos, n);
+      _strs[_nstrs][n] = '\0';
+      _nstrs++;
+      _pos += n;
+      break;
+
+    case RB_RECT:
+    case RB_INRECT:
+    case RB_OUTRECT:
+      r->type = RECT_REC_RECT + (tag - RB_RECT);
+      r->net = _str ();
+      r->mat = _str ();
+      r->llx = _px + _svar ();
+      r->lly = _py + _svar ();
+      r->urx = r->llx + _svar ();
+      r->ury = r->lly + _svar ();
+      r->rest = _str ();
+      if (!r->mat) {
+	RB_CORRUPT;
+      }
+      _px = r->llx;
+      _py = r->lly;
+      return 1;
+
+    case RB_BBOX:
+    case RB_SBOX:
+      r->type = (tag == RB_BBOX ? RECT_REC_BBOX : RECT_REC_SBOX);
+      r->llx = _svar ();
+      r->lly = _svar ();
+      r->urx = _svar ();
+      r->ury = _svar ();
+      return 1;
+
+    case RB_CELL:
+      r->type = RECT_REC_CELL;
+      r->net = _str ();
+      r->mat = _str ();
+      r->rest = _str ();
+      if (!r->net || !r->mat) {
+	RB_CORRUPT;
+      }
+      return 1;
+
+    case RB_END:
+      /* the cell index follows; it is only needed for random access */
+      _pos = _len;
+      return 0;
+
+    default:
+      RB_CORRUPT;
+      break;
+    }
+  }
+  return 0;
+}
+
+
+RectWriter::RectWriter (FILE *fp, int binary)
+{
+  _fp = fp;
+  _binary = binary;
+  _pos = 0;
+  _strs = NULL;
+  _nstrs = 0;
+  _px = 0;
+  _py = 0;
+  _cells = NULL;
+  _ncells = 0;
+  _maxcells = 0;
+  _w = new BufWriter (fp);
+
+  if (_binary) {
+    _strs = hash_new (32);
+    _w->put (_rb_header);
+    _pos = RB_HEADER_LEN;
+  }
+}
+
+RectWriter::~RectWriter ()
+{
+  delete _w;
+  if (_strs) {
+    hash_free (_strs);
+  }
+  if (_cells) {
+    FREE (_cells);
+  }
+}
+
+void RectWriter::_byte (int c)
+{
+  _w->put ((char)c);
+  _pos++;
+}
+
+void RectWriter::_uvar (unsigned long v)
+{
+  while (v >= 0x80) {
+    _byte ((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  _byte (v);
+}
+
+void RectWriter::_svar (long v)
+{
+  if (v < 0) {
+    _uvar ((~(unsigned long)v << 1) | 1);
+  }
+  else {
+    _uvar ((unsigned long)v << 1);
+  }
+}
+
+/* string id for s; emits a string definition the first time */
+unsigned long RectWriter::_str (const char *s)
+{
+  hash_bucket_t *b;
+  int len;
+
+  if (!s) {
+    return 0;
+  }
+  b = hash_lookup (_strs, s);
+  if (!b) {
+    len = strlen (s);
+    _byte (RB_STR);
+    _uvar (len);
+    _w->put (s);
+    _pos += len;
+    b = hash_add (_strs, s);
+    b->i = ++_nstrs;
+  }
+  return b->i;
+}
+
+void RectWriter::write (struct rect_record *r)
+{
+  unsigned long n, m, x;
+
+  Assert (r->type >= RECT_REC_RECT && r->type <= RECT_REC_CELL, "What?");
+
+  if (!_binary) {
+    switch (r->type) {
+    case RECT_REC_RECT:
+    case RECT_REC_INRECT:
+    case RECT_REC_OUTRECT:
+      _w->put (_rect_keyword[r->type]);
+      _w->put (' ');
+      _w->put (r->net ? r->net : "#");
+      _w->put (' ');
+      _w->put (r->mat);
+      _w->putcoords (r->llx, r->lly, r->urx, r->ury);
+      if (r->rest) {
+	_w->put (' ');
+	_w->put (r->rest);
+      }
+      _w->put ('\n');
+      break;
+
+    case RECT_REC_BBOX:
+    case RECT_REC_SBOX:
+      _w->put (_rect_keyword[r->type]);
+      _w->putcoords (r->llx, r->lly, r->urx, r->ury);
+      _w->put ('\n');
+      break;
+
+    case RECT_REC_CELL:
+      _w->printf ("cell %s %s", r->net, r->mat);
+      if (r->rest) {
+	_w->put (' ');
+	_w->put (r->rest);
+      }
+      _w->put ('\n');
+      break;
+    }
+    return;
+  }
+
+  switch (r->type) {
+  case RECT_REC_RECT:
+  case RECT_REC_INRECT:
+  case RECT_REC_OUTRECT:
+    /* strings must be defined before the record that uses them */
+    n = _str (r->net);
+    m = _str (r->mat);
+    x = _str (r->rest);
+    _byte (RB_RECT + (r->type - RECT_REC_RECT));
+    _uvar (n);
+    _uvar (m);
+    _svar (r->llx - _px);
+    _svar (r->lly - _py);
+    _svar (r->urx - r->llx);
+    _svar (r->ury - r->lly);
+    _uvar (x);
+    _px = r->llx;
+    _py = r->lly;
+    break;
+
+  case RECT_REC_BBOX:
+  case RECT_REC_SBOX:
+    _byte (r->type == RECT_REC_BBOX ? RB_BBOX : RB_SBOX);
+    _svar (r->llx);
+    _svar (r->lly);
+    _svar (r->urx);
+    _svar (r->ury);
+    break;
+
+  case RECT_REC_CELL:
+    n = _str (r->net);
+    m = _str (r->mat);
+    x = _str (r->rest);
+    if (_ncells == _maxcells) {
+      _maxcells = (_maxcells == 0 ? 16 : 2*_maxcells);
+      REALLOC (_cells, long, _maxcells);
+    }
+    _cells[_ncells++] = _pos;
+    _byte (RB_CELL);
+    _uvar (n);
+    _uvar (m);
+    _uvar (x);
+    break;
+  }
+}
+
+void RectWriter::rect (int type, const char *net, const char *mat,
+			long llx, long lly, long urx, long ury,
+			const char *rest)
+{
+  struct rect_record r;
+
+  r.type = type;
+  r.net = (char *) net;
+  r.mat = (char *) mat;
+  r.llx = llx;
+  r.lly = lly;
+  r.urx = urx;
+  r.ury = ury;
+  r.rest = (char *) rest;
+  write (&r);
+}
+
+void RectWriter::box (int type, long llx, long lly, long urx, long ury)
+{
+  rect (type, NULL, NULL, llx, lly, urx, ury);
+}
+
+void RectWriter::cell (const char *celltype, const char *inst,
+		       const char *rest)
+{
+  rect (RECT_REC_CELL, celltype, inst, 0, 0, 0, 0, rest);
+}
+
+int RectWriter::writeAll (RectReader *rd)
+{
+  struct rect_record r;
+  int n = 0;
+
+  while (rd->next (&r)) {
+    write (&r);
+    n++;
+  }
+  return n;
+}
+
+void RectWriter::finish ()
+{
+  if (_binary) {
+    _byte (RB_END);
+    _uvar (_ncells);
+    for (int i=0; i < _ncells; i++) {
+      _uvar (_cells[i]);
+    }
+  }
+  _w->flush ();
+  fflush (_fp);
+}
@@ -35,7 +35,7 @@
 void usage (char *name)
 {
   fprintf (stderr, "Unknown options.\n");
-  fprintf (stderr, "Usage: %s -p procname [-s] [-o <name>] [-a <mult>] [-c <cell>] <file.act>\n", name);
+  fprintf (stderr, "Usage: %s -p procname [-s] [-o <name>] [-a <mult>] [-c <cell>] [-j <n>] <file.act>\n", name);
   fprintf (stderr, " -p procname: name of ACT process corresponding to the top-level of the design\n");
   fprintf (stderr, " -o <name>: output files will be <name>.<extension> (default: out)\n");
   fprintf (stderr, " -s : emit spice netlist\n");
@@ -44,6 +44,7 @@ void usage (char *name)
   fprintf (stderr, " -r <ratio> : use this as the aspect ratio = x-size/y-size (default 1.0)\n");
   fprintf (stderr, " -c <cell>: Read in the <cell> ACT file as a starting point for cells,\n\toverwriting it with an updated version with any new cells\n");
   fprintf (stderr, " -S : share staticizers\n");
+  fprintf (stderr, " -j <n>: use <n> threads for stack search, leaf cell layouts and LEF (default 1)\n");
   //fprintf (stderr, " -A : report area\n");
   fprintf (stderr, " -R : generate report\n");
   fprintf (stderr, "\n");
@@ -66,6 +67,7 @@ int main (int argc, char **argv)
   double aspect_ratio;
   int report = 0;
   int share_staticizers = 0;
+  int jobs = 1;
 
   area_multiplier = 1.4;
   aspect_ratio = 1.0;
@@ -85,7 +87,7 @@ int main (int argc, char **argv)
   }
 #endif
 
-  while ((ch = getopt (argc, argv, "c:p:o:sSPRa:r:")) != -1) {
+  while ((ch = getopt (argc, argv, "c:p:o:sSPRa:r:j:")) != -1) {
     switch (ch) {
     case 'S':
       share_staticizers = 1;
@@ -103,6 +105,13 @@ int main (int argc, char **argv)
       aspect_ratio = atof (optarg);
       break;
 
+    case 'j':
+      jobs = atoi (optarg);
+      if (jobs < 1) {
+	fatal_error ("-j: number of threads must be positive");
+      }
+      break;
+
     case 'c':
       if (cellname) {
 	FREE (cellname);
@@ -202,6 +211,13 @@ int main (int argc, char **argv)
     fclose (sp);
   }
 
+  lp->setParam ("jobs", jobs);
+  ActDynamicPass *sp =
+    dynamic_cast<ActDynamicPass *> (a->pass_find ("net2stk"));
+  if (sp) {
+    /* for the stack search */
+    sp->setParam ("jobs", jobs);
+  }
   lp->run (p);
 
   ActNamespace *cell_ns = a->findNamespace ("cell");
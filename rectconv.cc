@@ -0,0 +1,70 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <common/misc.h>
+
+#include "geom.h"
+
+/*
+  Converts between the text (.rect) and binary (.rectb) rectangle
+  file formats. The format of each file is given by its extension.
+*/
+
+void usage (char *name)
+{
+  fprintf (stderr, "Usage: %s <in> <out>\n", name);
+  fprintf (stderr, " Converts between .rect (text) and .rectb (binary) files;\n");
+  fprintf (stderr, " the format of each file is determined by its extension.\n");
+  exit (1);
+}
+
+int main (int argc, char **argv)
+{
+  RectReader rd;
+  FILE *fp;
+  int n;
+  long sz;
+
+  if (argc != 3) {
+    usage (argv[0]);
+  }
+
+  if (!rd.open (argv[1])) {
+    fatal_error ("Could not read file `%s'", argv[1]);
+  }
+
+  fp = fopen (argv[2], "wb");
+  if (!fp) {
+    fatal_error ("Could not open file `%s' for writing", argv[2]);
+  }
+
+  RectWriter wr (fp, RectReader::isBinary (argv[2]));
+  n = wr.writeAll (&rd);
+  wr.finish ();
+  sz = ftell (fp);
+  fclose (fp);
+
+  printf ("%s: %d records, %ld bytes -> %s: %ld bytes\n", argv[1], n,
+	  rd.size(), argv[2], sz);
+  return 0;
+}
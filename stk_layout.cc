@@ -25,6 +25,10 @@
 #include <act/passes.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include "stk_pass.h"
 #include "stk_layout.h"
 
@@ -274,6 +278,25 @@ void ActStackLayout::cacheConfig ()
     }
   }
 
+  /* the .rect format (text or binary) follows the extension */
+  _rect_suffix = ".rect";
+  if (config_exists ("lefdef.rect_ext")) {
+    const char *ext = config_get_string ("lefdef.rect_ext");
+    if (strcmp (ext, "rectb") == 0) {
+      _rect_suffix = ".rectb";
+    }
+    else if (strcmp (ext, "rect") != 0) {
+      fatal_error ("lefdef.rect_ext: must be rect or rectb");
+    }
+  }
+
+  if (config_exists ("lefdef.cache_dir")) {
+    _cache_dir = config_get_string ("lefdef.cache_dir");
+  }
+  else {
+    _cache_dir = NULL;
+  }
+
   if (config_exists ("lefdef.rect_wells")) {
     _rect_wells = config_get_int ("lefdef.rect_wells");
     if (_rect_wells != 0 && _rect_wells != 1) {
@@ -308,6 +331,10 @@ void ActStackLayout::cacheConfig ()
   else {
     _extra_tracks_right = 0;
   }
+
+  if (_cache_dir) {
+    _cacheHashConfig ();
+  }
 }
 
 ActStackLayout::ActStackLayout (ActPass *ap) 
@@ -343,6 +370,10 @@ ActStackLayout::ActStackLayout (ActPass *ap)
   _cell_header = 0;
   _fp = NULL;
   _fpcell = NULL;
+
+  _prebuilt = NULL;
+  _prelef = NULL;
+  _cache = NULL;
 }
 
 #define EDGE_FLAGS_LEFT 0x1
@@ -366,14 +397,20 @@ static int getwidth (int idx, edge_t *e)
   return EDGE_WIDTH (e,idx)*manufacturing_grid_in_nm/Technology::T->scale;
 }
 
-/* actual edge length */
-static int getlength (edge_t *e, double adj)
+static int min_length = -1;
+
+static void init_min_length ()
 {
-  static int min_length = -1;
   if (min_length == -1) {
     min_length = config_get_int ("net.min_length") *
       ActNetlistPass::getGridsPerLambda();
   }
+}
+
+/* actual edge length */
+static int getlength (edge_t *e, double adj)
+{
+  init_min_length ();
   if (e->l != min_length) {
     adj = 0;
   }
@@ -1102,11 +1139,17 @@ void *ActStackLayout::localop (ActPass *ap, Process *p, int mode)
     _fpcell = (FILE *)dp->getPtrParam ("cell_file");
   }
   if (mode == 0) {
+    if (!_prebuilt && dp->hasParam ("jobs") && dp->getIntParam ("jobs") > 1) {
+      _buildParallel (dp->getIntParam ("jobs"));
+    }
     return _createlocallayout (p);
   }
   else if (mode == 1) {
     emitLEFHeader (_fp);
     emitWellHeader (_fpcell);
+    if (!_prelef && dp->hasParam ("jobs") && dp->getIntParam ("jobs") > 1) {
+      _buildParallelLEF (dp->getIntParam ("jobs"));
+    }
     _emitlocalLEF (p);
   }
   else if (mode == 2) {
@@ -1141,15 +1184,19 @@ void layout_free (ActPass *ap, void *v)
   }
 }
 
-LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
+/*
+ * Name of the local .rect file for p, looked up in the .rect input
+ * path if there is one. Either extension is accepted, the configured
+ * one first; the reader picks the format from the name. The result is
+ * allocated.
+ */
+char *ActStackLayout::_localRectFile (Process *p)
 {
   char cname[10240];
+  char *tmpname;
+  const char *sfx[2];
   int len;
 
-  if (_rect_import == 0) {
-    return NULL;
-  }
-  
   if (!p) {
     snprintf (cname, 10240, "toplevel");
   }
@@ -1157,27 +1204,73 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
     a->msnprintfproc (cname, 10240, p);
   }
   len = strlen (cname);
-  snprintf (cname + len, 10240 - len, ".rect");
 
-  char *tmpname;
-  if (_rect_inpath) {
-    tmpname = path_open (_rect_inpath, cname, NULL);
+  sfx[0] = _rectSuffix ();
+  sfx[1] = (strcmp (sfx[0], ".rect") == 0) ? ".rectb" : ".rect";
+
+  for (int i=0; i < 2; i++) {
+    snprintf (cname + len, 10240 - len, "%s", sfx[i]);
+    if (_rect_inpath) {
+      tmpname = path_open (_rect_inpath, cname, NULL);
+    }
+    else {
+      tmpname = Strdup (cname);
+    }
+    if (tmpname && access (tmpname, R_OK) == 0) {
+      return tmpname;
+    }
+    if (tmpname) {
+      FREE (tmpname);
+    }
   }
-  else {
-    tmpname = NULL;
+  snprintf (cname + len, 10240 - len, "%s", sfx[0]);
+  return Strdup (cname);
+}
+
+LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
+{
+  char *fname;
+
+  if (_rect_import == 0) {
+    return NULL;
   }
-    
+
+  fname = _localRectFile (p);
 #if 0
-  printf (" === processing %s\n", cname);
+  printf (" === processing %s\n", fname);
 #endif
 
   Rectangle file_bbox;
-  LayoutBlob *b = LayoutBlob::ReadRect (tmpname ? tmpname : cname,
-					nl->getNL (p), file_bbox,
-					_rect_import);
-  if (tmpname) {
-    FREE (tmpname);
+  LayoutBlob *b = _readRectFile (p, fname, _rect_import, file_bbox);
+  FREE (fname);
+
+  if (!b) {
+    return NULL;
+  }
+  b->markRead ();
+
+  if (_rect_import == 4 || _rect_import == 5) {
+    if (b->getBBox() != file_bbox) {
+      warning ("%s: bounding box for rect file was changed", p->getName());
+      fprintf (stderr, "file: ");
+      file_bbox.print(stderr);
+      fprintf (stderr, "; computed: ");
+      b->getBBox().print(stderr);
+      fprintf (stderr, "\n");
+    }
   }
+  
+  return b;
+}
+
+/*
+ * Read a .rect file for process p, and align it so that y=0 is
+ * between the p and n diffusion, like the generated layout.
+ */
+LayoutBlob *ActStackLayout::_readRectFile (Process *p, const char *file,
+					   int mode, Rectangle &file_bbox)
+{
+  LayoutBlob *b = LayoutBlob::ReadRect (file, nl->getNL (p), file_bbox, mode);
 
   if (!b) {
     return NULL;
@@ -1221,7 +1314,7 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
     }
   }
   if (set_diff == 0) {
-    warning ("Read %s; no diffusion found?", cname);
+    warning ("Read %s; no diffusion found?", file);
   }
   else {
     /* 
@@ -1257,22 +1350,327 @@ LayoutBlob *ActStackLayout::_readlocalRect (Process *p)
     }
   }
   b = computeLEFBoundary (b);
-  b->markRead ();
+  return b;
+}
 
-  if (_rect_import == 4 || _rect_import == 5) {
-    if (b->getBBox() != file_bbox) {
-      warning ("%s: bounding box for rect file was changed", p->getName());
-      fprintf (stderr, "file: ");
-      file_bbox.print(stderr);
-      fprintf (stderr, "; computed: ");
-      b->getBBox().print(stderr);
-      fprintf (stderr, "\n");
+
+/*------------------------------------------------------------------------
+ *
+ *  Leaf cell cache
+ *
+ *  When lefdef.cache_dir is set, the generated layout for each leaf
+ *  cell is saved as a .rect file along with its LEF macro. The file
+ *  names include a hash of the netlist of the cell, the stacks chosen
+ *  for it, and the entire configuration (technology rules and all
+ *  lefdef options), so an entry is only used if none of these has
+ *  changed.
+ *
+ *------------------------------------------------------------------------
+ */
+#define LAYOUT_CACHE_VERSION "layout-cache-2"
+
+struct layout_cache_ent {
+  char *name;			// file name without the extension
+  int used;			// 1 if the layout is from/saved to the cache
+};
+
+static void _hash_str (unsigned long *h, const char *s)
+{
+  while (*s) {
+    *h = (*h ^ (unsigned char)*s) * 1099511628211UL;
+    s++;
+  }
+  /* separator */
+  *h = (*h ^ 0xff) * 1099511628211UL;
+}
+
+static void _hash_int (unsigned long *h, long v)
+{
+  char buf[32];
+  snprintf (buf, 32, "%ld", v);
+  _hash_str (h, buf);
+}
+
+static void _hash_real (unsigned long *h, double v)
+{
+  char buf[32];
+  snprintf (buf, 32, "%.17g", v);
+  _hash_str (h, buf);
+}
+
+static void _hash_node (unsigned long *h, netlist_t *N, node_t *n)
+{
+  if (!n) {
+    _hash_str (h, "-");
+  }
+  else if (n->v) {
+    char buf[10240];
+    ActId *tmp = n->v->v->id->toid();
+    tmp->sPrint (buf, 10240);
+    delete tmp;
+    _hash_str (h, buf);
+  }
+  else if (n == N->Vdd) {
+    _hash_str (h, "Vdd");
+  }
+  else if (n == N->GND) {
+    _hash_str (h, "GND");
+  }
+  else {
+    _hash_str (h, "#");
+    _hash_int (h, n->i);
+  }
+}
+
+void ActStackLayout::_cacheHashConfig ()
+{
+  unsigned long h = 14695981039346656037UL;
+
+  _hash_str (&h, LAYOUT_CACHE_VERSION);
+
+  _hash_int (&h, lambda_to_scale);
+  _hash_str (&h, _version);
+  _hash_int (&h, _micron_conv);
+  _hash_real (&h, _manufacturing_grid);
+  _hash_str (&h, _m_align_x->getName());
+  _hash_str (&h, _m_align_y->getName());
+  _hash_int (&h, _horiz_metal);
+  _hash_int (&h, _pin_layer);
+  _hash_int (&h, _extra_tracks_top);
+  _hash_int (&h, _extra_tracks_bot);
+  _hash_int (&h, _extra_tracks_left);
+  _hash_int (&h, _extra_tracks_right);
+
+  init_min_length ();
+  _hash_int (&h, min_length);
+
+  /* everything else that can change the geometry comes from the
+     configuration: the technology file and all the lefdef options */
+  char *cfg;
+  size_t cfg_sz;
+  FILE *fp = open_memstream (&cfg, &cfg_sz);
+  if (!fp) {
+    fatal_error ("Layout cache: could not allocate memory");
+  }
+  config_dump (fp);
+  fclose (fp);
+  _hash_str (&h, cfg);
+  free (cfg);
+
+  _cache_cfg = h;
+}
+
+/*
+ * The stacks: gate pairs, then the n and p raw stacks. Edges are
+ * identified by their position in the netlist.
+ */
+static void _hash_pair (unsigned long *h, netlist_t *N,
+			struct pHashtable *E, struct gate_pairs *gp)
+{
+  phash_bucket_t *b;
+
+  _hash_node (h, N, gp->l.n);
+  _hash_node (h, N, gp->l.p);
+  _hash_node (h, N, gp->r.n);
+  _hash_node (h, N, gp->r.p);
+  _hash_int (h, gp->basepair);
+  _hash_int (h, gp->share);
+  _hash_int (h, gp->n_start);
+  _hash_int (h, gp->p_start);
+  _hash_int (h, gp->n_fold);
+  _hash_int (h, gp->p_fold);
+  _hash_int (h, gp->nodeshare);
+  if (gp->basepair) {
+    b = phash_lookup (E, gp->u.e.n);
+    _hash_int (h, b ? b->i : -1);
+    b = phash_lookup (E, gp->u.e.p);
+    _hash_int (h, b ? b->i : -1);
+  }
+  else {
+    _hash_int (h, list_length (gp->u.gp));
+    for (listitem_t *li = list_first (gp->u.gp); li; li = list_next (li)) {
+      _hash_pair (h, N, E, (struct gate_pairs *) list_value (li));
     }
   }
-  
-  return b;
 }
 
+static void _hash_stacks (unsigned long *h, netlist_t *N, list_t *stks)
+{
+  struct pHashtable *E;
+  phash_bucket_t *b;
+  listitem_t *li, *mi;
+  int i;
+
+  if (!stks) {
+    _hash_str (h, "-");
+    return;
+  }
+  E = phash_new (32);
+  i = 0;
+  for (node_t *n = N->hd; n; n = n->next) {
+    for (li = list_first (n->e); li; li = list_next (li)) {
+      if (!phash_lookup (E, list_value (li))) {
+	b = phash_add (E, list_value (li));
+	b->i = i++;
+      }
+    }
+  }
+
+  li = list_first (stks);
+  for (mi = list_first ((list_t *) list_value (li)); mi;
+       mi = list_next (mi)) {
+    _hash_pair (h, N, E, (struct gate_pairs *) list_value (mi));
+  }
+  for (li = list_next (li); li; li = list_next (li)) {
+    list_t *raw = (list_t *) list_value (li);
+    _hash_str (h, "|");
+    if (!raw) continue;
+    for (listitem_t *si = list_first (raw); si; si = list_next (si)) {
+      int pos = 0;
+      _hash_str (h, "/");
+      /* node, followed by (edge, visited count, node) triples */
+      for (mi = list_first ((list_t *) list_value (si)); mi;
+	   mi = list_next (mi)) {
+	if (pos % 3 == 0) {
+	  _hash_node (h, N, (node_t *) list_value (mi));
+	}
+	else if (pos % 3 == 1) {
+	  b = phash_lookup (E, list_value (mi));
+	  _hash_int (h, b ? b->i : -1);
+	}
+	else {
+	  _hash_int (h, (long) list_value (mi));
+	}
+	pos++;
+      }
+    }
+  }
+  phash_free (E);
+}
+
+struct layout_cache_ent *ActStackLayout::_cacheEntry (Process *p)
+{
+  phash_bucket_t *b;
+  struct layout_cache_ent *ent;
+  netlist_t *N;
+  unsigned long h;
+  char cname[10240];
+
+  if (!_cache_dir || !p) {
+    return NULL;
+  }
+  if (!_cache) {
+    _cache = phash_new (32);
+  }
+  b = phash_lookup (_cache, p);
+  if (b) {
+    return (struct layout_cache_ent *) b->v;
+  }
+
+  N = nl->getNL (p);
+  a->msnprintfproc (cname, 10240, p);
+
+  h = _cache_cfg;
+  _hash_str (&h, cname);
+  for (node_t *n = N->hd; n; n = n->next) {
+    _hash_node (&h, N, n);
+    _hash_int (&h, n->supply);
+    _hash_int (&h, n->contact);
+    _hash_int (&h, (n->v && n->v->v->output) ? 1 : 0);
+    for (listitem_t *li = list_first (n->e); li; li = list_next (li)) {
+      edge_t *e = (edge_t *) list_value (li);
+      _hash_int (&h, e->type);
+      _hash_int (&h, e->flavor);
+      _hash_int (&h, e->w);
+      _hash_int (&h, e->l);
+      _hash_int (&h, e->nfolds);
+      _hash_int (&h, e->keeper);
+      _hash_node (&h, N, e->g);
+      _hash_node (&h, N, e->a);
+      _hash_node (&h, N, e->b);
+    }
+  }
+  for (int i=0; i < A_LEN (N->bN->ports); i++) {
+    char buf[10240];
+    ActId *tmp = N->bN->ports[i].c->toid();
+    tmp->sPrint (buf, 10240);
+    delete tmp;
+    _hash_str (&h, buf);
+    _hash_int (&h, N->bN->ports[i].omit);
+    _hash_int (&h, N->bN->ports[i].input);
+  }
+  _hash_stacks (&h, N, (list_t *) stk->getMap (p));
+
+  int len = strlen (_cache_dir) + strlen (cname) + 20;
+  NEW (ent, struct layout_cache_ent);
+  MALLOC (ent->name, char, len);
+  snprintf (ent->name, len, "%s/%s_%016lx", _cache_dir, cname, h);
+  ent->used = 0;
+
+  b = phash_add (_cache, p);
+  b->v = ent;
+  return ent;
+}
+
+/*
+ * Return the cached layout for p, if any. This also marks p as a cell
+ * whose layout is saved to the cache.
+ */
+LayoutBlob *ActStackLayout::_readCache (Process *p)
+{
+  struct layout_cache_ent *ent = _cacheEntry (p);
+  char fname[10240];
+  Rectangle file_bbox;
+
+  if (!ent) {
+    return NULL;
+  }
+  ent->used = 1;
+
+  snprintf (fname, 10240, "%s%s", ent->name, _rectSuffix ());
+  if (access (fname, R_OK) != 0) {
+    return NULL;
+  }
+  return _readRectFile (p, fname, 1, file_bbox);
+}
+
+void ActStackLayout::_writeCacheRect (Process *p, LayoutBlob *b)
+{
+  struct layout_cache_ent *ent = _cacheEntry (p);
+  char fname[10240], tmpname[10240];
+  FILE *fp;
+
+  if (!ent || !ent->used || !b) {
+    return;
+  }
+
+  Rectangle bloatbox = b->getBloatBBox ();
+  if (bloatbox.empty()) {
+    return;
+  }
+  TransformMat mat;
+  mat.translate (-bloatbox.llx(), -bloatbox.lly());
+
+  /* write to a temporary file and rename it, so that concurrent runs
+     sharing the cache never see a partial file */
+  snprintf (fname, 10240, "%s%s", ent->name, _rectSuffix ());
+  snprintf (tmpname, 10240, "%s.%d", fname, (int) getpid ());
+  fp = fopen (tmpname, "w");
+  if (!fp) {
+    warning ("Could not write layout cache file `%s'", tmpname);
+    return;
+  }
+  {
+    RectWriter w (fp, RectReader::isBinary (fname));
+    b->PrintRect (&w, &mat);
+    w.finish ();
+  }
+  fclose (fp);
+  if (rename (tmpname, fname) != 0) {
+    warning ("Could not write layout cache file `%s'", fname);
+    unlink (tmpname);
+  }
+}
 
 static bool _empty_stacks (list_t *l)
 {
@@ -1297,7 +1695,6 @@ static bool _empty_stacks (list_t *l)
 LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
 {
   list_t *stks;
-  BBox b;
   LayoutBlob *BLOB;
 
   Assert (stk, "What?");
@@ -1331,139 +1728,46 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     fatal_error ("Process %s: could not read local .rect file", p->getName());
   }
 
-  b.n.llx = 0;
-  b.n.lly = 0;
-  b.n.urx = 0;
-  b.n.ury = 0;
-  b.p = b.n;
-
-  listitem_t *li;
-
-  li = list_first (stks);
-  list_t *stklist = (list_t *) list_value (li);
-
-  BLOB = new LayoutBlob (BLOB_LIST);
-
-  int diffspace = _localdiffspace (p);
+  BLOB = _readCache (p);
+  if (BLOB) {
+    return BLOB;
+  }
 
-  int has_both_types = 0;
+  if (_prebuilt) {
+    phash_bucket_t *pb = phash_lookup (_prebuilt, p);
+    if (pb) {
+      BLOB = (LayoutBlob *) pb->v;
+      pb->v = NULL;
+    }
+  }
+  if (!BLOB) {
+    BLOB = _createstacklayout (p, stks);
+  }
 
-  //printf ("Creating local layout: %s\n", p->getName());
+  /* now we need to adjust the boundary of this cell to make sure
+     several alignment restrictions are satisfied.
+     
+     * The y-coordinate for 0 is on a track boundary.
 
-  if (list_length (stklist) > 0) {
-    /* dual stacks */
-    listitem_t *si;
+     This means that we have to bloat in the -y and +y direction so
+     that the bounding box is on a track boundary, rather than looking
+     at the total y dimension for bloating.
+    
+     * Any mirroring is legal. This means that we have to have
+       spacing/2 around all the material on all sides.
+  */
 
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      struct gate_pairs *gp;
-      Layout *l = new Layout(nl->getNL (p));
-      gp = (struct gate_pairs *) list_value (si);
-      has_both_types = 1;
+  BLOB = computeLEFBoundary (BLOB);
 
-      /*--- process gp ---*/
-      b = print_dualstack (l, gp, diffspace);
-      
-      l->DrawDiffBBox (b.flavor, EDGE_PFET,
-		       b.p.llx, b.p.lly, b.p.urx-b.p.llx, b.p.ury-b.p.lly);
-      l->DrawDiffBBox (b.flavor, EDGE_NFET,
-		       b.n.llx, b.n.lly, b.n.urx-b.n.llx, b.n.ury-b.n.lly);
+  /* --- add pins --- */
+  netlist_t *n = nl->getNL (p);
 
-      BLOB->appendBlob (new LayoutBlob (BLOB_BASE, l), BLOB_HORIZ);
-    }
+  if (!dummy_netlist && n->psc && n->nsc) {
+    dummy_netlist = n;
   }
 
-  li = list_next (li);
-  stklist = (list_t *) list_value (li);
-
-  /* XXX: check singlestack!!! */
-  int nxpos = b.n.urx;
-  int pxpos = b.p.urx;
-
-  if (stklist && (list_length (stklist) > 0)) {
-    /* n stacks */
-    listitem_t *si;
-
-    if (!has_both_types && list_value (list_next (li)) &&
-	(list_length ((list_t*) list_value (list_next (li))) > 0)) {
-      has_both_types = 1;
-    }
-
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      list_t *sl = (list_t *) list_value (si);
-      Layout *l = new Layout (nl->getNL (p));
-
-      b = print_singlestack (l, sl, diffspace, nxpos);
-      
-      l->DrawDiffBBox (b.flavor, EDGE_NFET, b.n.llx, b.n.lly,
-		       b.n.urx - b.n.llx, b.n.ury - b.n.lly);
-
-      if (!has_both_types && !Technology::T->well[EDGE_NFET][b.flavor]) {
-	l->DrawDiff (b.flavor, EDGE_PFET, b.n.llx, b.n.lly + diffspace +
-		     (b.n.ury - b.n.lly),
-		     b.n.urx - b.n.llx, b.n.ury - b.n.lly, l->getVdd());
-	l->DrawDiffBBox (b.flavor, EDGE_PFET, b.n.llx, b.n.lly + diffspace +
-			 (b.n.ury - b.n.lly),
-			 b.n.urx - b.n.llx, b.n.ury - b.n.lly);
-	has_both_types = 1;
-      }
-
-      BLOB->appendBlob (new LayoutBlob (BLOB_BASE, l), BLOB_HORIZ); 
-    }
-  }
-
-  li = list_next (li);
-  stklist = (list_t *) list_value (li);
-  if (stklist && (list_length (stklist) > 0)) {
-    /* p stacks */
-    listitem_t *si;
-
-    for (si = list_first (stklist); si; si = list_next (si)) {
-      list_t *sl = (list_t *) list_value (si);
-      Layout *l = new Layout (nl->getNL (p));
-
-      b = print_singlestack (l, sl, diffspace, pxpos);
-      
-      l->DrawDiffBBox (b.flavor, EDGE_PFET, b.p.llx, b.p.lly,
-		       b.p.urx - b.p.llx, b.p.ury - b.p.lly);
-
-      if (!has_both_types && !Technology::T->well[EDGE_PFET][b.flavor]) {
-	l->DrawDiff (b.flavor, EDGE_NFET, b.p.llx, b.p.lly - diffspace -
-		     (b.p.ury - b.p.lly),
-		     b.p.urx - b.p.llx, b.p.ury - b.p.lly, l->getGND());
-	l->DrawDiffBBox (b.flavor, EDGE_NFET, b.p.llx, b.p.lly - diffspace -
-			 (b.p.ury - b.p.lly),
-			 b.p.urx - b.p.llx, b.p.ury - b.p.lly);
-	has_both_types = 1;
-      }
-
-      BLOB->appendBlob (new LayoutBlob (BLOB_BASE, l), BLOB_HORIZ); 
-    }
-  }
-
-  /* now we need to adjust the boundary of this cell to make sure
-     several alignment restrictions are satisfied.
-     
-     * The y-coordinate for 0 is on a track boundary.
-
-     This means that we have to bloat in the -y and +y direction so
-     that the bounding box is on a track boundary, rather than looking
-     at the total y dimension for bloating.
-    
-     * Any mirroring is legal. This means that we have to have
-       spacing/2 around all the material on all sides.
-  */
-
-  BLOB = computeLEFBoundary (BLOB);
-
-  /* --- add pins --- */
-  netlist_t *n = nl->getNL (p);
-
-  if (!dummy_netlist && n->psc && n->nsc) {
-    dummy_netlist = n;
-  }
-
-  Rectangle b_bbox;
-  b_bbox = BLOB->getBBox ();
+  Rectangle b_bbox;
+  b_bbox = BLOB->getBBox ();
 
   if (n && !b_bbox.empty()) {
     /* we have a netlist + layout */
@@ -1683,10 +1987,274 @@ LayoutBlob *ActStackLayout::_createlocallayout (Process *p)
     BLOB = computeLEFBoundary (BLOB);
   }
 
+  _writeCacheRect (p, BLOB);
+
   return BLOB;
 }
 
 
+/*
+ * Generate the layout for the transistor stacks of a process, in two
+ * steps. _paintstacks draws each stack into its own Layout; it only
+ * reads the stacks, the netlist and the technology, and only writes
+ * to the new Layouts, so _buildParallel runs it in worker threads.
+ * It does not use the ACT list, hash, or name printing helpers, nor
+ * the pass maps. The only ACT helper it may reach is warning(), from
+ * the tile code's internal consistency checks, which writes a single
+ * message with one stdio call. _assemblestacks wraps the Layouts into
+ * a blob and always runs on the main thread, along with the netlist
+ * and _localdiffspace lookups.
+ */
+static void _paintstacks (netlist_t *N, list_t *stks, int diffspace,
+			 std::vector<Layout *> &ls)
+{
+  BBox b;
+
+  b.n.llx = 0;
+  b.n.lly = 0;
+  b.n.urx = 0;
+  b.n.ury = 0;
+  b.p = b.n;
+
+  listitem_t *li;
+
+  li = list_first (stks);
+  list_t *stklist = (list_t *) list_value (li);
+
+  int has_both_types = 0;
+
+  //printf ("Creating local layout: %s\n", p->getName());
+
+  if (list_length (stklist) > 0) {
+    /* dual stacks */
+    listitem_t *si;
+
+    for (si = list_first (stklist); si; si = list_next (si)) {
+      struct gate_pairs *gp;
+      Layout *l = new Layout (N);
+      gp = (struct gate_pairs *) list_value (si);
+      has_both_types = 1;
+
+      /*--- process gp ---*/
+      b = print_dualstack (l, gp, diffspace);
+      
+      l->DrawDiffBBox (b.flavor, EDGE_PFET,
+		       b.p.llx, b.p.lly, b.p.urx-b.p.llx, b.p.ury-b.p.lly);
+      l->DrawDiffBBox (b.flavor, EDGE_NFET,
+		       b.n.llx, b.n.lly, b.n.urx-b.n.llx, b.n.ury-b.n.lly);
+      if (Layout::mergeEnabled ()) {
+	l->mergeTiles ();
+      }
+
+      ls.push_back (l);
+    }
+  }
+
+  li = list_next (li);
+  stklist = (list_t *) list_value (li);
+
+  /* XXX: check singlestack!!! */
+  int nxpos = b.n.urx;
+  int pxpos = b.p.urx;
+
+  if (stklist && (list_length (stklist) > 0)) {
+    /* n stacks */
+    listitem_t *si;
+
+    if (!has_both_types && list_value (list_next (li)) &&
+	(list_length ((list_t*) list_value (list_next (li))) > 0)) {
+      has_both_types = 1;
+    }
+
+    for (si = list_first (stklist); si; si = list_next (si)) {
+      list_t *sl = (list_t *) list_value (si);
+      Layout *l = new Layout (N);
+
+      b = print_singlestack (l, sl, diffspace, nxpos);
+      
+      l->DrawDiffBBox (b.flavor, EDGE_NFET, b.n.llx, b.n.lly,
+		       b.n.urx - b.n.llx, b.n.ury - b.n.lly);
+
+      if (!has_both_types && !Technology::T->well[EDGE_NFET][b.flavor]) {
+	l->DrawDiff (b.flavor, EDGE_PFET, b.n.llx, b.n.lly + diffspace +
+		     (b.n.ury - b.n.lly),
+		     b.n.urx - b.n.llx, b.n.ury - b.n.lly, l->getVdd());
+	l->DrawDiffBBox (b.flavor, EDGE_PFET, b.n.llx, b.n.lly + diffspace +
+			 (b.n.ury - b.n.lly),
+			 b.n.urx - b.n.llx, b.n.ury - b.n.lly);
+	has_both_types = 1;
+      }
+      if (Layout::mergeEnabled ()) {
+	l->mergeTiles ();
+      }
+
+      ls.push_back (l);
+    }
+  }
+
+  li = list_next (li);
+  stklist = (list_t *) list_value (li);
+  if (stklist && (list_length (stklist) > 0)) {
+    /* p stacks */
+    listitem_t *si;
+
+    for (si = list_first (stklist); si; si = list_next (si)) {
+      list_t *sl = (list_t *) list_value (si);
+      Layout *l = new Layout (N);
+
+      b = print_singlestack (l, sl, diffspace, pxpos);
+      
+      l->DrawDiffBBox (b.flavor, EDGE_PFET, b.p.llx, b.p.lly,
+		       b.p.urx - b.p.llx, b.p.ury - b.p.lly);
+
+      if (!has_both_types && !Technology::T->well[EDGE_PFET][b.flavor]) {
+	l->DrawDiff (b.flavor, EDGE_NFET, b.p.llx, b.p.lly - diffspace -
+		     (b.p.ury - b.p.lly),
+		     b.p.urx - b.p.llx, b.p.ury - b.p.lly, l->getGND());
+	l->DrawDiffBBox (b.flavor, EDGE_NFET, b.p.llx, b.p.lly - diffspace -
+			 (b.p.ury - b.p.lly),
+			 b.p.urx - b.p.llx, b.p.ury - b.p.lly);
+	has_both_types = 1;
+      }
+      if (Layout::mergeEnabled ()) {
+	l->mergeTiles ();
+      }
+
+      ls.push_back (l);
+    }
+  }
+}
+
+static LayoutBlob *_assemblestacks (std::vector<Layout *> &ls)
+{
+  LayoutBlob *BLOB = new LayoutBlob (BLOB_LIST);
+  for (Layout *l : ls) {
+    BLOB->appendBlob (new LayoutBlob (BLOB_BASE, l), BLOB_HORIZ);
+  }
+  return BLOB;
+}
+
+LayoutBlob *ActStackLayout::_createstacklayout (Process *p, list_t *stks)
+{
+  std::vector<Layout *> ls;
+  _paintstacks (nl->getNL (p), stks, _localdiffspace (p), ls);
+  return _assemblestacks (ls);
+}
+
+
+/*
+ * The processes visited by the stack pass, in traversal order. This
+ * pass visits the same processes.
+ */
+list_t *ActStackLayout::_visitedProcs ()
+{
+  RawActStackPass *sp = (RawActStackPass *) stk->getPtrParam ("raw");
+  if (!sp) {
+    return NULL;
+  }
+  return sp->getProcs ();
+}
+
+/*
+ * Mode 0 with multiple threads: generate the stack layouts of the
+ * visited processes up front, using "jobs" threads. Processes whose
+ * layout comes from a local .rect file or from the cache are
+ * skipped. The results are used by _createlocallayout, which still
+ * runs in the usual traversal order, so the output is the same as
+ * the serial run.
+ */
+void ActStackLayout::_buildParallel (int jobs)
+{
+  list_t *all = _visitedProcs ();
+  Process **procs;
+  list_t **stks;
+  netlist_t **nls;
+  int *diffspace;
+  std::vector<Layout *> *res;
+  int n;
+
+  if (!all) {
+    return;
+  }
+
+  MALLOC (procs, Process *, list_length (all) + 1);
+  MALLOC (stks, list_t *, list_length (all) + 1);
+  MALLOC (nls, netlist_t *, list_length (all) + 1);
+  MALLOC (diffspace, int, list_length (all) + 1);
+  n = 0;
+  for (listitem_t *li = list_first (all); li; li = list_next (li)) {
+    Process *p = (Process *) list_value (li);
+    list_t *sl;
+    if (p->isBlackBox() || p->isLowLevelBlackBox()) {
+      continue;
+    }
+    sl = (list_t *) stk->getMap (p);
+    if (!sl || _empty_stacks (sl)) {
+      continue;
+    }
+    if (_rect_import != 0) {
+      char *fname = _localRectFile (p);
+      int found = (access (fname, R_OK) == 0);
+      FREE (fname);
+      if (found) {
+	/* will be read from the .rect file */
+	continue;
+      }
+    }
+    struct layout_cache_ent *ent = _cacheEntry (p);
+    if (ent) {
+      char fname[10240];
+      snprintf (fname, 10240, "%s%s", ent->name, _rectSuffix ());
+      if (access (fname, R_OK) == 0) {
+	/* will be read from the cache */
+	continue;
+      }
+    }
+    procs[n] = p;
+    stks[n] = sl;
+    nls[n] = nl->getNL (p);
+    diffspace[n] = _localdiffspace (p);
+    n++;
+  }
+  res = new std::vector<Layout *>[n + 1];
+
+  /* lazily computed values must be set before the threads start */
+  Layout::Init ();
+  init_min_length ();
+
+  std::atomic<int> next (0);
+  auto work = [&] () {
+    int i;
+    while ((i = next++) < n) {
+      _paintstacks (nls[i], stks[i], diffspace[i], res[i]);
+    }
+  };
+
+  if (jobs > n) {
+    jobs = n;
+  }
+  std::vector<std::thread> threads;
+  for (int i=1; i < jobs; i++) {
+    threads.emplace_back (work);
+  }
+  work ();
+  for (auto &t : threads) {
+    t.join ();
+  }
+
+  _prebuilt = phash_new (8);
+  for (int i=0; i < n; i++) {
+    phash_bucket_t *b = phash_add (_prebuilt, procs[i]);
+    b->v = _assemblestacks (res[i]);
+  }
+  FREE (procs);
+  FREE (stks);
+  FREE (nls);
+  FREE (diffspace);
+  delete [] res;
+}
+
+
 LayoutBlob *ActStackLayout::_readwelltap (int flavor)
 {
   char cname[128];
@@ -1696,7 +2264,8 @@ LayoutBlob *ActStackLayout::_readwelltap (int flavor)
     return NULL;
   }
 
-  snprintf (cname, 128, "welltap_%s.rect", act_dev_value_to_string (flavor));
+  snprintf (cname, 128, "welltap_%s%s", act_dev_value_to_string (flavor),
+	    _rectSuffix ());
 
   if (_rect_inpath) {
     tmpname = path_open (_rect_inpath, cname, NULL);
@@ -1938,9 +2507,9 @@ void ActStackLayout::_emitwelltaprect (int flavor)
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
       
   /* emit rectangles */
-  strcat (name, ".rect");
+  strcat (name, _rectSuffix ());
 
-  FILE *tfp;
+  FILE *fp;
 
   const char *outdir;
   if (b->getRead()) {
@@ -1955,32 +2524,36 @@ void ActStackLayout::_emitwelltaprect (int flavor)
     int sz = strlen (name) + strlen (outdir) + 2;
     MALLOC (outname, char, sz);
     snprintf (outname, sz, "%s/%s", outdir, name);
-    tfp = fopen (outname, "w");
-    if (!tfp) {
+    fp = fopen (outname, "w");
+    if (!fp) {
       fatal_error ("Could not open file `%s' for writing", outname);
     }
     FREE (outname);
   }
   else {
-    tfp = fopen (name, "w");
-    if (!tfp) {
+    fp = fopen (name, "w");
+    if (!fp) {
       fatal_error ("Could not open file `%s' for writing", name);
     }
   }
-  b->PrintRect (tfp, &mat);
+  {
+    RectWriter w (fp, RectReader::isBinary (name));
+    b->PrintRect (&w, &mat);
 
-  if (_rect_wells) {
-    for (int j=0; j < 2; j++) {
-      long wllx, wlly, wurx, wury;
-      _computeWell (b, flavor, j, &wllx, &wlly, &wurx, &wury, 1);
-      if (wllx < wurx && wlly < wury) {
-	fprintf (tfp, "rect # %s %ld %ld %ld %ld\n",
-		 Technology::T->well[j][flavor]->getName(),
-		 wllx, wlly, wurx, wury);
+    if (_rect_wells) {
+      for (int j=0; j < 2; j++) {
+	long wllx, wlly, wurx, wury;
+	_computeWell (b, flavor, j, &wllx, &wlly, &wurx, &wury, 1);
+	if (wllx < wurx && wlly < wury) {
+	  w.rect (RECT_REC_RECT, NULL,
+		  Technology::T->well[j][flavor]->getName(),
+		  wllx, wlly, wurx, wury);
+	}
       }
     }
+    w.finish ();
   }
-  fclose (tfp);
+  fclose (fp);
 }
 
 void layout_run (ActPass *_ap, Process *p)
@@ -1995,6 +2568,20 @@ void layout_run (ActPass *_ap, Process *p)
 
 void ActStackLayout::run_post (Process *top)
 {
+  if (_prebuilt) {
+    /* stack layouts that were not used by the traversal */
+    phash_iter_t it;
+    phash_bucket_t *b;
+    phash_iter_init (_prebuilt, &it);
+    while ((b = phash_iter_next (_prebuilt, &it))) {
+      if (b->v) {
+	delete ((LayoutBlob *)b->v);
+      }
+    }
+    phash_free (_prebuilt);
+    _prebuilt = NULL;
+  }
+  
   if (!dummy_netlist) {
     dummy_netlist = nl->getNL (top);
   }
@@ -2052,7 +2639,7 @@ void ActStackLayout::_emitlocalRect (Process *p)
     snprintf (cname, 10240, "toplevel");
   }
   int len = strlen (cname);
-  snprintf (cname + len, 10240-len, ".rect");
+  snprintf (cname + len, 10240-len, "%s", _rectSuffix ());
 
 
   const char *outdir;
@@ -2080,35 +2667,37 @@ void ActStackLayout::_emitlocalRect (Process *p)
       fatal_error ("Could not open file `%s' for writing", cname);
     }
   }
-  blob->PrintRect (fp, &mat);
-
-  if (_rect_wells) {
-
-    for (int i=0; i < Technology::T->num_devs; i++) {
-      for (int j=0; j < 2; j++) {
-	long wllx, wlly, wurx, wury;
-	_computeWell (blob, i, j, &wllx, &wlly, &wurx, &wury);
-	if (wllx < wurx && wlly < wury) {
-	  fprintf (fp, "rect # %s %ld %ld %ld %ld\n",
-		   Technology::T->well[j][i]->getName(),
-		   wllx, wlly, wurx, wury);
+  {
+    RectWriter w (fp, RectReader::isBinary (cname));
+    blob->PrintRect (&w, &mat);
+
+    if (_rect_wells) {
+
+      for (int i=0; i < Technology::T->num_devs; i++) {
+	for (int j=0; j < 2; j++) {
+	  long wllx, wlly, wurx, wury;
+	  _computeWell (blob, i, j, &wllx, &wlly, &wurx, &wury);
+	  if (wllx < wurx && wlly < wury) {
+	    w.rect (RECT_REC_RECT, NULL, Technology::T->well[j][i]->getName(),
+		    wllx, wlly, wurx, wury);
+	  }
 	}
       }
     }
+    w.finish ();
   }
-  
   fclose (fp);
 }
 
-static void emit_header (FILE *fp, const char *name, const char *lefclass,
+static void emit_header (BufWriter *w, const char *name, const char *lefclass,
 			 LayoutBlob *blob)
 {
   double scale = Technology::T->scale/1000.0;
   
-  fprintf (fp, "MACRO %s\n", name);
-  fprintf (fp, "    CLASS %s ;\n", lefclass);
-  fprintf (fp, "    FOREIGN %s %.6f %.6f ;\n", name, 0.0, 0.0);
-  fprintf (fp, "    ORIGIN %.6f %.6f ;\n", 0.0, 0.0);
+  w->printf ("MACRO %s\n", name);
+  w->printf ("    CLASS %s ;\n", lefclass);
+  w->printf ("    FOREIGN %s %.6f %.6f ;\n", name, 0.0, 0.0);
+  w->printf ("    ORIGIN %.6f %.6f ;\n", 0.0, 0.0);
 
   Rectangle bloatbox;
   bloatbox = blob->getBloatBBox ();
@@ -2117,19 +2706,33 @@ static void emit_header (FILE *fp, const char *name, const char *lefclass,
   printf ("SIZE: %ld x %ld\n", burx - bllx + 1, bury - blly + 1);
 #endif
   
-  fprintf (fp, "    SIZE %.6f BY %.6f ;\n",
-	   bloatbox.wx()*scale, bloatbox.wy()*scale);
-  fprintf (fp, "    SYMMETRY X Y ;\n");
-  fprintf (fp, "    SITE CoreSite ;\n");
+  w->printf ("    SIZE %.6f BY %.6f ;\n",
+	     bloatbox.wx()*scale, bloatbox.wy()*scale);
+  w->put ("    SYMMETRY X Y ;\n");
+  w->put ("    SITE CoreSite ;\n");
 }
 
 
-static void emit_footer (FILE *fp, const char *name)
+static void emit_footer (BufWriter *w, const char *name)
 {
-  fprintf (fp, "END %s\n\n", name);
+  w->printf ("END %s\n\n", name);
+}
+
+static void emit_one_rect (BufWriter *w, double scale,
+			   long llx, long lly, long urx, long ury)
+{
+  w->put ("        RECT ");
+  w->putfixed (scale*llx);
+  w->put (' ');
+  w->putfixed (scale*lly);
+  w->put (' ');
+  w->putfixed (scale*(1+urx));
+  w->put (' ');
+  w->putfixed (scale*(1+ury));
+  w->put (" ;\n");
 }
 
-static int emit_layer_rects (FILE *fp, list_t *tiles, node_t **io = NULL,
+static int emit_layer_rects (BufWriter *w, list_t *tiles, node_t **io = NULL,
 			      int num_io = 0)
 {
   double scale = Technology::T->scale/1000.0;
@@ -2172,15 +2775,17 @@ static int emit_layer_rects (FILE *fp, list_t *tiles, node_t **io = NULL,
 
 	if (first) {
 	  if (!emit_obs && io != NULL) {
-	    fprintf (fp, "    OBS\n");
+	    w->put ("    OBS\n");
 	    emit_obs = 1;
 	  }
+	  w->put ("        LAYER ");
 	  if (lname == lprev) {
-	    fprintf (fp, "        LAYER %s ;\n", lname->getViaName());
+	    w->put (lname->getViaName());
 	  }
 	  else {
-	    fprintf (fp, "        LAYER %s ;\n", lname->getRouteName());
+	    w->put (lname->getRouteName());
 	  }
+	  w->put (" ;\n");
 	}
 	first = 0;
 	
@@ -2199,8 +2804,7 @@ static int emit_layer_rects (FILE *fp, list_t *tiles, node_t **io = NULL,
 	  tury = x;
 	}
 	
-	fprintf (fp, "        RECT %.6f %.6f %.6f %.6f ;\n",
-		 scale*tllx, scale*tlly, scale*(1+turx), scale*(1+tury));
+	emit_one_rect (w, scale, tllx, tlly, turx, tury);
       }
       lprev = lname;
     }
@@ -2208,68 +2812,67 @@ static int emit_layer_rects (FILE *fp, list_t *tiles, node_t **io = NULL,
   return emit_obs;
 }
 
-static void emit_antenna_area (FILE *fp, list_t *tiles)
+/*
+ * Same as emit_layer_rects with no I/O pins, using the search index
+ */
+static void emit_layer_rects (BufWriter *w, const struct blob_rects *R)
 {
   double scale = Technology::T->scale/1000.0;
-  listitem_t *tli;
-  double ant_area = 0.0;
-  double ant_diffarea = 0.0;
-
-  for (tli = list_first (tiles); tli; tli = list_next (tli)) {
-    struct tile_listentry *tle = (struct tile_listentry *) list_value (tli);
-    listitem_t *xi;
+  Layer *lprev = NULL;
+  int blk = -1;
+  int i, j;
 
-    for (xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
-      Layer *lname = (Layer *) list_value (xi);
-      xi = list_next (xi);
-      Assert (xi, "Hmm");
-
-      if (lname->isMetal()) {
-	continue;
-      }
-
-      list_t *actual_tiles = (list_t *) list_value (xi);
-      listitem_t *ti;
-      int first = 1;
-      
-      for (ti = list_first (actual_tiles); ti; ti = list_next (ti)) {
-	long tllx, tlly, turx, tury;
-	Tile *tmp = (Tile *) list_value (ti);
-
-	tle->m.apply (tmp->getllx(), tmp->getlly(), &tllx, &tlly);
-	tle->m.apply (tmp->geturx(), tmp->getury(), &turx, &tury);
-	
-	if (tllx > turx) {
-	  long x = tllx;
-	  tllx = turx;
-	  turx = x;
-	}
+  for (i=0; i < A_LEN (R->r); i = j) {
+    const struct blob_rect *r = &R->r[i];
 
-	if (tlly > tury) {
-	  long x = tlly;
-	  tlly = tury;
-	  tury = x;
-	}
-	
-	if (tmp->isFet()) {
-	  ant_area += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
-	}
-	else if (tmp->isDiff()) {
-	  ant_diffarea += (turx-tllx+1)*scale*(tury-tlly+1)*scale;
-	}
+    /* group of rectangles from one layout and plane */
+    for (j=i+1; j < A_LEN (R->r); j++) {
+      if (R->r[j].blk != r->blk || R->r[j].l != r->l ||
+	  R->r[j].via != r->via) {
+	break;
       }
     }
+    if (r->blk != blk) {
+      lprev = NULL;
+      blk = r->blk;
+    }
+    if (!r->l->isMetal()) {
+      continue;
+    }
+    w->put ("        LAYER ");
+    if (r->l == lprev) {
+      w->put (r->l->getViaName());
+    }
+    else {
+      w->put (r->l->getRouteName());
+    }
+    w->put (" ;\n");
+    for (int k=i; k < j; k++) {
+      emit_one_rect (w, scale, R->r[k].llx, R->r[k].lly,
+		     R->r[k].urx, R->r[k].ury);
+    }
+    lprev = r->l;
   }
-  if (ant_area > 0) {
-    fprintf (fp, "        ANTENNAGATEAREA %.6f ;\n", ant_area);
+}
+
+/* the antenna areas are accumulated when the search index is built */
+static void emit_antenna_area (BufWriter *w, const struct blob_rects *R)
+{
+  if (R->gate_area > 0) {
+    w->put ("        ANTENNAGATEAREA ");
+    w->putfixed (R->gate_area);
+    w->put (" ;\n");
   }
-  if (ant_diffarea > 0) {
-    fprintf (fp, "        ANTENNADIFFAREA %.6f ;\n", ant_diffarea);
+  if (R->diff_area > 0) {
+    w->put ("        ANTENNADIFFAREA ");
+    w->putfixed (R->diff_area);
+    w->put (" ;\n");
   }
 }  
 
 
-static void emit_one_pin (Act *a, FILE *fp, const char *name, int isinput,
+/* name is already mangled */
+static void emit_one_pin (BufWriter *w, const char *name, int isinput,
 			  const char *sigtype, LayoutBlob *blob,
 			  node_t *signode)
 {
@@ -2277,32 +2880,31 @@ static void emit_one_pin (Act *a, FILE *fp, const char *name, int isinput,
 
   Rectangle bloatbox = blob->getBloatBBox ();
   
-  fprintf (fp, "    PIN ");
-  a->mfprintf (fp, "%s\n", name);
+  w->put ("    PIN ");
+  w->put (name);
+  w->put ('\n');
   
   //printf ("pin %s [node 0x%lx]\n", name, (unsigned long)signode);
 
-  fprintf (fp, "        DIRECTION %s ;\n", isinput ? "INPUT" : "OUTPUT");
-  fprintf (fp, "        USE %s ;\n", sigtype);
+  w->printf ("        DIRECTION %s ;\n", isinput ? "INPUT" : "OUTPUT");
+  w->printf ("        USE %s ;\n", sigtype);
 
-  fprintf (fp, "        PORT\n");
+  w->put ("        PORT\n");
 
   /* -- find all pins of this name! -- */
   TransformMat mat;
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
-  list_t *tiles = blob->search (signode, &mat);
-  emit_layer_rects (fp, tiles);
+  const struct blob_rects *rects = blob->searchIndex (signode, &mat);
+  emit_layer_rects (w, rects);
 
-  fprintf (fp, "        END\n");
+  w->put ("        END\n");
 
   // now we emit just the fet area for antennas
-  emit_antenna_area (fp, tiles);
-
-  LayoutBlob::searchFree (tiles);
+  emit_antenna_area (w, rects);
 
-  fprintf (fp, "    END ");
-  a->mfprintf (fp, "%s", name);
-  fprintf (fp, "\n");
+  w->put ("    END ");
+  w->put (name);
+  w->put ('\n');
 }
 
 
@@ -2363,20 +2965,25 @@ void ActStackLayout::runrec (int mode, UserDef *u)
     for (int i=0; i < config_get_table_size ("act.dev_flavors"); i++) {
       if (wellplugs[i]) {
 	LayoutBlob *b = wellplugs[i];
-	char name[1024], nodename[1024];
+	char name[1024], nodename[1024], tmp[1024];
 
 	snprintf (name, 1024, "welltap_%s", act_dev_value_to_string (i));
-	emit_header (_fp, name, "CORE WELLTAP", b);
-
-	ActNetlistPass::sprint_node (nodename, 1024, dummy_netlist,
-				   dummy_netlist->nsc);
-	emit_one_pin (a, _fp, nodename, 1, "POWER", b, dummy_netlist->nsc);
-
-	ActNetlistPass::sprint_node (nodename, 1024, dummy_netlist,
-				     dummy_netlist->psc);
-	emit_one_pin (a, _fp, nodename, 1, "GROUND", b, dummy_netlist->psc);
+	{
+	  BufWriter out (_fp);
+	  emit_header (&out, name, "CORE WELLTAP", b);
+
+	  ActNetlistPass::sprint_node (tmp, 1024, dummy_netlist,
+				       dummy_netlist->nsc);
+	  a->msnprintf (nodename, 1024, "%s", tmp);
+	  emit_one_pin (&out, nodename, 1, "POWER", b, dummy_netlist->nsc);
+
+	  ActNetlistPass::sprint_node (tmp, 1024, dummy_netlist,
+				       dummy_netlist->psc);
+	  a->msnprintf (nodename, 1024, "%s", tmp);
+	  emit_one_pin (&out, nodename, 1, "GROUND", b, dummy_netlist->psc);
 	
-	emit_footer (_fp, name);
+	  emit_footer (&out, name);
+	}
 
 	TransformMat mat;
 	Rectangle bloatbox;
@@ -2414,6 +3021,7 @@ void ActStackLayout::runrec (int mode, UserDef *u)
     /* done with LEF */
     _lef_header = 0;
     _cell_header = 0;
+    _freeParallelLEF ();
   }
   else if (mode == 2) {
     /* nothing */
@@ -2697,60 +3305,312 @@ void layout_recursive (ActPass *_ap, UserDef *u, int mode)
  */
 int ActStackLayout::_emitlocalLEF (Process *p)
 {
-  char macroname[10240];
-  FILE *fp = _fp;
-  FILE *fpcell = _fpcell;
-  A_DECL (node_t *, iopins);
-  
-  /* emit self */
-  netlist_t *n;
+  struct layout_cache_ent *ent = NULL;
+  char fname[10240];
+  char buf[10240];
+  FILE *cfp, *tfp;
+  long sz;
+  int ret;
 
-  LayoutBlob *blob = getLayout (p);
-  if (!blob) {
-    return 0;
+  if (_cache && p) {
+    phash_bucket_t *b = phash_lookup (_cache, p);
+    if (b) {
+      ent = (struct layout_cache_ent *) b->v;
+    }
+  }
+  if (!ent || !ent->used) {
+    return _emitlocalLEF (p, _fp);
   }
 
-  if (blob->isMacro()) {
-    /* insert LEF */
-    FILE *bfp;
+  snprintf (fname, 10240, "%s.lef", ent->name);
+  cfp = fopen (fname, "r");
+  if (cfp) {
+    while ((sz = fread (buf, 1, 10240, cfp)) > 0) {
+      fwrite (buf, 1, sz, _fp);
+    }
+    fclose (cfp);
+    if (_fpcell) {
+      _emitLocalWellLEF (_fpcell, p);
+    }
+    return 1;
+  }
 
-    if (!blob->getLEFFile()) {
-      warning ("Macro %s is missing LEF\n", blob->getMacroName());
-      return 0;
+  /* generate the LEF, and save it in the cache */
+  tfp = tmpfile ();
+  if (!tfp) {
+    return _emitlocalLEF (p, _fp);
+  }
+  ret = _emitlocalLEF (p, tfp);
+
+  char tmpname[10240];
+  snprintf (tmpname, 10240, "%s.%d", fname, (int) getpid ());
+  cfp = NULL;
+  if (ret && ftell (tfp) > 0) {
+    cfp = fopen (tmpname, "w");
+  }
+  rewind (tfp);
+  while ((sz = fread (buf, 1, 10240, tfp)) > 0) {
+    fwrite (buf, 1, sz, _fp);
+    if (cfp) {
+      fwrite (buf, 1, sz, cfp);
+    }
+  }
+  fclose (tfp);
+  if (cfp) {
+    fclose (cfp);
+    if (rename (tmpname, fname) != 0) {
+      unlink (tmpname);
+    }
+  }
+  return ret;
+}
+
+/*
+ * The LEF macro of a process is written in two steps. _lefMacro
+ * looks up everything that needs the ACT name printing helpers, the
+ * netlist hash tables, the configuration, or ACT lists: the mangled
+ * macro and pin names, the pin nodes, and the non-pin metal of
+ * layouts read from .rect files. _emitLEFMacro then writes the macro
+ * and its well LEF from that and the layout of the cell. The search
+ * index it builds belongs to the top-level blob of the cell, so
+ * _buildParallelLEF runs it for different cells in worker threads;
+ * _lefMacro and _freeLEFMacro always run on the main thread.
+ */
+struct lef_pin {
+  char *name;			// mangled pin name
+  int input;
+  const char *sigtype;
+  node_t *n;
+};
+
+struct lef_macro {
+  LayoutBlob *blob;
+  char *name;			// mangled macro name
+  A_DECL (struct lef_pin, pins);
+  list_t *metal;		// non-pin metal, if the layout was read
+};
+
+static void _lef_addpin (Act *a, struct lef_macro *m, const char *name,
+			 int input, const char *sigtype, node_t *n)
+{
+  char buf[10240];
+
+  a->msnprintf (buf, 10240, "%s", name);
+  A_NEW (m->pins, struct lef_pin);
+  A_NEXT (m->pins).name = Strdup (buf);
+  A_NEXT (m->pins).input = input;
+  A_NEXT (m->pins).sigtype = sigtype;
+  A_NEXT (m->pins).n = n;
+  A_INC (m->pins);
+}
+
+static void _freeLEFMacro (struct lef_macro *m)
+{
+  for (int i=0; i < A_LEN (m->pins); i++) {
+    FREE (m->pins[i].name);
+  }
+  A_FREE (m->pins);
+  if (m->metal) {
+    LayoutBlob::searchFree (m->metal);
+  }
+  FREE (m->name);
+  FREE (m);
+}
+
+/*
+ * LEF text for one process, generated ahead of time by
+ * _buildParallelLEF
+ */
+struct lef_buf {
+  char *lef;			// LEF macro
+  size_t lef_sz;
+  char *cell;			// well LEF, if any
+  size_t cell_sz;
+  int ret;			// return value of _emitlocalLEF
+};
+
+/*
+ * Mode 1 with multiple threads: generate the LEF of the visited
+ * processes into memory buffers up front, using "jobs" threads. The
+ * names and pins are looked up by _lefMacro on the main thread; the
+ * workers only run _emitLEFMacro (see struct lef_macro). The buffers
+ * are copied to the output by _emitlocalLEF in the usual traversal
+ * order, so the output is the same as the serial run.
+ */
+void ActStackLayout::_buildParallelLEF (int jobs)
+{
+  list_t *all = _visitedProcs ();
+  Process **procs;
+  struct lef_macro **ms;
+  struct lef_buf **res;
+  int n, ret;
+
+  if (!all) {
+    return;
+  }
+
+  MALLOC (procs, Process *, list_length (all) + 1);
+  MALLOC (ms, struct lef_macro *, list_length (all) + 1);
+  n = 0;
+  for (listitem_t *li = list_first (all); li; li = list_next (li)) {
+    Process *p = (Process *) list_value (li);
+    LayoutBlob *b = getLayout (p);
+    if (!b || b->isMacro()) {
+      continue;
+    }
+    if (_cache) {
+      phash_bucket_t *cb = phash_lookup (_cache, p);
+      if (cb && ((struct layout_cache_ent *)cb->v)->used) {
+	char fname[10240];
+	snprintf (fname, 10240, "%s.lef",
+		  ((struct layout_cache_ent *)cb->v)->name);
+	if (access (fname, R_OK) == 0) {
+	  /* will be read from the cache */
+	  continue;
+	}
+      }
     }
+    ms[n] = _lefMacro (p, &ret);
+    if (!ms[n]) {
+      /* nothing to emit */
+      continue;
+    }
+    procs[n++] = p;
+  }
+  MALLOC (res, struct lef_buf *, n + 1);
+
+  std::atomic<int> next (0);
+  auto work = [&] () {
+    int i;
+    while ((i = next++) < n) {
+      struct lef_buf *lb;
+      FILE *lfp, *cfp;
+
+      res[i] = NULL;
+      NEW (lb, struct lef_buf);
+      lb->lef = NULL;
+      lb->lef_sz = 0;
+      lb->cell = NULL;
+      lb->cell_sz = 0;
+      lfp = open_memstream (&lb->lef, &lb->lef_sz);
+      cfp = NULL;
+      if (lfp && _fpcell) {
+	cfp = open_memstream (&lb->cell, &lb->cell_sz);
+      }
+      if (!lfp || (_fpcell && !cfp)) {
+	/* emit this one serially */
+	if (lfp) {
+	  fclose (lfp);
+	}
+	if (lb->lef) {
+	  free (lb->lef);
+	}
+	FREE (lb);
+	continue;
+      }
+      _emitLEFMacro (ms[i], lfp, cfp);
+      lb->ret = 1;
+      fclose (lfp);
+      if (cfp) {
+	fclose (cfp);
+      }
+      res[i] = lb;
+    }
+  };
+
+  if (jobs > n) {
+    jobs = n;
+  }
+  std::vector<std::thread> threads;
+  for (int i=1; i < jobs; i++) {
+    threads.emplace_back (work);
+  }
+  work ();
+  for (auto &t : threads) {
+    t.join ();
+  }
+
+  _prelef = phash_new (8);
+  for (int i=0; i < n; i++) {
+    if (res[i]) {
+      phash_bucket_t *b = phash_add (_prelef, procs[i]);
+      b->v = res[i];
+    }
+    _freeLEFMacro (ms[i]);
+  }
+  FREE (procs);
+  FREE (ms);
+  FREE (res);
+}
+
+void ActStackLayout::_freeParallelLEF ()
+{
+  phash_iter_t it;
+  phash_bucket_t *b;
 
-    bfp = fopen (blob->getLEFFile(), "r");
-    if (!bfp) {
-      fprintf (stderr, "Macro %s: LEF %s could not be opened\n",
-	       blob->getMacroName(), blob->getLEFFile());
-      return 0;
+  if (!_prelef) {
+    return;
+  }
+  phash_iter_init (_prelef, &it);
+  while ((b = phash_iter_next (_prelef, &it))) {
+    struct lef_buf *lb = (struct lef_buf *) b->v;
+    if (lb) {
+      free (lb->lef);
+      free (lb->cell);
+      FREE (lb);
     }
+  }
+  phash_free (_prelef);
+  _prelef = NULL;
+}
 
-    char buf[10240];
-    
-    while (!feof (bfp)) {
-      long sz;
-      sz = fread (buf, 1, 10240, bfp);
-      if (sz > 0) {
-	fwrite (buf, 1, sz, fp);
+int ActStackLayout::_emitlocalLEF (Process *p, FILE *fp)
+{
+  if (_prelef) {
+    phash_bucket_t *b = phash_lookup (_prelef, p);
+    if (b && b->v) {
+      struct lef_buf *lb = (struct lef_buf *) b->v;
+      int ret = lb->ret;
+      fwrite (lb->lef, 1, lb->lef_sz, fp);
+      if (_fpcell) {
+	fwrite (lb->cell, 1, lb->cell_sz, _fpcell);
       }
+      free (lb->lef);
+      free (lb->cell);
+      FREE (lb);
+      b->v = NULL;
+      return ret;
     }
-    fprintf (fp, "\n");
-    fclose (bfp);
-    return 1;
+  }
+  return _emitlocalLEF (p, fp, _fpcell);
+}
+
+/*
+ * Returns NULL if there is no macro to emit for p; *ret is the return
+ * value of _emitlocalLEF.
+ */
+struct lef_macro *ActStackLayout::_lefMacro (Process *p, int *ret)
+{
+  char buf[10240];
+  struct lef_macro *m;
+  netlist_t *n;
+
+  *ret = 0;
+
+  LayoutBlob *blob = getLayout (p);
+  if (!blob || blob->isMacro()) {
+    return NULL;
   }
 
   n = nl->getNL (p);
   if (!n) {
-    return 0;
+    return NULL;
   }
 
-  Rectangle bloatbox;
-  bloatbox = blob->getBloatBBox ();
-
-  if (bloatbox.empty()) {
+  if (blob->getBloatBBox ().empty()) {
     /* no layout */
-    return 1;
+    *ret = 1;
+    return NULL;
   }
 
   /* if this has weak gates only, skip it... 
@@ -2771,17 +3631,17 @@ int ActStackLayout::_emitlocalLEF (Process *p)
       }
     }
     if (!nd) {
-      return 0;
+      return NULL;
     }
   }
 
-  A_INIT (iopins);
+  NEW (m, struct lef_macro);
+  m->blob = blob;
+  a->msnprintfproc (buf, 10240, p);
+  m->name = Strdup (buf);
+  A_INIT (m->pins);
+  m->metal = NULL;
 
-  double scale = Technology::T->scale/1000.0;
-  
-  a->msnprintfproc (macroname, 10240, p);
-  emit_header (fp, macroname, "CORE", blob);
-  
   /* find pins */
   int found_vdd = 0;
   int found_gnd = 0;
@@ -2813,10 +3673,7 @@ int ActStackLayout::_emitlocalLEF (Process *p)
       sigtype = "GROUND";
       found_gnd = 1;
     }
-    emit_one_pin (a, fp, tmp, n->bN->ports[i].input, sigtype, blob, av->n);
-    A_NEW (iopins, node_t *);
-    A_NEXT (iopins) = av->n;
-    A_INC (iopins);
+    _lef_addpin (a, m, tmp, n->bN->ports[i].input, sigtype, av->n);
   }
 
   /* add globals as input pins */
@@ -2846,10 +3703,7 @@ int ActStackLayout::_emitlocalLEF (Process *p)
       found_gnd = 1;
       sigtype = "GROUND";
     }
-    emit_one_pin (a, fp, tmp, 1 /* input */, sigtype, blob, av->n);
-    A_NEW (iopins, node_t *);
-    A_NEXT (iopins) = av->n;
-    A_INC (iopins);
+    _lef_addpin (a, m, tmp, 1 /* input */, sigtype, av->n);
   }
 
   /* check Vdd/GND */
@@ -2858,68 +3712,132 @@ int ActStackLayout::_emitlocalLEF (Process *p)
   if (!found_vdd && n->Vdd) {
     found_vdd = 1;
     if (n->Vdd->e && list_length (n->Vdd->e) > 0) {
-      emit_one_pin (a, fp, config_get_string ("net.global_vdd"),
-		    1, "POWER", blob, n->Vdd);
-
-    A_NEW (iopins, node_t *);
-    A_NEXT (iopins) = n->Vdd;
-    A_INC (iopins);
+      _lef_addpin (a, m, config_get_string ("net.global_vdd"),
+		   1, "POWER", n->Vdd);
     }
   }
 
   if (!found_gnd && n->GND) {
     found_gnd = 1;
     if (n->GND->e && list_length (n->GND->e) > 0) {
-      emit_one_pin (a, fp, config_get_string ("net.global_gnd"),
-		    1, "GROUND", blob, n->GND);
-
-      A_NEW (iopins, node_t *);
-      A_NEXT (iopins) = n->GND;
-      A_INC (iopins);
+      _lef_addpin (a, m, config_get_string ("net.global_gnd"),
+		   1, "GROUND", n->GND);
     }
   }
 
   /* read non-pin metal */
-
   if (blob->getRead ()) {
-    list_t *l;
-    Rectangle bloatbox = blob->getBloatBBox ();
     TransformMat mat;
-    mat.translate (-bloatbox.llx(), -bloatbox.lly());
-    l = blob->searchAllMetal (&mat);
-    if (emit_layer_rects (fp, l, iopins, A_LEN (iopins))) {
-      fprintf (fp, "    END\n");
+    mat.translate (-blob->getBloatBBox().llx(), -blob->getBloatBBox().lly());
+    m->metal = blob->searchAllMetal (&mat);
+  }
+
+  *ret = 1;
+  return m;
+}
+
+void ActStackLayout::_emitLEFMacro (struct lef_macro *m, FILE *fp,
+				    FILE *fpcell)
+{
+  LayoutBlob *blob = m->blob;
+  node_t **iopins;
+  double scale = Technology::T->scale/1000.0;
+
+  Rectangle bloatbox;
+  bloatbox = blob->getBloatBBox ();
+
+  MALLOC (iopins, node_t *, A_LEN (m->pins) + 1);
+
+  {
+    BufWriter out (fp);
+    emit_header (&out, m->name, "CORE", blob);
+
+    for (int i=0; i < A_LEN (m->pins); i++) {
+      emit_one_pin (&out, m->pins[i].name, m->pins[i].input,
+		    m->pins[i].sigtype, blob, m->pins[i].n);
+      iopins[i] = m->pins[i].n;
+    }
+
+    if (m->metal) {
+      if (emit_layer_rects (&out, m->metal, iopins, A_LEN (m->pins))) {
+	out.put ("    END\n");
+      }
+    }
+    else {
+      /* XXX: add obstructions for metal layers; in reality we need to
+	 add the routed metal and then grab that here */
+      RoutingMat *m1 = Technology::T->metal[0];
+      int pinspc = MAX (m1->getPitch(), _pin_metal->getPitch());
+      Rectangle rbloatbox = blob->getBloatBBox ();
+      if ((rbloatbox.wy() > 6*pinspc) &&
+	  (rbloatbox.wx() > 2*_pin_metal->getPitch())) {
+	out.put ("    OBS\n");
+	out.printf ("      LAYER %s ;\n", m1->getLEFName());
+	out.printf ("         RECT %.6f %.6f %.6f %.6f ;\n",
+		 scale*((rbloatbox.llx() - bloatbox.llx()) + _pin_metal->getPitch()),
+		 scale*((rbloatbox.lly() - bloatbox.lly()) + 3*pinspc),
+		 scale*((rbloatbox.urx() - bloatbox.llx()) - _pin_metal->getPitch()),
+		 scale*((rbloatbox.ury() - bloatbox.lly()) - 3*pinspc));
+	out.put ("    END\n");
+      }
     }
-    LayoutBlob::searchFree (l);
+
+    emit_footer (&out, m->name);
   }
-  else {
-    /* XXX: add obstructions for metal layers; in reality we need to
-       add the routed metal and then grab that here */
-    RoutingMat *m1 = Technology::T->metal[0];
-    int pinspc = MAX (m1->getPitch(), _pin_metal->getPitch());
-    Rectangle rbloatbox = blob->getBloatBBox ();
-    if ((rbloatbox.wy() > 6*pinspc) &&
-	(rbloatbox.wx() > 2*_pin_metal->getPitch())) {
-      fprintf (fp, "    OBS\n");
-      fprintf (fp, "      LAYER %s ;\n", m1->getLEFName());
-      fprintf (fp, "         RECT %.6f %.6f %.6f %.6f ;\n",
-	       scale*((rbloatbox.llx() - bloatbox.llx()) + _pin_metal->getPitch()),
-	       scale*((rbloatbox.lly() - bloatbox.lly()) + 3*pinspc),
-	       scale*((rbloatbox.urx() - bloatbox.llx()) - _pin_metal->getPitch()),
-	       scale*((rbloatbox.ury() - bloatbox.lly()) - 3*pinspc));
-      fprintf (fp, "    END\n");
-    }
-  }
-
-  emit_footer (fp, macroname);
+
+  FREE (iopins);
 
   if (fpcell) {
-    _emitLocalWellLEF (fpcell, p);
+    _emitWellLEF (fpcell, blob, m->name);
   }
+}
 
-  A_FREE (iopins);
-  
-  return 1;
+int ActStackLayout::_emitlocalLEF (Process *p, FILE *fp, FILE *fpcell)
+{
+  struct lef_macro *m;
+  int ret;
+
+  LayoutBlob *blob = getLayout (p);
+  if (!blob) {
+    return 0;
+  }
+
+  if (blob->isMacro()) {
+    /* insert LEF */
+    FILE *bfp;
+
+    if (!blob->getLEFFile()) {
+      warning ("Macro %s is missing LEF\n", blob->getMacroName());
+      return 0;
+    }
+
+    bfp = fopen (blob->getLEFFile(), "r");
+    if (!bfp) {
+      fprintf (stderr, "Macro %s: LEF %s could not be opened\n",
+	       blob->getMacroName(), blob->getLEFFile());
+      return 0;
+    }
+
+    char buf[10240];
+    
+    while (!feof (bfp)) {
+      long sz;
+      sz = fread (buf, 1, 10240, bfp);
+      if (sz > 0) {
+	fwrite (buf, 1, sz, fp);
+      }
+    }
+    fprintf (fp, "\n");
+    fclose (bfp);
+    return 1;
+  }
+
+  m = _lefMacro (p, &ret);
+  if (m) {
+    _emitLEFMacro (m, fp, fpcell);
+    _freeLEFMacro (m);
+  }
+  return ret;
 }
 
 
@@ -2941,18 +3859,17 @@ void ActStackLayout::_computeWell (LayoutBlob *blob, int flavor, int type,
   Rectangle bloatbox = blob->getBloatBBox ();
   mat.translate (-bloatbox.llx(), -bloatbox.lly());
 
-  list_t *tiles;
+  const struct blob_rects *rects;
   if (is_welltap) {
-    tiles = blob->search (TILE_FLGS_TO_ATTR(flavor,type,WDIFF_OFFSET), &mat);
+    rects = blob->searchIndex (TILE_FLGS_TO_ATTR(flavor,type,WDIFF_OFFSET), &mat);
   }
   else {
-    tiles = blob->search (TILE_FLGS_TO_ATTR(flavor,type,DIFF_OFFSET), &mat);
+    rects = blob->searchIndex (TILE_FLGS_TO_ATTR(flavor,type,DIFF_OFFSET), &mat);
   }
   
   long wllx, wlly, wurx, wury;
 
-  LayoutBlob::searchBBox (tiles, &wllx, &wlly, &wurx, &wury);
-  LayoutBlob::searchFree (tiles);
+  LayoutBlob::searchBBox (rects, &wllx, &wlly, &wurx, &wury);
   if (wurx >= wllx) {
     /* bloat the region based on well overhang */
     if (is_welltap) {
@@ -3027,16 +3944,24 @@ void ActStackLayout::_emitLocalWellLEF (FILE *fp, Process *p)
     return;
   }
 
+  char buf[10240];
+  a->msnprintfproc (buf, 10240, p);
+  _emitWellLEF (fp, blob, buf);
+}
+
+/*
+ * Well LEF for a cell, given its layout and mangled name
+ */
+void ActStackLayout::_emitWellLEF (FILE *fp, LayoutBlob *blob,
+				   const char *name)
+{
   double scale = Technology::T->scale/1000.0;
 
-  fprintf (fp, "MACRO ");
-  a->mfprintfproc (fp, p);
-  fprintf (fp, "\n");
+  fprintf (fp, "MACRO %s\n", name);
 
   /*for (int lef=0; lef < 2; lef++)*/ {
   int lef = 0;
-  fprintf (fp, "    VERSION ");
-  a->mfprintfproc (fp, p);
+  fprintf (fp, "    VERSION %s", name);
   if (lef == 1) {
     fprintf (fp, "_plug");
   }
@@ -3064,9 +3989,7 @@ void ActStackLayout::_emitLocalWellLEF (FILE *fp, Process *p)
   fprintf (fp, "    END VERSION\n");
   }
   
-  fprintf (fp, "END ");
-  a->mfprintfproc (fp, p);
-  fprintf (fp, "\n\n");
+  fprintf (fp, "END %s\n\n", name);
 
   return;
 }
@@ -3468,38 +4391,147 @@ void ActStackLayout::_maxHeightlocal (Process *p)
  *
  *------------------------------------------------------------------------
  */
-static int _instcount;
-static double _areacount;
-static double _areastdcell;
 static int _maximum_height;
 
-static void count_inst (void *x, ActId *prefix, UserDef *u)
+/*
+ * Instance counts and areas, aggregated bottom-up over the
+ * hierarchy; each process is visited once.
+ */
+struct def_proc_agg {
+  int self;			// 1 if p itself is a cell with layout
+  unsigned long inst;		// # of cell instances, including p
+  double area;			// total cell area
+  double stdarea;		// total area at the maximum cell height
+  unsigned long mult;		// # of times p occurs in the design
+};
+
+static struct pHashtable *_def_agg;
+L_A_DECL (Process *, _def_order);	// processes in post-order
+
+static struct def_proc_agg *_agg_proc (ActStackLayout *ap, Process *p)
 {
-  ActStackLayout *ap = (ActStackLayout *)x;
-  LayoutBlob *b;
+  phash_bucket_t *b;
+  struct def_proc_agg *g;
   long llx, lly, urx, ury;
-  Process *p;
 
-  p = dynamic_cast<Process *>(u);
-  if (!p) {
-    return;
+  b = phash_lookup (_def_agg, p);
+  if (b) {
+    return (struct def_proc_agg *) b->v;
   }
 
-  b = ap->getLayout (p);
-  if (ap->getBBox (p, &llx, &lly, &urx, &ury)) {
-    if ((llx > urx) || (lly > ury)) return;
+  NEW (g, struct def_proc_agg);
+  g->self = 0;
+  g->inst = 0;
+  g->area = 0;
+  g->stdarea = 0;
+  g->mult = 0;
+  b = phash_add (_def_agg, p);
+  b->v = g;
 
-    if (b) {
-      b->incCount();
+  if (ap->getBBox (p, &llx, &lly, &urx, &ury) &&
+      !((llx > urx) || (lly > ury))) {
+    g->self = 1;
+    g->inst = 1;
+    g->area = (urx - llx + 1)*(ury - lly + 1);
+    g->stdarea = (urx - llx + 1)*_maximum_height;
+  }
+
+  ActUniqProcInstiter i(p->CurScope());
+  for (i = i.begin(); i != i.end(); i++) {
+    ValueIdx *vx = (*i);
+    Process *instproc = dynamic_cast<Process *>(vx->t->BaseType ());
+    struct def_proc_agg *c;
+
+    if (vx->t->arrayInfo()) {
+      Arraystep *as = vx->t->arrayInfo()->stepper();
+      while (!as->isend()) {
+	if (vx->isPrimary (as->index())) {
+	  if (as->curProc() && as->curProc() != instproc) {
+	    instproc = as->curProc();
+	  }
+	  c = _agg_proc (ap, instproc);
+	  g->inst += c->inst;
+	  g->area += c->area;
+	  g->stdarea += c->stdarea;
+	}
+	as->step();
+      }
+      delete as;
     }
     else {
-      ap->incBBox (p);
+      c = _agg_proc (ap, instproc);
+      g->inst += c->inst;
+      g->area += c->area;
+      g->stdarea += c->stdarea;
     }
-    _instcount++;
-    
-    _areacount += (urx - llx + 1)*(ury - lly + 1);
-    _areastdcell += (urx - llx + 1)*_maximum_height;
   }
+
+  A_NEW (_def_order, Process *);
+  A_NEXT (_def_order) = p;
+  A_INC (_def_order);
+
+  return g;
+}
+
+/*
+ * Number of occurrences of each process: parents come after their
+ * children in the post-order, so walk it backward.
+ */
+static void _agg_mult (Process *top)
+{
+  phash_bucket_t *b;
+
+  b = phash_lookup (_def_agg, top);
+  Assert (b, "What?");
+  ((struct def_proc_agg *)b->v)->mult = 1;
+
+  for (int k=A_LEN (_def_order)-1; k >= 0; k--) {
+    Process *p = _def_order[k];
+    struct def_proc_agg *g;
+    g = (struct def_proc_agg *) phash_lookup (_def_agg, p)->v;
+    if (g->mult == 0) {
+      continue;
+    }
+
+    ActUniqProcInstiter i(p->CurScope());
+    for (i = i.begin(); i != i.end(); i++) {
+      ValueIdx *vx = (*i);
+      Process *instproc = dynamic_cast<Process *>(vx->t->BaseType ());
+
+      if (vx->t->arrayInfo()) {
+	Arraystep *as = vx->t->arrayInfo()->stepper();
+	while (!as->isend()) {
+	  if (vx->isPrimary (as->index())) {
+	    if (as->curProc() && as->curProc() != instproc) {
+	      instproc = as->curProc();
+	    }
+	    b = phash_lookup (_def_agg, instproc);
+	    ((struct def_proc_agg *)b->v)->mult += g->mult;
+	  }
+	  as->step();
+	}
+	delete as;
+      }
+      else {
+	b = phash_lookup (_def_agg, instproc);
+	((struct def_proc_agg *)b->v)->mult += g->mult;
+      }
+    }
+  }
+}
+
+static void _agg_free ()
+{
+  phash_iter_t it;
+  phash_bucket_t *b;
+
+  phash_iter_init (_def_agg, &it);
+  while ((b = phash_iter_next (_def_agg, &it))) {
+    FREE (b->v);
+  }
+  phash_free (_def_agg);
+  _def_agg = NULL;
+  A_FREE (_def_order);
 }
 
 /*
@@ -3508,9 +4540,11 @@ static void count_inst (void *x, ActId *prefix, UserDef *u)
 static Act *global_act;
 static ActStackLayout *_alp;
 
+static struct pHashtable *_def_procnames;
+
 static void dump_inst (void *x, ActId *prefix, UserDef *u)
 {
-  FILE *fp = (FILE *)x;
+  BufWriter *w = (BufWriter *)x;
   char buf[10240];
   LayoutBlob *b;
   long llx, lly, urx, ury;
@@ -3527,11 +4561,20 @@ static void dump_inst (void *x, ActId *prefix, UserDef *u)
          - inst2591 NAND4X2 ;
          - inst2591 NAND4X2 + PLACED ( 100000 71820 ) N ;   <- pre-placed
     */
-    fprintf (fp, "- ");
+    w->put ("- ");
     prefix->sPrint (buf, 10240);
-    global_act->mfprintf (fp, "%s ", buf);
-    global_act->mfprintfproc (fp, p);
-    fprintf (fp, " ;\n");
+    w->putmangle (global_act, buf);
+    w->put (' ');
+
+    /* cell names repeat; mangle them once */
+    phash_bucket_t *b = phash_lookup (_def_procnames, p);
+    if (!b) {
+      b = phash_add (_def_procnames, p);
+      global_act->msnprintfproc (buf, 10240, p);
+      b->v = Strdup (buf);
+    }
+    w->put ((char *)b->v);
+    w->put (" ;\n");
   }
 }
 
@@ -3565,37 +4608,112 @@ static bool _is_global_supply (ActId *sig)
   return false;
 }
 
-static int print_net (Act *a, FILE *fp, ActId *prefix, act_local_net_t *net,
-		      int toplevel, int pins)
+/*
+ * Mangled strings for a net in a process. They are the same for
+ * every instance of the process, so they are computed once and
+ * shared by all of them.
+ */
+struct def_net_strs {
+  char *name;			// mangled net name
+  int npins;
+  char **pins;			// mangled "inst pin" for each pin
+};
+
+static struct pHashtable *_def_netstrs;
+
+static struct def_net_strs *_get_net_strs (Act *a, act_local_net_t *net)
 {
-  char buf[10240];
+  phash_bucket_t *b;
+  struct def_net_strs *s;
+  char buf[10240], mbuf[10240];
+  ActId *tmp;
+  int len;
+
+  b = phash_lookup (_def_netstrs, net);
+  if (b) {
+    return (struct def_net_strs *) b->v;
+  }
+
+  NEW (s, struct def_net_strs);
+  tmp = net->net->primary()->toid();
+  tmp->sPrint (buf, 10240);
+  delete tmp;
+  a->msnprintf (mbuf, 10240, "%s", buf);
+  s->name = Strdup (mbuf);
+
+  s->npins = A_LEN (net->pins);
+  MALLOC (s->pins, char *, s->npins + 1);
+  for (int i=0; i < s->npins; i++) {
+    net->pins[i].inst->sPrint (buf, 10240);
+    a->msnprintf (mbuf, 10240, "%s", buf);
+    len = strlen (mbuf);
+    snprintf (mbuf + len, 10240 - len, " ");
+    len += strlen (mbuf + len);
+
+    tmp = net->pins[i].pin->toid();
+    tmp->sPrint (buf, 10240);
+    delete tmp;
+    a->msnprintf (mbuf + len, 10240 - len, "%s", buf);
+    s->pins[i] = Strdup (mbuf);
+  }
+
+  b = phash_add (_def_netstrs, net);
+  b->v = s;
+  return s;
+}
+
+static void _free_net_strs ()
+{
+  phash_iter_t it;
+  phash_bucket_t *b;
+
+  if (!_def_netstrs) {
+    return;
+  }
+  phash_iter_init (_def_netstrs, &it);
+  while ((b = phash_iter_next (_def_netstrs, &it))) {
+    struct def_net_strs *s = (struct def_net_strs *) b->v;
+    for (int i=0; i < s->npins; i++) {
+      FREE (s->pins[i]);
+    }
+    FREE (s->pins);
+    FREE (s->name);
+    FREE (s);
+  }
+  phash_free (_def_netstrs);
+  _def_netstrs = NULL;
+}
+
+/* pfx is the mangled instance prefix (with the trailing separator),
+   or NULL at the top level */
+static int print_net (Act *a, BufWriter *w, const char *pfx,
+		      act_local_net_t *net, int toplevel, int pins)
+{
+  struct def_net_strs *s;
   Assert (net, "Why are you calling this function?");
   if (net->skip) return 0;
   if (net->port && (!toplevel || !pins)) return 0;
 
   if (A_LEN (net->pins) < 1) return 0;
 
-  fprintf (fp, "- ");
-  if (prefix) {
-    prefix->sPrint (buf, 10240);
-    global_act->mfprintf (fp, "%s.", buf);
-    //prefix->Print (fp);
-    //fprintf (fp, ".");
+  s = _get_net_strs (a, net);
+
+  w->put ("- ");
+  if (pfx) {
+    w->put (pfx);
   }
-  ActId *tmp = net->net->primary()->toid();
-  tmp->sPrint (buf, 10240);
-  global_act->mfprintf (fp, "%s", buf);
-  //tmp->Print (fp);
-  delete tmp;
+  w->put (s->name);
 
-  fprintf (fp, "\n  ");
+  w->put ("\n  ");
 
   if (net->port) {
     //fprintf (fp, " ( PIN top_iopin%d )", toplevel-1);
+    char pbuf[10240];
     ActId *tmp = net->net->toid();
-    fprintf (fp, " ( PIN ");
-    tmp->Print (fp);
-    fprintf (fp, " )");
+    tmp->sPrint (pbuf, 10240);
+    w->put (" ( PIN ");
+    w->put (pbuf);
+    w->put (" )");
     delete tmp;
   }
   else if (net->net->isglobal() && pins) {
@@ -3605,27 +4723,26 @@ static int print_net (Act *a, FILE *fp, ActId *prefix, act_local_net_t *net,
       /* omit */
     }
     else {
-      fprintf (fp, " ( PIN %s )", buf);
+      char buf[10240];
+      ActId *ptmp = net->net->primary()->toid();
+      ptmp->sPrint (buf, 10240);
+      delete ptmp;
+      w->put (" ( PIN ");
+      w->put (buf);
+      w->put (" )");
     }
     delete tmp;
   }
 
-  for (int i=0; i < A_LEN (net->pins); i++) {
-    fprintf (fp, " ( ");
-    if (prefix) {
-      prefix->sPrint (buf, 10240);
-      a->mfprintf (fp, "%s.", buf);
+  for (int i=0; i < s->npins; i++) {
+    w->put (" ( ");
+    if (pfx) {
+      w->put (pfx);
     }
-    net->pins[i].inst->sPrint (buf, 10240);
-    a->mfprintf (fp, "%s ", buf);
-
-    tmp = net->pins[i].pin->toid();
-    tmp->sPrint (buf, 10240);
-    delete tmp;
-    a->mfprintf (fp, "%s ", buf);
-    fprintf (fp, ")");
+    w->put (s->pins[i]);
+    w->put (" )");
   }
-  fprintf (fp, "\n;\n");
+  w->put ("\n;\n");
 
   return 1;
 }
@@ -3634,16 +4751,62 @@ static unsigned long netcount;
 
 static ActBooleanizePass *boolinfo;
 
-void _collect_emit_nets (Act *a, ActId *prefix, Process *p, FILE *fp, int do_pins)
+struct def_net_emit {
+  Act *a;
+  BufWriter *w;
+  int do_pins;
+  A_DECL (char, pfx);		// mangled instance prefix, built up
+				// one instance at a time
+};
+
+static void _pfx_append (struct def_net_emit *E, const char *s)
+{
+  while (*s) {
+    A_NEW (E->pfx, char);
+    A_NEXT (E->pfx) = *s;
+    A_INC (E->pfx);
+    s++;
+  }
+  A_NEW (E->pfx, char);
+  A_NEXT (E->pfx) = '\0';
+}
+
+/* extend the prefix by one (mangled) instance name */
+static void _pfx_push (struct def_net_emit *E, ActId *id)
+{
+  char buf[10240], mbuf[10240];
+  int len;
+
+  id->sPrint (buf, 10240);
+  len = strlen (buf);
+  snprintf (buf + len, 10240 - len, ".");
+  E->a->msnprintf (mbuf, 10240, "%s", buf);
+  _pfx_append (E, mbuf);
+}
+
+/* restore the prefix to its first len characters */
+static void _pfx_pop (struct def_net_emit *E, int len)
+{
+  A_LEN (E->pfx) = len;
+  if (len > 0) {
+    E->pfx[len] = '\0';
+  }
+}
+
+static void _collect_emit_nets (struct def_net_emit *E, Process *p)
 {
   Assert (p->isExpanded(), "What are we doing");
 
   act_boolean_netlist_t *n = boolinfo->getBNL (p);
   Assert (n, "What!");
 
+  /* the prefix is the same for all the nets in this instance */
+  const char *pfx = A_LEN (E->pfx) > 0 ? E->pfx : NULL;
+
   /* first, print my local nets */
   for (int i=0; i < A_LEN (n->nets); i++) {
-    if (print_net (a, fp, prefix, &n->nets[i], prefix == NULL ? (i+1) : 0, do_pins)) {
+    if (print_net (E->a, E->w, pfx, &n->nets[i], pfx == NULL ? (i+1) : 0,
+		   E->do_pins)) {
       netcount++;
     }
   }
@@ -3653,22 +4816,11 @@ void _collect_emit_nets (Act *a, ActId *prefix, Process *p, FILE *fp, int do_pin
   for (i = i.begin(); i != i.end(); i++) {
     ValueIdx *vx = (*i);
     ActId *newid;
-    ActId *cpy;
+    int len = A_LEN (E->pfx);
     
     Process *instproc = dynamic_cast<Process *>(vx->t->BaseType ());
 
     newid = new ActId (vx->getName());
-    if (prefix) {
-      cpy = prefix->Clone ();
-      ActId *tmp = cpy;
-      while (tmp->Rest()) {
-	tmp = tmp->Rest();
-      }
-      tmp->Append (newid);
-    }
-    else {
-      cpy = newid;
-    }
 
     if (vx->t->arrayInfo()) {
       Arraystep *as = vx->t->arrayInfo()->stepper();
@@ -3679,18 +4831,22 @@ void _collect_emit_nets (Act *a, ActId *prefix, Process *p, FILE *fp, int do_pin
 	  }
 	  Array *x = as->toArray();
 	  newid->setArray (x);
-	  _collect_emit_nets (a, cpy, instproc, fp, do_pins);
-	  delete x;
+	  _pfx_push (E, newid);
 	  newid->setArray (NULL);
+	  delete x;
+	  _collect_emit_nets (E, instproc);
+	  _pfx_pop (E, len);
 	}
 	as->step();
       }
       delete as;
     }
     else {
-      _collect_emit_nets (a, cpy, instproc, fp, do_pins);
+      _pfx_push (E, newid);
+      _collect_emit_nets (E, instproc);
+      _pfx_pop (E, len);
     }
-    delete cpy;
+    delete newid;
   }
   return;
 }
@@ -3725,18 +4881,31 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
   }
   ActApplyPass *ap = dynamic_cast<ActApplyPass *>(tap);
 
-  _instcount = 0;
-  _areacount = 0;
-  _areastdcell = 0;
   _maximum_height = dp->getIntParam ("cell_maxheight");
-  ap->setCookie (this);
-  ap->setInstFn (count_inst);
-  ap->run (p);
-  count_inst (this, NULL, p); // oops!
-
-  _total_instances = _instcount;
-  _total_area = _areacount;
-  _total_stdcell_area = _areastdcell;
+  _def_agg = phash_new (32);
+  A_INIT (_def_order);
+  struct def_proc_agg *agg = _agg_proc (this, p);
+
+  _total_instances = agg->inst;
+  _total_area = agg->area;
+  _total_stdcell_area = agg->stdarea;
+
+  /* per-cell instance counts */
+  _agg_mult (p);
+  for (int k=0; k < A_LEN (_def_order); k++) {
+    phash_bucket_t *b = phash_lookup (_def_agg, _def_order[k]);
+    struct def_proc_agg *g = (struct def_proc_agg *) b->v;
+    if (g->self && g->mult > 0) {
+      LayoutBlob *blob = getLayout (_def_order[k]);
+      if (blob) {
+	blob->incCount (g->mult);
+      }
+      else {
+	incBBox (_def_order[k], g->mult);
+      }
+    }
+  }
+  _agg_free ();
 
 
   double sidey;
@@ -3841,13 +5010,27 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
   }
 
   /* -- instances  -- */
-  fprintf (fp, "COMPONENTS %d ;\n", _total_instances);
-  ap->setCookie (fp);
+  BufWriter out (fp);
+  char buf[10240];
+  
+  out.printf ("COMPONENTS %d ;\n", _total_instances);
+  ap->setCookie (&out);
   ap->setInstFn (dump_inst);
   global_act = a;
   _alp = this;
+  _def_procnames = phash_new (8);
   ap->run (p);
-  fprintf (fp, "END COMPONENTS\n\n");
+  {
+    phash_iter_t it;
+    phash_bucket_t *b;
+    phash_iter_init (_def_procnames, &it);
+    while ((b = phash_iter_next (_def_procnames, &it))) {
+      FREE (b->v);
+    }
+    phash_free (_def_procnames);
+    _def_procnames = NULL;
+  }
+  out.put ("END COMPONENTS\n\n");
 
 
   /* -- pins -- */
@@ -3880,7 +5063,7 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
       }
     }
 
-    fprintf (fp, "PINS %d ;\n", num_pins);
+    out.printf ("PINS %d ;\n", num_pins);
     num_pins = 0;
     for (int i=0; i < A_LEN (act_bnl->ports); i++) {
       if (act_bnl->ports[i].omit) continue;
@@ -3888,19 +5071,17 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
       ActId *tmp = act_bnl->nets[act_bnl->ports[i].netid].net->toid();
       //fprintf (fp, "- top_iopin%d + NET ", act_bnl->ports[i].netid);
       // we can use the port name here! no weird numbers now!
-      fprintf (fp, "- ");
-      tmp->Print (fp);
-      fprintf (fp, " + NET ");
-      tmp->Print (fp);
+      tmp->sPrint (buf, 10240);
+      out.printf ("- %s + NET %s", buf, buf);
       delete tmp;
       if (act_bnl->ports[i].input) {
-	fprintf (fp, " + DIRECTION INPUT + USE SIGNAL ");
+	out.put (" + DIRECTION INPUT + USE SIGNAL ");
       }
       else {
-	fprintf (fp, " + DIRECTION OUTPUT + USE SIGNAL ");
+	out.put (" + DIRECTION OUTPUT + USE SIGNAL ");
       }
       /* placement directives will go here */
-      fprintf (fp, " ;\n");
+      out.put (" ;\n");
     }
 
     /* gloal nets */
@@ -3912,27 +5093,26 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
 	}
 	else {
 	  //fprintf (fp, "- top_iopin%d + NET ", i);
-	  fprintf (fp, "- ");
-	  tmp->Print (fp);
-	  fprintf (fp, " + NET ");
-	  tmp->Print (fp);
-	  fprintf (fp, " + DIRECTION INPUT + USE SIGNAL ;\n");
+	  tmp->sPrint (buf, 10240);
+	  out.printf ("- %s + NET %s", buf, buf);
+	  out.put (" + DIRECTION INPUT + USE SIGNAL ;\n");
 	}
 	delete tmp;
       }
     }
   }
   else {
-    fprintf (fp, "PINS 0 ;\n");
+    out.put ("PINS 0 ;\n");
   }
-  fprintf (fp, "END PINS\n\n");
+  out.put ("END PINS\n\n");
 
   netcount = 0;
   unsigned long pos = 0;
 
   /* -- nets -- */
+  out.flush ();
   pos = ftell (fp);
-  fprintf (fp, "NETS %012lu ;\n", netcount);
+  out.printf ("NETS %012lu ;\n", netcount);
   /*
     Output format: 
 
@@ -3940,10 +5120,19 @@ void ActStackLayout::emitDEF (FILE *fp, Process *p, double pad,
     ( inst5638 A ) ( inst4678 Y )
     ;
   */
-  _collect_emit_nets (a, NULL, p, fp, do_pins);
+  struct def_net_emit E;
+  E.a = a;
+  E.w = &out;
+  E.do_pins = do_pins;
+  A_INIT (E.pfx);
+  _def_netstrs = phash_new (32);
+  _collect_emit_nets (&E, p);
+  _free_net_strs ();
+  A_FREE (E.pfx);
   
-  fprintf (fp, "END NETS\n\n");
-  fprintf (fp, "END DESIGN\n");
+  out.put ("END NETS\n\n");
+  out.put ("END DESIGN\n");
+  out.flush ();
 
   fseek (fp, pos, SEEK_SET);
   
@@ -4076,6 +5265,21 @@ void ActStackLayout::_collectLocalStats(Process *p)
 	  Technology::T->scale/1000.0);
   printf ("area: %.2f%%\n", area*count*100.0/all_area*area_mult);
 
+  if (blob) {
+    struct layout_tile_stats ts;
+    blob->getTileStats (&ts);
+    printf ("  tiles=%lu; peak_tiles=%lu; tile_mem=%.1f KB\n",
+	    ts.ntiles, ts.peak, ts.bytes/1024.0);
+    if (ts.nfind > 0) {
+      printf ("  tile_find=%lu; hops=%lu (%.2f/find)\n",
+	      ts.nfind, ts.nhops, ts.nhops*1.0/ts.nfind);
+    }
+    if (ts.nmerged > 0) {
+      printf ("  tile_merge: %lu -> %lu tiles\n",
+	      ts.ntiles + ts.nmerged, ts.ntiles);
+    }
+  }
+
   unsigned long ncount, ecount, keeper;
   _getNetDetails (p, &ncount, &ecount, &keeper);
   if (ncount > 0) {
@@ -4387,7 +5591,7 @@ int ActStackLayout::getBBox (Process *p, long *llx, long *lly,
   return 0;
 }
 
-void ActStackLayout::incBBox (Process *p) 
+void ActStackLayout::incBBox (Process *p, long n)
 {
   phash_bucket_t *pb;
   struct bbox_elem *be;
@@ -4396,7 +5600,7 @@ void ActStackLayout::incBBox (Process *p)
   pb = phash_lookup (boxH, p);
   Assert (pb, "What?");
   be = (struct bbox_elem *) pb->v;
-  be->count++;
+  be->count += n;
 }
 
 long ActStackLayout::getBBoxCount (Process *p)
@@ -4670,6 +5874,9 @@ void ActStackLayout::reportDirs (FILE *fp)
 
   fprintf (fp, "    outinitdir: %s\n", _rect_outinitdir ? _rect_outinitdir : "none");
   fprintf (fp, "    outdir: %s\n", _rect_outdir ? _rect_outdir : "none");
+  if (_cache_dir) {
+    fprintf (fp, "    cache: %s\n", _cache_dir);
+  }
 }
 
 
@@ -48,7 +48,7 @@ public:
 
   void setBBox (Process *p, long llx, long lly, long urx, long ury);
   int getBBox (Process *p, long *llx, long *lly, long *urx, long *ury);
-  void incBBox (Process *p);
+  void incBBox (Process *p, long n = 1);
   long getBBoxCount (Process *p);
 
 
@@ -63,15 +63,36 @@ public:
   int _localdiffspace (Process *p);
 
   LayoutBlob *_readlocalRect (Process *p);
+  char *_localRectFile (Process *p);
+  LayoutBlob *_readRectFile (Process *p, const char *file, int mode,
+			     Rectangle &file_bbox);
 
   /* mode 0 */
   LayoutBlob *_createlocallayout (Process *p);
+  LayoutBlob *_createstacklayout (Process *p, list_t *stks);
+
+  /* mode 0 with threads: stack layouts computed by _buildParallel,
+     indexed by process */
+  struct pHashtable *_prebuilt;
+  void _buildParallel (int jobs);
+  list_t *_visitedProcs ();
 
   /* mode 1 */
   int _lef_header;
   int _cell_header;
   int _emitlocalLEF (Process *p);
+  int _emitlocalLEF (Process *p, FILE *fp);
+  int _emitlocalLEF (Process *p, FILE *fp, FILE *fpcell);
+  struct lef_macro *_lefMacro (Process *p, int *ret);
+  void _emitLEFMacro (struct lef_macro *m, FILE *fp, FILE *fpcell);
+
+  /* mode 1 with threads: LEF text computed by _buildParallelLEF,
+     indexed by process */
+  struct pHashtable *_prelef;
+  void _buildParallelLEF (int jobs);
+  void _freeParallelLEF ();
   void _emitLocalWellLEF (FILE *fp, Process *p);
+  void _emitWellLEF (FILE *fp, LayoutBlob *blob, const char *name);
 
   void _computeWell (LayoutBlob *blob, int flavor, int type,
 		     long *llx, long *lly, long *urx, long *ury,
@@ -89,6 +110,17 @@ public:
   /* mode 4 */
   void _emitlocalRect (Process *p);
 
+  /* .rect file name extension for output; the writer picks the
+     format from it */
+  const char *_rectSuffix () { return _rect_suffix; }
+
+  /* leaf cell cache: generated .rect and LEF for each cell, keyed by
+     a hash of the netlist and configuration */
+  struct layout_cache_ent *_cacheEntry (Process *p);
+  LayoutBlob *_readCache (Process *p);
+  void _writeCacheRect (Process *p, LayoutBlob *b);
+  void _cacheHashConfig ();
+
   /* this is mode 5 */
   void emitDEFHeader (FILE *fp, Process *p);
   /* pad doubles as bb_x, ratio as bb_y if is_bounding_box is true*/
@@ -159,6 +191,11 @@ public:
   const char *_rect_outdir;	// rect output directory, if any
   const char *_rect_outinitdir; // rect output directory for initial
 				// unwired layout
+  const char *_rect_suffix;	// .rect or .rectb
+
+  const char *_cache_dir;	// leaf cell cache directory, if any
+  unsigned long _cache_cfg;	// hash of the configuration
+  struct pHashtable *_cache;	// process to cache entry
 
   int _extra_tracks_top;
   int _extra_tracks_bot;
@@ -19,6 +19,10 @@
  *
  **************************************************************************
  */
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <common/heap.h>
 #include "stk_pass.h"
 #include <common/config.h>
@@ -273,50 +277,115 @@ static void node_degree (node_t *n, int *pcnt, int *ncnt)
 
 
 /*
- * Search for gate pair to see if it is already in the heap
+ * Candidate gate pairs are kept in a heap ordered by cost, along with
+ * an index from a signature of the pair to the heap entries with that
+ * signature. This lets us check for duplicates without scanning the
+ * entire heap.
  */
-static int find_pairs (Heap *h, struct gate_pairs *p)
+struct pair_heap {
+  Heap *h;
+  std::unordered_multimap<unsigned long, struct gate_pairs *> idx;
+};
+
+/*
+ * The signature covers share, nodeshare, and the edges/gate pair
+ * sequence, but not the end points.
+ */
+static unsigned long pair_signature (struct gate_pairs *p)
 {
-  struct gate_pairs *x;
+  unsigned long sig;
 
-  for (int i=0; i < h->sz; i++) {
-    x = (struct gate_pairs *) h->value[i];
-    if (x->share == p->share && x->nodeshare == p->nodeshare &&
-	x->basepair == p->basepair) {
-      listitem_t *li, *mi;
-      if (x->l == p->l) {
-	if (x->basepair) {
-	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p)
-	    return 1;
-	}
-	else {
-	  for (li = list_first (x->u.gp), mi = list_first (p->u.gp); 
-	       li && mi; li = list_next (li), mi = list_next (mi)) {
-	    if (list_value (li) != list_value (mi))  {
-	      break;
-	    }
-	  }
-	  if (!li || !mi) return 1;
-	}
-      }
-      else if (x->l == p->r) {
-	if (x->basepair) {
-	  if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p)
-	    return 1;
-	}
-	else {
-	  list_t *rp;
-	  rp = list_dup (p->u.gp);
-	  list_reverse (rp);
-	  for (li = list_first (x->u.gp), mi = list_first (p->u.gp); 
-	       li && mi; li = list_next (li), mi = list_next (mi)) {
-	    if (list_value (li) != list_value (mi))  {
-	      break;
-	    }
-	  }
-	  if (!li || !mi) return 1;
-	}
-      }
+  sig = p->share;
+  sig = sig*31 + p->nodeshare;
+  sig = sig*31 + p->basepair;
+  if (p->basepair) {
+    sig = sig*31 + (unsigned long) p->u.e.n;
+    sig = sig*31 + (unsigned long) p->u.e.p;
+  }
+  else {
+    listitem_t *li;
+    for (li = list_first (p->u.gp); li; li = list_next (li)) {
+      sig = sig*31 + (unsigned long) list_value (li);
+    }
+  }
+  return sig;
+}
+
+/*
+ * Check if x is a duplicate of p. A non-basepair's share is the sum
+ * of the (positive) shares of its list, so equal shares with one list
+ * a prefix of the other means the lists are identical.
+ */
+static int same_pairs (struct gate_pairs *x, struct gate_pairs *p)
+{
+  listitem_t *li, *mi;
+
+  if (x->share != p->share || x->nodeshare != p->nodeshare ||
+      x->basepair != p->basepair) {
+    return 0;
+  }
+  if (!(x->l == p->l) && !(x->l == p->r)) {
+    return 0;
+  }
+  if (x->basepair) {
+    if (x->u.e.n == p->u.e.n && x->u.e.p == p->u.e.p) {
+      return 1;
+    }
+    return 0;
+  }
+  for (li = list_first (x->u.gp), mi = list_first (p->u.gp); 
+       li && mi; li = list_next (li), mi = list_next (mi)) {
+    if (list_value (li) != list_value (mi))  {
+      break;
+    }
+  }
+  if (!li || !mi) {
+    return 1;
+  }
+  return 0;
+}
+
+static struct pair_heap *pairs_new ()
+{
+  struct pair_heap *ph = new pair_heap;
+  ph->h = heap_new (32);
+  return ph;
+}
+
+static void pairs_free (struct pair_heap *ph)
+{
+  heap_free (ph->h);
+  delete ph;
+}
+
+static void pairs_insert (struct pair_heap *ph, int key, struct gate_pairs *p)
+{
+  heap_insert (ph->h, key, p);
+  ph->idx.insert (std::make_pair (pair_signature (p), p));
+}
+
+static struct gate_pairs *pairs_remove_min (struct pair_heap *ph)
+{
+  struct gate_pairs *p = (struct gate_pairs *) heap_remove_min (ph->h);
+  auto range = ph->idx.equal_range (pair_signature (p));
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second == p) {
+      ph->idx.erase (it);
+      break;
+    }
+  }
+  return p;
+}
+
+/*
+ * Search for gate pair to see if it is already in the heap
+ */
+static int find_pairs (struct pair_heap *ph, struct gate_pairs *p)
+{
+  auto range = ph->idx.equal_range (pair_signature (p));
+  for (auto it = range.first; it != range.second; it++) {
+    if (same_pairs (it->second, p)) {
+      return 1;
     }
   }
   return 0;
@@ -597,7 +666,250 @@ static edge_t *pick_candidate_edge (list_t *l, node_t *n, int type, node_t **oth
 }
 
 
-static list_t *compute_raw_stacks (netlist_t *N, list_t *l, int type)
+
+/*
+ * Bounded search for raw stacks.
+ *
+ * The raw stacks are a set of paths that cover all the available
+ * edges of one type; each additional path is a diffusion break. An
+ * edge with k available folds is used all at once, ending on the
+ * other side if k is odd and on the same side if k is even. The
+ * greedy walk in compute_raw_stacks is used as the initial solution,
+ * and a depth-first branch-and-bound search looks for one with fewer
+ * paths until it has visited a fixed number of search nodes. The
+ * budget is a step count rather than a time limit, so the result only
+ * depends on the netlist.
+ *
+ * Lower bound: every path has at most two ends at nodes with odd
+ * degree (counting folds), so at least #odd/2 more paths are needed,
+ * except that the current path may continue.
+ *
+ * A search is set up and its result is turned back into stacks by the
+ * pass; raw_search_dfs itself only touches the raw_search, so
+ * searches for different cells can run in separate threads.
+ */
+struct raw_search {
+  std::vector<node_t *> nodes;
+  std::vector<edge_t *> edges;
+  std::vector<int> ea, eb;	// end points
+  std::vector<int> eav;		// available folds
+  std::vector<int> estart;	// visited count before the search
+  std::vector<std::vector<int> > adj;
+
+  std::vector<char> used;
+  std::vector<int> deg;		// available folds at each node
+  int odd;			// # of nodes with odd degree
+  int remaining;		// # of unused edges
+
+  /* paths: node v is encoded as -(v+1), followed by edge indices */
+  std::vector<int> path;
+  std::vector<int> best;
+  int bestcost;
+
+  long steps;
+  long limit;			// step budget
+  bool stop;
+};
+
+static void raw_search_degree (raw_search *S, int v, int delta)
+{
+  if (S->deg[v] & 1) S->odd--;
+  S->deg[v] += delta;
+  if (S->deg[v] & 1) S->odd++;
+}
+
+static void raw_search_use (raw_search *S, int e, int dir)
+{
+  S->used[e] = (dir > 0 ? 0 : 1);
+  S->remaining += dir;
+  raw_search_degree (S, S->ea[e], dir*S->eav[e]);
+  raw_search_degree (S, S->eb[e], dir*S->eav[e]);
+}
+
+static int raw_search_next (raw_search *S, int e, int v)
+{
+  if (S->eav[e] & 1) {
+    return (S->ea[e] == v ? S->eb[e] : S->ea[e]);
+  }
+  return v;
+}
+
+static void raw_search_dfs (raw_search *S, int cur, int paths)
+{
+  int lb;
+
+  if (S->stop) return;
+  if (++S->steps > S->limit) {
+    S->stop = true;
+    return;
+  }
+
+  if (S->remaining == 0) {
+    if (paths < S->bestcost) {
+      S->bestcost = paths;
+      S->best = S->path;
+    }
+    return;
+  }
+
+  lb = S->odd/2;
+  if (lb < 1) lb = 1;
+  if (cur >= 0 && S->deg[cur] > 0) {
+    lb--;
+  }
+  if (paths + lb >= S->bestcost) {
+    return;
+  }
+
+  if (cur >= 0 && S->deg[cur] > 0) {
+    /* extend the current path; try edges that don't end the path
+       first, like the greedy walk */
+    for (int pass=0; pass < 2; pass++) {
+      for (int e : S->adj[cur]) {
+	if (S->used[e]) continue;
+	int nxt = raw_search_next (S, e, cur);
+	raw_search_use (S, e, -1);
+	int cont = (S->deg[nxt] > 0);
+	if (cont == (pass == 0)) {
+	  S->path.push_back (e);
+	  raw_search_dfs (S, nxt, paths);
+	  S->path.pop_back ();
+	}
+	raw_search_use (S, e, 1);
+	if (S->stop) return;
+      }
+    }
+    return;
+  }
+
+  /* start a new path, at an odd degree node if there is one */
+  for (int v=0; v < (int)S->nodes.size(); v++) {
+    if (S->deg[v] == 0) continue;
+    if (S->odd > 0 && !(S->deg[v] & 1)) continue;
+    S->path.push_back (-(v+1));
+    raw_search_dfs (S, v, paths+1);
+    S->path.pop_back ();
+    if (S->stop) return;
+    if (S->odd == 0) break;
+  }
+}
+
+/*
+ * Set up a search for a better set of raw stacks than the greedy
+ * one. edges has the available edges before the greedy walk, with
+ * their visited counts in start. Returns NULL if there is nothing to
+ * search.
+ */
+static raw_search *raw_search_new (list_t *l,
+				   std::vector<edge_t *> &edges,
+				   std::vector<int> &start,
+				   int greedy, long budget)
+{
+  raw_search *S;
+  struct pHashtable *nidx, *eidx;
+  phash_bucket_t *b;
+  listitem_t *li;
+
+  if (greedy <= 1 || edges.empty()) {
+    /* can't do better than one path */
+    return NULL;
+  }
+
+  S = new raw_search;
+  nidx = phash_new (32);
+  for (li = list_first (l); li; li = list_next (li)) {
+    node_t *n = (node_t *) list_value (li);
+    b = phash_add (nidx, n);
+    b->i = S->nodes.size();
+    S->nodes.push_back (n);
+  }
+  S->adj.resize (S->nodes.size());
+  S->deg.assign (S->nodes.size(), 0);
+  S->odd = 0;
+  S->remaining = 0;
+
+  eidx = phash_new (32);
+  for (size_t i=0; i < edges.size(); i++) {
+    edge_t *e = edges[i];
+    phash_bucket_t *ba = phash_lookup (nidx, e->a);
+    phash_bucket_t *bb = phash_lookup (nidx, e->b);
+    if (!ba || !bb) {
+      phash_free (nidx);
+      phash_free (eidx);
+      delete S;
+      return NULL;
+    }
+    b = phash_add (eidx, e);
+    b->i = i;
+    S->edges.push_back (e);
+    S->ea.push_back (ba->i);
+    S->eb.push_back (bb->i);
+    S->eav.push_back (e->nfolds - start[i]);
+    S->estart.push_back (start[i]);
+    S->used.push_back (1);
+    raw_search_use (S, i, 1);
+  }
+  phash_free (nidx);
+
+  /* adjacency in edge list order, as in the greedy walk */
+  for (size_t v=0; v < S->nodes.size(); v++) {
+    for (li = list_first (S->nodes[v]->e); li; li = list_next (li)) {
+      b = phash_lookup (eidx, list_value (li));
+      if (b) {
+	S->adj[v].push_back (b->i);
+      }
+    }
+  }
+  phash_free (eidx);
+
+  S->bestcost = greedy;
+  S->steps = 0;
+  S->limit = budget;
+  S->stop = false;
+  return S;
+}
+
+static void raw_search_run (raw_search *S)
+{
+  raw_search_dfs (S, -1, 0);
+}
+
+/*
+ * The stacks found by the search, or NULL if it didn't improve on
+ * the greedy walk.
+ */
+static list_t *raw_search_result (raw_search *S)
+{
+  if (S->best.empty()) {
+    return NULL;
+  }
+
+  list_t *stks = list_new ();
+  list_t *onestk = NULL;
+  int cur = -1;
+  for (int x : S->best) {
+    if (x < 0) {
+      cur = -x - 1;
+      onestk = list_new ();
+      list_append (stks, onestk);
+      list_append (onestk, S->nodes[cur]);
+    }
+    else {
+      cur = raw_search_next (S, x, cur);
+      list_append (onestk, S->edges[x]);
+      list_append (onestk, (void *)(long)S->estart[x]);
+      list_append (onestk, S->nodes[cur]);
+    }
+  }
+  return stks;
+}
+
+/*
+ * Greedy raw stacks. If budget is positive, *search is set to a
+ * search that may improve on them (or NULL).
+ */
+static list_t *compute_raw_stacks (list_t *l, int type,
+				   long budget, raw_search **search)
 {
   node_t *n;
   list_t *stks;
@@ -606,7 +918,31 @@ static list_t *compute_raw_stacks (netlist_t *N, list_t *l, int type)
   node_t *other;
 
   stks = list_new ();
+  if (search) {
+    *search = NULL;
+  }
 
+  /* save the available edges for the search */
+  std::vector<edge_t *> edges;
+  std::vector<int> start;
+  if (budget > 0) {
+    struct pHashtable *H = phash_new (32);
+    listitem_t *li, *mi;
+    for (li = list_first (l); li; li = list_next (li)) {
+      n = (node_t *) list_value (li);
+      for (mi = list_first (n->e); mi; mi = list_next (mi)) {
+	e = (edge_t *) list_value (mi);
+	if (e->type != type) continue;
+	if (!available_edge (e)) continue;
+	if (phash_lookup (H, e)) continue;
+	phash_add (H, e);
+	edges.push_back (e);
+	start.push_back (e->visited);
+      }
+    }
+    phash_free (H);
+  }
+  list_t *all = (budget > 0 ? list_dup (l) : NULL);
 
 #if 0
   printf ("Type: %c\n", type == EDGE_PFET ? 'p' : 'n');
@@ -640,10 +976,463 @@ static list_t *compute_raw_stacks (netlist_t *N, list_t *l, int type)
       list_append (stks, onestk);
     }
   }
+
+  if (all) {
+    if (search) {
+      *search = raw_search_new (all, edges, start, list_length (stks), budget);
+    }
+    list_free (all);
+  }
   return stks;
 }
 
 
+/*
+ * The stacks only depend on the structure of the netlist, not on the
+ * names of its nodes. Processes with the same netlist (e.g. a cell
+ * template instantiated with parameters that don't change its
+ * circuits) get a copy of the stacks computed for the first one, with
+ * nodes and edges mapped positionally.
+ *
+ * The shape of a netlist is a flattened description of everything the
+ * stack computation looks at: nodes in netlist order, the edge list of
+ * each node in order, and the edge attributes. Two netlists with the
+ * same shape result in the same stacks.
+ */
+struct stk_shape {
+  std::vector<int> sig;
+  std::vector<node_t *> nodes;
+  std::vector<edge_t *> edges;
+  unsigned long hash;
+};
+
+struct stk_memo {
+  stk_shape *shape;
+  std::vector<char> contact;	// node contact flags after stacking
+  std::vector<int> visited;	// edge visited counts after stacking
+  list_t *stks;			// copy of the result; NULL until
+				// the stack search is done
+  list_t *pairs;		// gate pairs allocated for the copy
+};
+
+/*
+ * Stacks that are waiting for the stack search. Either ret was
+ * computed here and its raw stacks may be replaced by the search
+ * results (shape == NULL), or it is to be filled in with a copy of
+ * the memo m once that is complete.
+ */
+struct stk_pending {
+  list_t *ret;
+  raw_search *S[2];		// n and p searches, if any
+  stk_memo *m;
+  stk_shape *shape;		// shape of ret, for a copy
+};
+
+struct stk_cache {
+  std::unordered_multimap<unsigned long, stk_memo *> tab;
+  std::vector<stk_pending *> pending; // in traversal order
+};
+
+static int node_idx (struct pHashtable *H, node_t *n)
+{
+  phash_bucket_t *b;
+  if (!n) return -1;
+  b = phash_lookup (H, n);
+  return b ? b->i : -2;
+}
+
+static stk_shape *netlist_shape (netlist_t *N)
+{
+  stk_shape *s = new stk_shape;
+  struct pHashtable *nidx, *eidx;
+  phash_bucket_t *b;
+  listitem_t *li;
+  node_t *n;
+
+  nidx = phash_new (32);
+  eidx = phash_new (32);
+
+  for (n = N->hd; n; n = n->next) {
+    b = phash_add (nidx, n);
+    b->i = s->nodes.size();
+    s->nodes.push_back (n);
+  }
+
+  for (n = N->hd; n; n = n->next) {
+    int flags = 0;
+    if (n->supply) flags |= 1;
+    if (n->v && n->v->v->output) flags |= 2;
+    if (n == N->Vdd) flags |= 4;
+    if (n == N->GND) flags |= 8;
+    if (n->contact) flags |= 16;
+    s->sig.push_back (flags);
+    s->sig.push_back (list_length (n->e));
+    for (li = list_first (n->e); li; li = list_next (li)) {
+      edge_t *e = (edge_t *) list_value (li);
+      b = phash_lookup (eidx, e);
+      if (b) {
+	s->sig.push_back (b->i);
+	continue;
+      }
+      b = phash_add (eidx, e);
+      b->i = s->edges.size();
+      s->edges.push_back (e);
+      s->sig.push_back (-1);
+      s->sig.push_back (e->type);
+      s->sig.push_back (e->flavor);
+      s->sig.push_back (e->nfolds);
+      s->sig.push_back (e->visited);
+      s->sig.push_back (e->w);
+      s->sig.push_back (e->l);
+      s->sig.push_back (node_idx (nidx, e->g));
+      s->sig.push_back (node_idx (nidx, e->a));
+      s->sig.push_back (node_idx (nidx, e->b));
+    }
+  }
+
+  phash_free (nidx);
+  phash_free (eidx);
+
+  s->hash = s->sig.size();
+  for (int v : s->sig) {
+    s->hash = s->hash*31 + (unsigned int)v;
+  }
+  return s;
+}
+
+static void *map_ptr (struct pHashtable *M, void *p)
+{
+  phash_bucket_t *b;
+  if (!p) return NULL;
+  b = phash_lookup (M, p);
+  if (b) {
+    return b->v;
+  }
+  return p;
+}
+
+/*
+ * Copy a gate pair, replacing nodes and edges using the map M. Gate
+ * pairs are added to M as well, so that shared pairs stay shared.
+ */
+static struct gate_pairs *copy_pair (struct gate_pairs *gp,
+				     struct pHashtable *M)
+{
+  phash_bucket_t *b;
+  struct gate_pairs *tmp;
+  listitem_t *li;
+
+  b = phash_lookup (M, gp);
+  if (b) {
+    return (struct gate_pairs *) b->v;
+  }
+  NEW (tmp, struct gate_pairs);
+  *tmp = *gp;
+  b = phash_add (M, gp);
+  b->v = tmp;
+
+  tmp->l.n = (node_t *) map_ptr (M, gp->l.n);
+  tmp->l.p = (node_t *) map_ptr (M, gp->l.p);
+  tmp->r.n = (node_t *) map_ptr (M, gp->r.n);
+  tmp->r.p = (node_t *) map_ptr (M, gp->r.p);
+  if (gp->basepair) {
+    tmp->u.e.n = (edge_t *) map_ptr (M, gp->u.e.n);
+    tmp->u.e.p = (edge_t *) map_ptr (M, gp->u.e.p);
+  }
+  else {
+    tmp->u.gp = list_new ();
+    for (li = list_first (gp->u.gp); li; li = list_next (li)) {
+      list_append (tmp->u.gp,
+		   copy_pair ((struct gate_pairs *) list_value (li), M));
+    }
+  }
+  return tmp;
+}
+
+/*
+ * Raw stacks: node, followed by (edge, visited count, node) triples
+ */
+static list_t *copy_raw_stacks (list_t *stks, struct pHashtable *M)
+{
+  list_t *ret;
+  listitem_t *li, *mi;
+  int pos;
+
+  if (!stks) {
+    return NULL;
+  }
+  ret = list_new ();
+  for (li = list_first (stks); li; li = list_next (li)) {
+    list_t *onestk = list_new ();
+    pos = 0;
+    for (mi = list_first ((list_t *) list_value (li)); mi;
+	 mi = list_next (mi)) {
+      if (pos % 3 == 2) {
+	list_append (onestk, list_value (mi));
+      }
+      else {
+	list_append (onestk, map_ptr (M, list_value (mi)));
+      }
+      pos++;
+    }
+    list_append (ret, onestk);
+  }
+  return ret;
+}
+
+static list_t *copy_stacks (list_t *stks, struct pHashtable *M)
+{
+  list_t *ret, *l;
+  listitem_t *li;
+
+  ret = list_new ();
+  li = list_first (stks);
+  l = list_new ();
+  for (listitem_t *mi = list_first ((list_t *) list_value (li)); mi;
+       mi = list_next (mi)) {
+    list_append (l, copy_pair ((struct gate_pairs *) list_value (mi), M));
+  }
+  list_append (ret, l);
+  li = list_next (li);
+  list_append (ret, copy_raw_stacks ((list_t *) list_value (li), M));
+  li = list_next (li);
+  list_append (ret, copy_raw_stacks ((list_t *) list_value (li), M));
+  return ret;
+}
+
+static stk_memo *stk_cache_find (RawActStackPass *sp, stk_shape *s)
+{
+  stk_cache *c = sp->getCache ();
+  if (!c) {
+    return NULL;
+  }
+  auto range = c->tab.equal_range (s->hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second->shape->sig == s->sig) {
+      return it->second;
+    }
+  }
+  return NULL;
+}
+
+/* node and edge state after stacking, from the memo */
+static void stk_cache_restore (stk_memo *m, stk_shape *s)
+{
+  for (size_t i=0; i < s->nodes.size(); i++) {
+    s->nodes[i]->contact = m->contact[i];
+  }
+  for (size_t i=0; i < s->edges.size(); i++) {
+    s->edges[i]->visited = m->visited[i];
+  }
+}
+
+static list_t *stk_cache_replay (stk_memo *m, stk_shape *s)
+{
+  struct pHashtable *M;
+  phash_bucket_t *b;
+  list_t *ret;
+
+  M = phash_new (32);
+  for (size_t i=0; i < s->nodes.size(); i++) {
+    b = phash_add (M, m->shape->nodes[i]);
+    b->v = s->nodes[i];
+  }
+  for (size_t i=0; i < s->edges.size(); i++) {
+    b = phash_add (M, m->shape->edges[i]);
+    b->v = s->edges[i];
+  }
+  ret = copy_stacks (m->stks, M);
+  phash_free (M);
+  return ret;
+}
+
+static stk_cache *stk_cache_get (RawActStackPass *sp)
+{
+  stk_cache *c = sp->getCache ();
+  if (!c) {
+    c = new stk_cache;
+    sp->setCache (c);
+  }
+  return c;
+}
+
+/* save a copy of the final stacks in the memo */
+static void stk_cache_fill (stk_memo *m, list_t *stks)
+{
+  struct pHashtable *M;
+  phash_iter_t it;
+  phash_bucket_t *b;
+
+  /* the map only has gate pairs, so nodes and edges are unchanged */
+  M = phash_new (32);
+  m->stks = copy_stacks (stks, M);
+  m->pairs = list_new ();
+  phash_iter_init (M, &it);
+  while ((b = phash_iter_next (M, &it))) {
+    list_append (m->pairs, b->v);
+  }
+  phash_free (M);
+}
+
+/*
+ * Add a memo for stks. If the stacks are still waiting for the
+ * search, the copy is made once the search is done.
+ */
+static stk_memo *stk_cache_add (RawActStackPass *sp, stk_shape *s,
+				list_t *stks, bool pending)
+{
+  stk_cache *c = stk_cache_get (sp);
+  stk_memo *m;
+
+  m = new stk_memo;
+  m->shape = s;
+  for (node_t *n : s->nodes) {
+    m->contact.push_back (n->contact);
+  }
+  for (edge_t *e : s->edges) {
+    m->visited.push_back (e->visited);
+  }
+  m->stks = NULL;
+  m->pairs = NULL;
+  if (!pending) {
+    stk_cache_fill (m, stks);
+  }
+  c->tab.insert (std::make_pair (s->hash, m));
+  return m;
+}
+
+static void free_raw_stacks (list_t *stks);
+
+/*
+ * Run all the pending stack searches using up to "jobs" threads, and
+ * then complete the pending stacks in traversal order. The result
+ * does not depend on the number of threads.
+ */
+static void stk_search_flush (RawActStackPass *sp, int jobs)
+{
+  stk_cache *c = sp->getCache ();
+  std::vector<raw_search *> all;
+
+  if (!c || c->pending.empty()) {
+    return;
+  }
+  for (stk_pending *pd : c->pending) {
+    for (int k=0; k < 2; k++) {
+      if (pd->S[k]) {
+	all.push_back (pd->S[k]);
+      }
+    }
+  }
+
+  std::atomic<int> next (0);
+  int n = all.size();
+  auto work = [&] () {
+    int i;
+    while ((i = next++) < n) {
+      raw_search_run (all[i]);
+    }
+  };
+  if (jobs > n) {
+    jobs = n;
+  }
+  std::vector<std::thread> threads;
+  for (int i=1; i < jobs; i++) {
+    threads.emplace_back (work);
+  }
+  work ();
+  for (auto &t : threads) {
+    t.join ();
+  }
+
+  for (stk_pending *pd : c->pending) {
+    if (!pd->shape) {
+      /* raw stacks are the second and third entries */
+      listitem_t *li = list_next (list_first (pd->ret));
+      for (int k=0; k < 2; k++) {
+	if (pd->S[k]) {
+	  list_t *better = raw_search_result (pd->S[k]);
+	  if (better) {
+	    free_raw_stacks ((list_t *) list_value (li));
+	    list_value (li) = better;
+	  }
+	  delete pd->S[k];
+	}
+	li = list_next (li);
+      }
+      stk_cache_fill (pd->m, pd->ret);
+    }
+    else {
+      listitem_t *li, *mi;
+      list_t *tmp = stk_cache_replay (pd->m, pd->shape);
+      for (li = list_first (pd->ret), mi = list_first (tmp); li;
+	   li = list_next (li), mi = list_next (mi)) {
+	list_value (li) = list_value (mi);
+      }
+      list_free (tmp);
+      delete pd->shape;
+    }
+    delete pd;
+  }
+  c->pending.clear ();
+}
+
+static void free_raw_stacks (list_t *stks)
+{
+  listitem_t *li;
+  if (!stks) return;
+  for (li = list_first (stks); li; li = list_next (li)) {
+    list_free ((list_t *) list_value (li));
+  }
+  list_free (stks);
+}
+
+RawActStackPass::~RawActStackPass ()
+{
+  if (procs) {
+    list_free (procs);
+  }
+  if (!cache) {
+    return;
+  }
+  /* searches that never ran */
+  for (stk_pending *pd : cache->pending) {
+    for (int k=0; k < 2; k++) {
+      if (pd->S[k]) {
+	delete pd->S[k];
+      }
+    }
+    if (pd->shape) {
+      delete pd->shape;
+    }
+    delete pd;
+  }
+  for (auto &x : cache->tab) {
+    stk_memo *m = x.second;
+    listitem_t *li;
+
+    if (!m->stks) {
+      delete m->shape;
+      delete m;
+      continue;
+    }
+    for (li = list_first (m->pairs); li; li = list_next (li)) {
+      delete_pair ((struct gate_pairs *) list_value (li));
+    }
+    list_free (m->pairs);
+    li = list_first (m->stks);
+    list_free ((list_t *) list_value (li));
+    li = list_next (li);
+    free_raw_stacks ((list_t *) list_value (li));
+    li = list_next (li);
+    free_raw_stacks ((list_t *) list_value (li));
+    list_free (m->stks);
+    delete m->shape;
+    delete m;
+  }
+  delete cache;
+}
+
+
 void stk_init (ActPass *a)
 {
   ActNetlistPass *nl = NULL;
@@ -678,9 +1467,18 @@ void stk_init (ActPass *a)
   dp->setParam ("raw", (void *)_sp);
 }
   
-void stk_run (ActPass *ap, Process *p)
+void stk_run (ActPass *_ap, Process *p)
 {
-  /* nothing to do */
+  ActDynamicPass *ap = dynamic_cast<ActDynamicPass *> (_ap);
+  RawActStackPass *_sp = (RawActStackPass *)ap->getPtrParam ("raw");
+  int jobs = 1;
+  Assert (_sp, "What?");
+
+  /* the traversal is done; run the stack searches */
+  if (ap->hasParam ("jobs")) {
+    jobs = ap->getIntParam ("jobs");
+  }
+  stk_search_flush (_sp, jobs);
 }
 
 void stk_recursive (ActPass *ap, Process *p, int mode)
@@ -698,6 +1496,10 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   netlist_t *N = _sp->getNL (p);
   Assert (N, "What?");
 
+  if (p) {
+    _sp->addProc (p);
+  }
+
   node_t *n;
   list_t *pnodes, *nnodes;
   listitem_t *li, *mi;
@@ -724,6 +1526,33 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     }
   }
 
+  /* reuse the stacks of an identical netlist, if any */
+  stk_shape *shape = netlist_shape (N);
+  stk_memo *memo = stk_cache_find (_sp, shape);
+  if (memo) {
+    list_t *ret;
+    stk_cache_restore (memo, shape);
+    if (memo->stks) {
+      ret = stk_cache_replay (memo, shape);
+      delete shape;
+    }
+    else {
+      /* filled in once the search for the memo is done */
+      stk_pending *pd = new stk_pending;
+      ret = list_new ();
+      list_append (ret, NULL);
+      list_append (ret, NULL);
+      list_append (ret, NULL);
+      pd->ret = ret;
+      pd->S[0] = NULL;
+      pd->S[1] = NULL;
+      pd->m = memo;
+      pd->shape = shape;
+      stk_cache_get (_sp)->pending.push_back (pd);
+    }
+    return ret;
+  }
+
   /* nodes to be processed */
   pnodes = list_new ();
   nnodes = list_new ();
@@ -779,11 +1608,11 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	     min(degree of vertex, # of edges/2)
   */
 
-  Heap *pairs;
-  Heap *final;
+  struct pair_heap *pairs;
+  struct pair_heap *final;
   list_t *rawpairs;
 
-  pairs = heap_new (32);
+  pairs = pairs_new ();
   rawpairs = list_new ();
 
 #if 0
@@ -861,7 +1690,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 
 	    /* see if we can find this in the heap */
 	    if (!find_pairs (pairs, p)) {
-	      heap_insert (pairs, maxedges-COST(p), p);
+	      pairs_insert (pairs, maxedges-COST(p), p);
 	      list_append (rawpairs, p);
 #if 0
 	      dump_pair (N, p);
@@ -871,7 +1700,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	      delete_pair (p);
 	    }
 	    if (p2 && !find_pairs (pairs, p2)) {
-	      heap_insert (pairs, maxedges-COST(p2), p2);
+	      pairs_insert (pairs, maxedges-COST(p2), p2);
 	      list_append (rawpairs, p2);
 #if 0
 	      dump_pair (N, p);
@@ -891,15 +1720,15 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
      to fet chains of length 1.
   */
 
-  final = heap_new (32);
+  final = pairs_new ();
   int found = 1;
-  while (heap_size (pairs) > 0) {
+  while (heap_size (pairs->h) > 0) {
     struct gate_pairs *gp;
 
     found  = 0;
     /* for each element of the heap, attempt to extend the size using
        one of the pairs */
-    gp = (struct gate_pairs *) heap_remove_min (pairs);
+    gp = pairs_remove_min (pairs);
 #if 0
     /* XXX: need to prune the search tree */
     printf ("looking-at:\n");
@@ -983,7 +1812,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 	  }
 	  found = 1;
 	  if (!find_pairs (pairs, gnew)) {
-	    heap_insert (pairs, maxedges - COST(gnew), gnew);
+	    pairs_insert (pairs, maxedges - COST(gnew), gnew);
 #if 0
 	    printf ("new-pair: ");
 	    dump_pair (N, gnew);
@@ -1014,7 +1843,7 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     }
 
     if (!found && !find_pairs (final, gp)) {
-      heap_insert (final, maxedges - COST(gp), gp);
+      pairs_insert (final, maxedges - COST(gp), gp);
     }
     else {
       if (!gp->basepair) {
@@ -1035,10 +1864,10 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
 #if 0
   printf ("-- candidates ---\n");
 #endif    
-  while (heap_size (final) > 0) {
+  while (heap_size (final->h) > 0) {
     struct gate_pairs *gp;
     
-    gp = (struct gate_pairs *) heap_remove_min (final);
+    gp = pairs_remove_min (final);
 
 #if 0
     dump_pair (N, gp);
@@ -1064,6 +1893,8 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
     }
   }
   list_free (rawpairs);
+  pairs_free (pairs);
+  pairs_free (final);
   
   /*-- stks has the final candidate stacks.
     Now we add the remaining edges where possible, stitching together
@@ -1124,14 +1955,24 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   list_free (pnodes);
   pnodes = tmplist;
 
+  /* optional search for better stacks, with a budget of
+     lefdef.stack_search steps for each stack type. The searches are
+     run by stk_run after the traversal, so that different cells can
+     be searched in parallel. */
+  long budget = 0;
+  if (config_exists ("lefdef.stack_search")) {
+    budget = config_get_int ("lefdef.stack_search");
+  }
+
   list_t *stk_n = NULL, *stk_p = NULL;
+  raw_search *S[2] = { NULL, NULL };
   if (list_length (nnodes) > 0) {
-    stk_n = compute_raw_stacks (N, nnodes, EDGE_NFET);
+    stk_n = compute_raw_stacks (nnodes, EDGE_NFET, budget, &S[0]);
   }
-  list_free (nnodes);
   if (list_length (pnodes) > 0) {
-    stk_p = compute_raw_stacks (N, pnodes, EDGE_PFET);
+    stk_p = compute_raw_stacks (pnodes, EDGE_PFET, budget, &S[1]);
   }
+  list_free (nnodes);
   list_free (pnodes);
   
   list_t *retlist;
@@ -1140,6 +1981,17 @@ void *stk_proc (ActPass *_ap, Process *p, int mode)
   list_append (retlist, stk_n);
   list_append (retlist, stk_p);
 
+  memo = stk_cache_add (_sp, shape, retlist, (S[0] || S[1]));
+  if (S[0] || S[1]) {
+    stk_pending *pd = new stk_pending;
+    pd->ret = retlist;
+    pd->S[0] = S[0];
+    pd->S[1] = S[1];
+    pd->m = memo;
+    pd->shape = NULL;
+    stk_cache_get (_sp)->pending.push_back (pd);
+  }
+
   return retlist;
 }
 
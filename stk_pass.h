@@ -66,9 +66,12 @@ struct gate_pairs {
   int available_mark ();
 };
 
+struct stk_cache;
+
 class RawActStackPass {
 public:
-  RawActStackPass (ActPass *p) { me = p; }
+  RawActStackPass (ActPass *p) { me = p; cache = NULL; procs = NULL; }
+  ~RawActStackPass ();
   
   int isEmpty (list_t *stk);
   list_t *getStacks (Process *p = NULL);
@@ -78,9 +81,21 @@ public:
   void *getMap (Process *p) { return me->getMap (p); }
   ActPass *getPass () { return me; }
 
+  struct stk_cache *getCache () { return cache; }
+  void setCache (struct stk_cache *c) { cache = c; }
+
+  /* processes visited by the pass, in traversal order */
+  list_t *getProcs () { return procs; }
+  void addProc (Process *p) {
+    if (!procs) { procs = list_new (); }
+    list_append (procs, p);
+  }
+
 private:
   ActNetlistPass *nl;
   ActPass *me;
+  struct stk_cache *cache;	// stacks for netlists seen so far
+  list_t *procs;		// processes visited
 };
 
 extern "C" {
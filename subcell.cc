@@ -19,251 +19,442 @@
  *
  **************************************************************************
  */
+#include <math.h>
+#include <algorithm>
 #include "subcell.h"
 
+// Maximum fanout of the R-tree
 int LayerSubcell::subcell_level_threshold = 10;
 
 // This must be always larger than subcell_level_threshold
 int LayerSubcell::subcell_recompute_threshold = 200;
 
-void LayerSubcell::addSubcell (SubcellInst *s)
+static struct subcell_rnode *_rnode_new (int leaf, int max)
 {
-  const Rectangle &r = s->getBBox ();
-  Assert (_region.contains (r), "What?");
-  if (_bbox.empty()) {
-    _computeBBox();
-  }
-  _bbox = _bbox ^ r;
-  if (_leq || _gt) {
-    if (_leq->_splitx) {
-      if (_splitval < r.llx()) {
-	_gt->addSubcell (s);
-      }
-      else if (r.urx() <= _splitval) {
-	_leq->addSubcell (s);
-      }
-      else {
-	// add to this level
-	_levelcount++;
-	if (!_lst) {
-	  _lst = new SubcellList (s);
-	}
-	else {
-	  _lst->append (s, _splitx == 1 ? true : false);
-	}
+  struct subcell_rnode *x;
+  NEW (x, struct subcell_rnode);
+  x->leaf = leaf ? 1 : 0;
+  x->n = 0;
+  x->max = max;
+  x->up = NULL;
+  x->e = new subcell_rent[max+1];
+  return x;
+}
+
+static void _rnode_free (struct subcell_rnode *x, bool cells)
+{
+  for (int i=0; i < x->n; i++) {
+    if (x->leaf) {
+      if (cells) {
+	delete x->e[i].u.c;
       }
     }
     else {
-      if (_splitval < r.lly()) {
-	_gt->addSubcell (s);
-      }
-      else if (r.ury() <= _splitval) {
-	_leq->addSubcell (s);
-      }
-      else {
-	_levelcount++;
-	if (!_lst) {
-	  _lst = new SubcellList (s);
-	}
-	else {
-	  _lst->append (s, _splitx == 1 ? true : false);
-	}
-      }
+      _rnode_free (x->e[i].u.n, cells);
     }
-    if (_levelcount > subcell_level_threshold) {
-      if (!_leq && !_gt) {
-	// find an x-split, and find a y-split
-	SubcellList *tmp;
-	double x_mean, y_mean;
-	x_mean = 0;
-	y_mean = 0;
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  x_mean += (c->getBBox().llx() + c->getBBox().urx())/2;
-	  y_mean += (c->getBBox().lly() + c->getBBox().ury())/2;
-	}
-	x_mean /= _levelcount;
-	y_mean /= _levelcount;
-
-	int x_count_left, y_count_left;
-	x_count_left = 0;
-	y_count_left = 0;
-
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  if (c->getBBox().urx() <= (long)x_mean) {
-	    x_count_left++;
-	  }
-	  if (c->getBBox().ury() <= (long)y_mean) {
-	    y_count_left++;
-	  }
-	}
-#ifndef ABS
-#define ABS(a) ((a) < 0 ? -(a) : (a))
-#endif
-	unsigned int x_gap, y_gap;
-	x_gap = ABS(_levelcount/2-x_count_left);
-	y_gap = ABS(_levelcount/2-y_count_left);
-
-
-	// create left, right sub-trees
-	if (x_gap < y_gap || (x_gap == y_gap && _splitx == 0)) {
-	  _leq = new LayerSubcell (true);
-	  _gt = new LayerSubcell (true);
-	  _splitval = x_mean;
-
-	  // split in the x direction. 
-	  Rectangle r = _region;
-	  r.setXMax (_splitval);
-	  _leq->setRegion (r);
-	  r = _region;
-	  r.setXMin (_splitval+1);
-	  _gt->setRegion (r);
-	}
-	else {
-	  _splitval = y_mean;
-	  _leq = new LayerSubcell (false);
-	  _gt = new LayerSubcell (false);
-
-	  // split in the y direction
-	  Rectangle r = _region;
-	  r.setYMax (_splitval);
-	  _leq->setRegion (r);
-	  r = _region;
-	  r.setYMin (_splitval+1);
-	  _gt->setRegion (r);
-	}
-	SubcellList *newlst = NULL;
-	for (tmp = _lst; tmp; tmp = tmp->getNext()) {
-	  SubcellInst *c = tmp->getCell();
-	  if (_leq->_splitx) {
-	    if (c->getBBox().urx() <= _splitval) {
-	      _leq->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	    else if (c->getBBox().llx() > _splitval) {
-	      _gt->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	  }
-	  else {
-	    if (c->getBBox().ury() <= _splitval) {
-	      _leq->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	    else if (c->getBBox().lly() > _splitval) {
-	      _gt->addSubcell (c);
-	      tmp->clearCell();
-	      _levelcount--;
-	    }
-	  }
-	}
-	// now delete the subcell that were moved out
-	_lst = _lst->flushClear ();
-      }
-      else if (_levelcount > subcell_recompute_threshold) {
-	// XXX: fixme: re-partition data structure
-      }
+  }
+  delete [] x->e;
+  FREE (x);
+}
+
+/*
+ * Set entry e to point to node x, and recompute its boxes from the
+ * entries of x (not the entire subtree).
+ */
+static void _rnode_cover (struct subcell_rnode *x, struct subcell_rent &e)
+{
+  e.bbox.clear ();
+  e.bloatbbox.clear ();
+  e.abutbox.clear ();
+  for (int i=0; i < x->n; i++) {
+    e.bbox = e.bbox ^ x->e[i].bbox;
+    e.bloatbbox = e.bloatbbox ^ x->e[i].bloatbbox;
+    e.abutbox = e.abutbox ^ x->e[i].abutbox;
+  }
+  e.u.n = x;
+}
+
+static void _rent_extend (struct subcell_rent &to,
+			  const struct subcell_rent &from)
+{
+  to.bbox = to.bbox ^ from.bbox;
+  to.bloatbbox = to.bloatbbox ^ from.bloatbbox;
+  to.abutbox = to.abutbox ^ from.abutbox;
+}
+
+static void _rent_cell (struct subcell_rent &e, SubcellInst *s)
+{
+  e.bbox = s->getBBox ();
+  e.bloatbbox = s->getBloatBBox ();
+  e.abutbox = s->getAbutBox ();
+  e.u.c = s;
+}
+
+/* index of x in its parent */
+static int _rnode_slot (struct subcell_rnode *x)
+{
+  struct subcell_rnode *p = x->up;
+  for (int i=0; i < p->n; i++) {
+    if (p->e[i].u.n == x) {
+      return i;
     }
   }
+  Assert (0, "What?");
+  return -1;
 }
-  
 
-void LayerSubcell::delSubcell (SubcellInst *s)
+static double _rarea (const Rectangle &r)
 {
-  const Rectangle &r = s->getBBox ();
-  Assert (_region.contains (r), "What?");
-  _bbox.clear ();
-  _bloatbbox.clear();
-  if (_leq || _gt) {
-    if (_splitx) {
-      if (_splitval < r.llx()) {
-	_gt->delSubcell (s);
-      }
-      else if (r.urx() <= _splitval) {
-	_leq->delSubcell (s);
-      }
-      else {
-	_levelcount--;
-	Assert (_lst, "What?");
-	_lst->del (s);
-	if (_levelcount == 0) {
-	  delete _lst;
-	  _lst = NULL;
+  if (r.empty()) {
+    return 0;
+  }
+  return (double)r.wx()*(double)r.wy();
+}
+
+static bool _rent_cmpx (const struct subcell_rent &a,
+			const struct subcell_rent &b)
+{
+  return (a.bbox.llx() + a.bbox.urx()) < (b.bbox.llx() + b.bbox.urx());
+}
+
+static bool _rent_cmpy (const struct subcell_rent &a,
+			const struct subcell_rent &b)
+{
+  return (a.bbox.lly() + a.bbox.ury()) < (b.bbox.lly() + b.bbox.ury());
+}
+
+
+LayerSubcell::~LayerSubcell ()
+{
+  if (_root) {
+    _rnode_free (_root, true);
+  }
+}
+
+/*
+ * STR bulk load: sort the entries along the primary axis, cut them
+ * into sqrt(#nodes) vertical slices, sort each slice along the other
+ * axis, and pack consecutive runs into nodes. Repeat one level up
+ * until there is a single node left.
+ */
+void LayerSubcell::_pack (int n, struct subcell_rent *e)
+{
+  int M = subcell_level_threshold;
+  struct subcell_rent *cur = e;
+  int cn = n;
+  int leaf = 1;
+
+  Assert (!_root && n > 0, "What?");
+
+  while (1) {
+    int P = (cn + M - 1)/M;
+    int S = (int) ceil (sqrt ((double)P));
+    int slice = S*M;
+    struct subcell_rent *nxt;
+    int nn;
+
+    std::sort (cur, cur + cn, _sortx ? _rent_cmpx : _rent_cmpy);
+    for (int i=0; i < cn; i += slice) {
+      int k = MIN (slice, cn - i);
+      std::sort (cur + i, cur + i + k, _sortx ? _rent_cmpy : _rent_cmpx);
+    }
+
+    nxt = new subcell_rent[P];
+    nn = 0;
+    for (int i=0; i < cn; i += M) {
+      struct subcell_rnode *x = _rnode_new (leaf, M);
+      for (int j=i; j < cn && j < i + M; j++) {
+	x->e[x->n++] = cur[j];
+	if (!leaf) {
+	  cur[j].u.n->up = x;
 	}
       }
+      _rnode_cover (x, nxt[nn++]);
+    }
+    if (cur != e) {
+      delete [] cur;
+    }
+    cur = nxt;
+    cn = nn;
+    leaf = 0;
+    if (cn == 1) {
+      break;
+    }
+  }
+  _root = cur[0].u.n;
+  _root->up = NULL;
+  delete [] cur;
+  _dirty = 0;
+}
+
+void LayerSubcell::_collect (struct subcell_rnode *x,
+			     struct subcell_rent *e, int *n)
+{
+  for (int i=0; i < x->n; i++) {
+    if (x->leaf) {
+      e[(*n)++] = x->e[i];
     }
     else {
-      if (_splitval < r.lly()) {
-	_gt->addSubcell (s);
+      _collect (x->e[i].u.n, e, n);
+    }
+  }
+}
+
+void LayerSubcell::_repack ()
+{
+  struct subcell_rent *e;
+  int n;
+
+  if (!_root) {
+    return;
+  }
+  e = new subcell_rent[_count];
+  n = 0;
+  _collect (_root, e, &n);
+  Assert (n == _count, "What?");
+  _rnode_free (_root, false);
+  _root = NULL;
+  if (n > 0) {
+    _pack (n, e);
+  }
+  delete [] e;
+}
+
+void LayerSubcell::bulkLoad (int n, SubcellInst **s)
+{
+  struct subcell_rent *e;
+  int k;
+
+  if (n <= 0) {
+    return;
+  }
+  e = new subcell_rent[_count + n];
+  k = 0;
+  if (_root) {
+    _collect (_root, e, &k);
+    _rnode_free (_root, false);
+    _root = NULL;
+  }
+  for (int i=0; i < n; i++) {
+    _rent_cell (e[k], s[i]);
+    Assert (_region.contains (e[k].bbox), "What?");
+    k++;
+  }
+  _count = k;
+  _pack (k, e);
+  delete [] e;
+}
+
+/*
+ * Split an overflowing node in half along the axis with the larger
+ * spread, and propagate upward.
+ */
+void LayerSubcell::_split (struct subcell_rnode *x)
+{
+  struct subcell_rnode *y, *p;
+  long xmin, xmax, ymin, ymax;
+  int half;
+
+  xmin = MAX_VALUE;
+  xmax = MIN_VALUE;
+  ymin = MAX_VALUE;
+  ymax = MIN_VALUE;
+  for (int i=0; i < x->n; i++) {
+    long cx = (x->e[i].bbox.llx() + x->e[i].bbox.urx())/2;
+    long cy = (x->e[i].bbox.lly() + x->e[i].bbox.ury())/2;
+    xmin = MIN (xmin, cx);
+    xmax = MAX (xmax, cx);
+    ymin = MIN (ymin, cy);
+    ymax = MAX (ymax, cy);
+  }
+  if ((xmax - xmin) >= (ymax - ymin)) {
+    std::sort (x->e, x->e + x->n, _rent_cmpx);
+  }
+  else {
+    std::sort (x->e, x->e + x->n, _rent_cmpy);
+  }
+
+  y = _rnode_new (x->leaf, x->max);
+  half = x->n/2;
+  for (int i=half; i < x->n; i++) {
+    y->e[y->n] = x->e[i];
+    if (!y->leaf) {
+      y->e[y->n].u.n->up = y;
+    }
+    y->n++;
+  }
+  x->n = half;
+
+  if (!x->up) {
+    p = _rnode_new (0, MAX (subcell_level_threshold, 2));
+    _rnode_cover (x, p->e[0]);
+    _rnode_cover (y, p->e[1]);
+    p->n = 2;
+    x->up = p;
+    y->up = p;
+    _root = p;
+  }
+  else {
+    p = x->up;
+    _rnode_cover (x, p->e[_rnode_slot (x)]);
+    y->up = p;
+    _rnode_cover (y, p->e[p->n++]);
+    if (p->n > p->max) {
+      _split (p);
+    }
+  }
+}
+
+void LayerSubcell::_insert (struct subcell_rent &e)
+{
+  struct subcell_rnode *x;
+
+  if (!_root) {
+    _root = _rnode_new (1, subcell_level_threshold);
+  }
+  x = _root;
+  while (!x->leaf) {
+    // pick the child that needs the least enlargement
+    int best = 0;
+    double best_inc = 0, best_area = 0;
+    for (int i=0; i < x->n; i++) {
+      double a = _rarea (x->e[i].bbox);
+      double inc = _rarea (x->e[i].bbox ^ e.bbox) - a;
+      if (i == 0 || inc < best_inc || (inc == best_inc && a < best_area)) {
+	best = i;
+	best_inc = inc;
+	best_area = a;
       }
-      else if (r.ury() <= _splitval) {
-	_leq->addSubcell (s);
+    }
+    _rent_extend (x->e[best], e);
+    x = x->e[best].u.n;
+  }
+  x->e[x->n++] = e;
+  if (x->n > x->max) {
+    _split (x);
+  }
+}
+
+void LayerSubcell::addSubcell (SubcellInst *s)
+{
+  struct subcell_rent e;
+
+  _rent_cell (e, s);
+  Assert (_region.contains (e.bbox), "What?");
+  _insert (e);
+  _count++;
+  _dirty++;
+
+  // incremental inserts degrade the tree; re-pack once they
+  // dominate
+  if (_dirty > subcell_recompute_threshold && _dirty > _count/2) {
+    _repack ();
+  }
+}
+
+bool LayerSubcell::_find (struct subcell_rnode *x, SubcellInst *s,
+			  const Rectangle *r,
+			  struct subcell_rnode **leaf, int *idx)
+{
+  for (int i=0; i < x->n; i++) {
+    if (x->leaf) {
+      if (x->e[i].u.c == s) {
+	*leaf = x;
+	*idx = i;
+	return true;
       }
-      else {
-	_levelcount--;
-	Assert (_lst, "What?");
-	_lst->del (s);
-	if (_levelcount == 0) {
-	  delete _lst;
-	  _lst = NULL;
-	}
+    }
+    else if (!r || x->e[i].bbox.contains (*r)) {
+      if (_find (x->e[i].u.n, s, r, leaf, idx)) {
+	return true;
       }
     }
   }
+  return false;
 }
 
+void LayerSubcell::delSubcell (SubcellInst *s)
+{
+  struct subcell_rnode *x, *p;
+  int idx;
 
+  if (!_root) {
+    return;
+  }
 
+  Rectangle r = s->getBBox ();
+  Assert (_region.contains (r), "What?");
 
-void LayerSubcell::_computeBBox ()
-{
-  SubcellList *l;
-  _bbox.clear ();
-  _bloatbbox.clear ();
-  _abutbox.clear ();
-  for (l = _lst; l; l = _lst->getNext()) {
-    _bbox = _bbox ^ l->getCell()->getBBox ();
-    _bloatbbox = _bloatbbox ^ l->getCell()->getBloatBBox();
-    _abutbox = _abutbox ^ l->getCell()->getAbutBox ();
+  if (!_find (_root, s, &r, &x, &idx)) {
+    // the bbox of the subcell may have changed since it was added
+    if (!_find (_root, s, NULL, &x, &idx)) {
+      return;
+    }
   }
-  if (_leq) {
-    _bbox = _bbox ^ _leq->getBBox();
-    _bloatbbox = _bloatbbox ^ _leq->getBloatBBox();
-    _abutbox = _abutbox ^ _leq->getAbutBox();
+  x->e[idx] = x->e[--x->n];
+  delete s;
+  _count--;
+
+  // fix up boxes along the path to the root, dropping empty nodes
+  while (x->up) {
+    p = x->up;
+    int k = _rnode_slot (x);
+    if (x->n == 0) {
+      p->e[k] = p->e[--p->n];
+      _rnode_free (x, false);
+    }
+    else {
+      _rnode_cover (x, p->e[k]);
+    }
+    x = p;
+  }
+
+  while (!_root->leaf && _root->n == 1) {
+    x = _root->e[0].u.n;
+    x->up = NULL;
+    _root->n = 0;
+    _rnode_free (_root, false);
+    _root = x;
   }
-  if (_gt) {
-    _bbox = _bbox ^ _gt->getBBox();
-    _bloatbbox = _bloatbbox ^ _gt->getBloatBBox();
-    _abutbox = _abutbox ^ _gt->getAbutBox();
+  if (_root->n == 0) {
+    _rnode_free (_root, false);
+    _root = NULL;
+    _dirty = 0;
   }
 }
 
+
 Rectangle LayerSubcell::getBBox ()
 {
-  if (_bbox.empty()) {
-    _computeBBox();
+  Rectangle r;
+  if (_root) {
+    for (int i=0; i < _root->n; i++) {
+      r = r ^ _root->e[i].bbox;
+    }
   }
-  return _bbox;
+  return r;
 }
 
 Rectangle LayerSubcell::getBloatBBox ()
 {
-  if (_bloatbbox.empty()) {
-    _computeBBox();
+  Rectangle r;
+  if (_root) {
+    for (int i=0; i < _root->n; i++) {
+      r = r ^ _root->e[i].bloatbbox;
+    }
   }
-  return _bloatbbox;
+  return r;
 }
 
 Rectangle LayerSubcell::getAbutBox ()
 {
-  if (_bbox.empty()) {
-    _computeBBox();
+  Rectangle r;
+  if (_root) {
+    for (int i=0; i < _root->n; i++) {
+      r = r ^ _root->e[i].abutbox;
+    }
   }
-  return _abutbox;
+  return r;
 }
 
 
@@ -272,6 +463,8 @@ SubcellInst::SubcellInst (LayoutBlob *b, const char *id, const char *name,
 {
   _nx = 1;
   _ny = 1;
+  _px = 0;
+  _py = 0;
   _b = b;
   _uid = id;
   _name = name;
@@ -300,62 +493,64 @@ LayoutEdgeAttrib *SubcellInst::getLayoutEdgeAttrib ()
   return le;
 }
 
-Rectangle SubcellInst::getBBox()
+/*
+ * Box of the array, given the box r of the master in its own
+ * coordinates: the box of element (0,0), stretched by the extent of
+ * the array.
+ */
+Rectangle SubcellInst::_arrayBox (const Rectangle &r)
 {
-  Assert (0, "What?");
+  Rectangle b = _m.applyBox (r);
+  long llx, lly, urx, ury;
+  long dx, dy;
 
+  if (b.empty()) {
+    return b;
+  }
+  llx = b.llx();
+  lly = b.lly();
+  urx = b.urx();
+  ury = b.ury();
+
+  dx = (long)(_nx - 1)*_px;
+  dy = (long)(_ny - 1)*_py;
+  if (dx < 0) {
+    llx += dx;
+  }
+  else {
+    urx += dx;
+  }
+  if (dy < 0) {
+    lly += dy;
+  }
+  else {
+    ury += dy;
+  }
+  b.setRectCoords (llx, lly, urx, ury);
+  return b;
+}
+
+Rectangle SubcellInst::getBBox()
+{
   Rectangle r;
   if (!_b) {
     return r;
   }
-  r = _b->getBBox ();
-  Rectangle a = _b->getAbutBox ();
-  if (a.empty()) {
-    a = r;
-  }
-
-  // XXX: this is wrong
-
-  long fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
-  long fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
-
-  r.setRectCoords (r.llx(), r.lly(), r.llx() + a.wx()*_nx + fringex,
-		   r.lly() + a.wy()*_ny + fringey);
-
-  return r;
+  return _arrayBox (_b->getBBox ());
 }
 
 Rectangle SubcellInst::getBloatBBox()
 {
-  Assert (0, "What?");
-
   Rectangle r;
   if (!_b) {
     return r;
   }
-  r = _b->getBBox ();
-  Rectangle a = _b->getAbutBox ();
-  if (a.empty()) {
-    a = r;
-  }
-  r = _b->getBloatBBox ();
-
-  // XXX: this is wrong
-
-  long fringex = (a.llx() - r.llx()) + (r.urx() - a.urx());
-  long fringey = (a.lly() - r.lly()) + (r.ury() - a.ury());
-
-  r.setRectCoords (r.llx(), r.lly(), r.llx() + a.wx()*_nx + fringex,
-		   r.lly() + a.wy()*_ny + fringey);
-
-  return r;
+  return _arrayBox (_b->getBloatBBox ());
 }
 
 
 Rectangle SubcellInst::getAbutBox ()
 {
-  Assert (0, "What?");
-
   Rectangle r;
   if (!_b) {
     return r;
@@ -364,28 +559,99 @@ Rectangle SubcellInst::getAbutBox ()
   if (r.empty()) {
     return getBBox();
   }
-  // XXX: this is wrong
-  r.setRect (r.llx(), r.lly(), r.wx()*_nx, r.wy()*_ny);
-  return r;
+  return _arrayBox (r);
+}
+
+static long _floor_div (long a, long b)
+{
+  long q = a / b;
+  if ((a % b) != 0 && a < 0) {
+    q--;
+  }
+  return q;
 }
 
+/*
+ * Range of i in [0,n-1] for which [lo + i*p, hi + i*p] overlaps
+ * [wlo, whi].
+ */
+static bool _pitch_range (long lo, long hi, long p, int n,
+			  long wlo, long whi, int *imin, int *imax)
+{
+  long a, b;
 
-void SubcellInst::PrintRect (FILE *fp, TransformMat *mat)
+  if (p == 0 || n == 1) {
+    *imin = 0;
+    *imax = n-1;
+    return !(hi < wlo || lo > whi);
+  }
+  if (p < 0) {
+    return _pitch_range (-hi, -lo, -p, n, -whi, -wlo, imin, imax);
+  }
+  a = _floor_div (whi - lo, p);
+  b = -_floor_div (hi - wlo, p);
+  if (a > n-1) {
+    a = n-1;
+  }
+  if (b < 0) {
+    b = 0;
+  }
+  if (b > a) {
+    return false;
+  }
+  *imin = b;
+  *imax = a;
+  return true;
+}
+
+bool SubcellInst::arrayRange (const Rectangle &b0, const Rectangle &w,
+			      int *xlo, int *xhi, int *ylo, int *yhi)
+{
+  if (b0.empty() || w.empty()) {
+    return false;
+  }
+  if (!_pitch_range (b0.llx(), b0.urx(), _px, _nx, w.llx(), w.urx(),
+		     xlo, xhi)) {
+    return false;
+  }
+  if (!_pitch_range (b0.lly(), b0.ury(), _py, _ny, w.lly(), w.ury(),
+		     ylo, yhi)) {
+    return false;
+  }
+  return true;
+}
+
+TransformMat SubcellInst::elementMat (int i, int j, const TransformMat *m)
+{
+  TransformMat e = _m;
+
+  e.translate ((long)i*_px, (long)j*_py);
+  if (m) {
+    e.applyMat (*m);
+  }
+  return e;
+}
+
+
+void SubcellInst::PrintRect (RectWriter *w, TransformMat *mat)
 {
   TransformMat m = _m;
-  fprintf (fp, "cell %s %s ", _name, _uid);
+  char buf[1024];
+  int len;
+
   if (mat) {
     m.applyMat (*mat);
-    m.PrintRect (fp);
+    m.sPrintRect (buf, 1024);
   }
   else {
-    fprintf (fp, "N 0 0");
+    snprintf (buf, 1024, "N 0 0");
   }
   if (_nx > 1 || _ny > 1) {
-    fprintf (fp, " arr %d %d %d %d",
-	     _nx, _px, _ny, _py);
+    len = strlen (buf);
+    snprintf (buf + len, 1024 - len, " arr %d %d %d %d",
+	      _nx, _px, _ny, _py);
   }
-  fprintf (fp, "\n");
+  w->cell (_name, _uid, buf);
 }
 
 
@@ -24,9 +24,18 @@
 
 #include "geom.h"
 
+/*
+ * An instance (or array of instances) of a master layout. The master
+ * blob is shared by all instances and all array elements, and is
+ * never modified or freed through an instance. Array element (i,j)
+ * is the master transformed by _m and then shifted by (i*_px,
+ * j*_py). No copy of the master is made per element, but the
+ * hierarchical searches and the search index return one result per
+ * element, so their cost grows with nx*ny.
+ */
 class SubcellInst {
 private:
-  LayoutBlob *_b;		//< the actual layout (subcell)
+  LayoutBlob *_b;		//< the master layout (subcell)
   TransformMat _m;		//< geometric transformations to get
 				// the tiles into global coordinates
   const char *_uid;		//< unique identifier for the subcell
@@ -34,6 +43,8 @@ private:
   int _nx, _ny;			//< array size
   int _px, _py;			//< x,y pitch
 
+  Rectangle _arrayBox (const Rectangle &r);
+
 public:
   /** We use aliases for the id and name pointers, so they should be
       persistent pointers.
@@ -45,11 +56,31 @@ public:
 
   LayoutEdgeAttrib *getLayoutEdgeAttrib ();
 
+  LayoutBlob *getMaster () { return _b; }
+  bool isArray () { return _nx > 1 || _ny > 1; }
+
+  /* bounding boxes of the entire array */
   Rectangle getBBox();
   Rectangle getBloatBBox();
   Rectangle getAbutBox ();
 
-  void PrintRect (FILE *fp, TransformMat *mat);
+  /*
+    Given the box b0 of array element (0,0) and a window w in the
+    same coordinate frame, returns the range of array elements that
+    overlap the window. Returns false if there are none.
+  */
+  bool arrayRange (const Rectangle &b0, const Rectangle &w,
+		   int *xlo, int *xhi, int *ylo, int *yhi);
+
+  /*
+    Transform for array element (i,j): the instance transform, then
+    the shift by the pitch (in the parent's frame), then m if given.
+  */
+  TransformMat elementMat (int i, int j, const TransformMat *m = NULL);
+
+  void PrintRect (RectWriter *w, TransformMat *mat);
+
+  friend class LayoutBlob;
 };
 
 class SubcellList {
@@ -82,58 +113,88 @@ class SubcellList {
 
 
 /*
- * Recursively partition space
+ * R-tree node used by LayerSubcell. Entries in a leaf point to
+ * subcells; entries in an internal node point to child nodes. Each
+ * entry caches the bounding boxes of whatever it points to.
+ */
+struct subcell_rent {
+  Rectangle bbox, bloatbbox, abutbox;
+  union {
+    struct subcell_rnode *n;
+    SubcellInst *c;
+  } u;
+};
+
+struct subcell_rnode {
+  unsigned int leaf:1;		/* 1 if entries are subcells */
+  int n;			/* number of entries in use */
+  int max;			/* capacity (fanout when created) */
+  struct subcell_rnode *up;	/* parent node */
+  struct subcell_rent *e;	/* entries, max+1 of them */
+};
+
+
+/*
+ * Spatial index over subcells: an R-tree that can be bulk-loaded
+ * with STR (sort-tile-recursive) packing and also supports
+ * incremental insert/delete. Bounding boxes are maintained along the
+ * insert/delete path only.
  */
 class LayerSubcell {
 
  private:
-  unsigned int _splitx:1;   /* 1 if my split was in the x-direction */
-  long _splitval:62;	    /* location of split. the split
-			       coordinate is in the "_leq" box. */
+  unsigned int _sortx:1;    /* STR: sort by x first */
   Rectangle _region;	    /* owned region */
-  Rectangle _bbox;	    /* actual bounding box */
-  Rectangle _bloatbbox;	    /* bloated bbox */
-  Rectangle _abutbox;	    /* abutment box */
-  LayerSubcell *_leq, *_gt; /* split tile */
-  SubcellList *_lst;	    /* list of subcells here */
-  int _levelcount;	    /* list length */
-
-
-  void _computeBBox();
+  struct subcell_rnode *_root; /* R-tree */
+  int _count;		    /* number of subcells */
+  int _dirty;		    /* # incremental inserts since last pack */
+
+  void _pack (int n, struct subcell_rent *e);
+  void _repack ();
+  void _insert (struct subcell_rent &e);
+  void _split (struct subcell_rnode *x);
+  bool _find (struct subcell_rnode *x, SubcellInst *s,
+	      const Rectangle *r, struct subcell_rnode **leaf, int *idx);
+  void _collect (struct subcell_rnode *x, struct subcell_rent *e, int *n);
+
+  template<class F>
+  void _search (struct subcell_rnode *x, const Rectangle &r, F &f) {
+    for (int i=0; i < x->n; i++) {
+      if (x->e[i].bbox.overlaps (r)) {
+	if (x->leaf) {
+	  f (x->e[i].u.c);
+	}
+	else {
+	  _search (x->e[i].u.n, r, f);
+	}
+      }
+    }
+  }
 
  public:
 
-  static int subcell_level_threshold; // if you exceed this threshold,
-				      // then add sub-trees
+  static int subcell_level_threshold; // maximum number of entries
+				      // in an R-tree node
   
-  static int subcell_recompute_threshold; // if you exceed this
-					  // threshold, then
-					  // re-compute the entire subtree!
+  static int subcell_recompute_threshold; // after this many
+					  // incremental inserts (and at
+					  // least as many as were
+					  // packed), re-pack the entire
+					  // tree!
   
   LayerSubcell(bool sort_x = true) {
     Assert (subcell_recompute_threshold  > subcell_level_threshold, "What?");
-    _splitx = sort_x ? 1 : 0;
-    _splitval = 0;
-    _leq = NULL;
-    _gt = NULL;
-    _lst = NULL;
-    _levelcount = 0;
+    Assert (subcell_level_threshold > 1, "What?");
+    _sortx = sort_x ? 1 : 0;
+    _root = NULL;
+    _count = 0;
+    _dirty = 0;
   }
 
-  ~LayerSubcell() {
-    if (_leq) {
-      delete _leq;
-    }
-    if (_gt) {
-      delete _gt;
-    }
-    if (_lst) {
-      delete _lst;
-    }
-  }
+  ~LayerSubcell();
 
   void initGlobal() {
-    if (_leq || _gt || _lst) {
+    if (_root) {
       fatal_error ("LayerSubcell:: initGlobal() called after subcells were added!");
     }
     _region.setRect (MIN_VALUE, MIN_VALUE, MAX_VALUE, MAX_VALUE);
@@ -143,9 +204,25 @@ class LayerSubcell {
     _region = r;
   }
 
+  /* The subcell instances are owned by this structure once added */
   void addSubcell (SubcellInst *s);
   void delSubcell (SubcellInst *s);
 
+  /* Add n subcells at once, re-packing the whole tree */
+  void bulkLoad (int n, SubcellInst **s);
+
+  int numSubcells () { return _count; }
+
+  /*
+    Calls f(s) for every subcell s whose bounding box overlaps r.
+  */
+  template<class F>
+  void search (const Rectangle &r, F f) {
+    if (_root) {
+      _search (_root, r, f);
+    }
+  }
+
   Rectangle getBBox ();
   Rectangle getBloatBBox ();
   Rectangle getAbutBox();
@@ -0,0 +1,306 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <act/act.h>
+#include "../subcell.h"
+#include "unit.h"
+
+/*
+ * Checks the hierarchical searches of LayoutBlob on oriented, nested
+ * and arrayed subcells: search(net), search(type), searchAllMetal(),
+ * searchIndex() and query(). The expected geometry is computed by
+ * pushing every tile of the masters through each level of the
+ * hierarchy one step at a time, so it does not depend on how the
+ * searches compose transformation matrices. query() is then checked
+ * against a brute-force filter of the same rectangles.
+ *
+ * Needs the technology file: run from test/ with ACT_HOME set.
+ */
+
+typedef std::tuple<long, long, long, long, void *, Layer *> R;
+
+#define NNETS 6
+static char nets[NNETS];
+static int diff_attr;
+
+/* one level of placement: the instance transform, then the shift of
+   the array element */
+struct step {
+  TransformMat m;
+  long dx, dy;
+};
+
+static R mkrect (const TransformMat *m, Tile *t, Layer *l)
+{
+  long llx, lly, urx, ury, x;
+
+  m->apply (t->getllx(), t->getlly(), &llx, &lly);
+  m->apply (t->geturx(), t->getury(), &urx, &ury);
+  if (llx > urx) { x = llx; llx = urx; urx = x; }
+  if (lly > ury) { x = lly; lly = ury; ury = x; }
+  return R (llx, lly, urx, ury, t->getNet(), l);
+}
+
+/* flatten (and free) the result of a search */
+static void flatten (list_t *res, std::vector<R> &out)
+{
+  for (listitem_t *li = list_first (res); li; li = list_next (li)) {
+    struct tile_listentry *tle = (struct tile_listentry *) list_value (li);
+    for (listitem_t *xi = list_first (tle->tiles); xi; xi = list_next (xi)) {
+      Layer *l = (Layer *) list_value (xi);
+      xi = list_next (xi);
+      list_t *tiles = (list_t *) list_value (xi);
+      for (listitem_t *ti = list_first (tiles); ti; ti = list_next (ti)) {
+	out.push_back (mkrect (&tle->m, (Tile *) list_value (ti), l));
+      }
+    }
+  }
+  LayoutBlob::searchFree (res);
+}
+
+static void flatten (const struct blob_rects *r, std::vector<R> &out)
+{
+  for (int i=0; r && i < A_LEN (r->r); i++) {
+    out.push_back (R (r->r[i].llx, r->r[i].lly, r->r[i].urx, r->r[i].ury,
+		      r->r[i].t->getNet(), r->r[i].l));
+  }
+}
+
+/* push the master's rectangles through the path, innermost first */
+static void place (std::vector<R> &master, std::vector<struct step> &path,
+		   std::vector<R> &out)
+{
+  for (R r : master) {
+    long llx = std::get<0>(r), lly = std::get<1>(r);
+    long urx = std::get<2>(r), ury = std::get<3>(r);
+    for (int k = path.size()-1; k >= 0; k--) {
+      long x;
+      path[k].m.apply (llx, lly, &llx, &lly);
+      path[k].m.apply (urx, ury, &urx, &ury);
+      if (llx > urx) { x = llx; llx = urx; urx = x; }
+      if (lly > ury) { x = lly; lly = ury; ury = x; }
+      llx += path[k].dx; urx += path[k].dx;
+      lly += path[k].dy; ury += path[k].dy;
+    }
+    out.push_back (R (llx, lly, urx, ury, std::get<4>(r), std::get<5>(r)));
+  }
+}
+
+static void check (const char *msg, std::vector<R> got, std::vector<R> exp)
+{
+  std::sort (got.begin(), got.end());
+  std::sort (exp.begin(), exp.end());
+  if (got != exp) {
+    fail ("%s: %d rectangles, expected %d", msg, (int)got.size(),
+	  (int)exp.size());
+  }
+}
+
+static TransformMat orient (int o, long dx, long dy)
+{
+  TransformMat m;
+  if (o & 1) m.mirrorLR ();
+  if (o & 2) m.mirrorTB ();
+  if (o & 4) m.mirror45 ();
+  m.translate (dx, dy);
+  return m;
+}
+
+/* a leaf layout with metal and diffusion on a coarse grid, so that no
+   two rectangles touch */
+static LayoutBlob *mkleaf (std::vector<R> &rects)
+{
+  Layout *L = new Layout (NULL);
+  int nm = Technology::T->nmetals < 2 ? Technology::T->nmetals : 2;
+
+  for (int i=0; i < 4; i++) {
+    for (int j=0; j < 4; j++) {
+      int k = rnd (nm + 1);
+      void *n = &nets[rnd (NNETS)];
+      long wx = 1 + rnd (8), wy = 1 + rnd (8);
+      if (k == nm) {
+	L->DrawDiff (0, EDGE_NFET, i*10, j*10, wx, wy, n);
+      }
+      else {
+	L->DrawMetal (k, i*10, j*10, wx, wy, n);
+      }
+    }
+  }
+  LayoutBlob *b = new LayoutBlob (BLOB_BASE, L);
+  flatten (b->searchAllMetal (), rects);
+  flatten (b->search (diff_attr), rects);
+  return b;
+}
+
+static LayoutBlob *mkcell (LayoutBlob *master, TransformMat m,
+			   int nx, int px, int ny, int py)
+{
+  SubcellInst *s = new SubcellInst (master, "x", "cell", &m);
+  if (nx > 1 || ny > 1) {
+    s->mkArray (nx, px, ny, py);
+  }
+  return new LayoutBlob (s);
+}
+
+struct inst {
+  int master;			// index into the masters
+  TransformMat m;
+  int nx, px, ny, py;
+};
+
+static void run (int topo)
+{
+  std::vector<R> mrects[2];
+  LayoutBlob *leaf[2];
+  std::vector<struct inst> mid_insts;
+  std::vector<R> exp;
+  std::vector<struct step> path;
+  char msg[100];
+
+  for (int i=0; i < 2; i++) {
+    leaf[i] = mkleaf (mrects[i]);
+  }
+
+  /* mid: three oriented leaf instances, two of them arrays */
+  mid_insts.push_back ({ 0, orient (rnd (8), 50, -20), 1, 0, 1, 0 });
+  mid_insts.push_back ({ 1, orient (rnd (8), -80, 10), 3, 45, 2, 50 });
+  mid_insts.push_back ({ 0, orient (rnd (8), 0, 120), 2, 60, 1, 0 });
+
+  LayoutBlob *mid = new LayoutBlob (BLOB_LIST);
+  for (struct inst &x : mid_insts) {
+    mid->appendBlob (mkcell (leaf[x.master], x.m, x.nx, x.px, x.ny, x.py),
+		     BLOB_MERGE);
+  }
+
+  /* top: an arrayed instance of mid in orientation topo, and a leaf */
+  LayoutBlob *top = new LayoutBlob (BLOB_LIST);
+  TransformMat tm = orient (topo, 1000, -700);
+  top->appendBlob (mkcell (mid, tm, 2, 400, 2, 500), BLOB_MERGE);
+  TransformMat lm = orient (7 - topo, -300, 200);
+  top->appendBlob (mkcell (leaf[1], lm, 1, 0, 1, 0), BLOB_MERGE);
+
+  /* expected geometry */
+  for (int i=0; i < 2; i++) {
+    for (int j=0; j < 2; j++) {
+      for (struct inst &x : mid_insts) {
+	for (int a=0; a < x.nx; a++) {
+	  for (int b=0; b < x.ny; b++) {
+	    path.clear ();
+	    path.push_back ({ tm, (long)i*400, (long)j*500 });
+	    path.push_back ({ x.m, (long)a*x.px, (long)b*x.py });
+	    place (mrects[x.master], path, exp);
+	  }
+	}
+      }
+    }
+  }
+  path.clear ();
+  path.push_back ({ lm, 0, 0 });
+  place (mrects[1], path, exp);
+
+  /* searchAllMetal */
+  std::vector<R> got, want;
+  flatten (top->searchAllMetal (), got);
+  for (R r : exp) {
+    if (std::get<5>(r) != NULL && std::get<5>(r)->isMetal()) {
+      want.push_back (r);
+    }
+  }
+  snprintf (msg, 100, "orientation %d: searchAllMetal", topo);
+  check (msg, got, want);
+
+  /* search (type) and searchIndex (type) */
+  want.clear ();
+  for (R r : exp) {
+    if (!std::get<5>(r)->isMetal()) {
+      want.push_back (r);
+    }
+  }
+  got.clear ();
+  flatten (top->search (diff_attr), got);
+  snprintf (msg, 100, "orientation %d: search (type)", topo);
+  check (msg, got, want);
+  got.clear ();
+  flatten (top->searchIndex (diff_attr), got);
+  snprintf (msg, 100, "orientation %d: searchIndex (type)", topo);
+  check (msg, got, want);
+
+  /* search (net) and searchIndex (net) */
+  for (int k=0; k < NNETS; k++) {
+    want.clear ();
+    for (R r : exp) {
+      if (std::get<4>(r) == &nets[k]) {
+	want.push_back (r);
+      }
+    }
+    got.clear ();
+    flatten (top->search (&nets[k]), got);
+    snprintf (msg, 100, "orientation %d: search (net %d)", topo, k);
+    check (msg, got, want);
+    got.clear ();
+    flatten (top->searchIndex (&nets[k]), got);
+    snprintf (msg, 100, "orientation %d: searchIndex (net %d)", topo, k);
+    check (msg, got, want);
+  }
+
+  /* query: brute-force filter of the same rectangles */
+  Rectangle bb = top->getBBox ();
+  for (int k=0; k < 200; k++) {
+    Rectangle w;
+    w.setRect (bb.llx() - 20 + rnd (bb.wx() + 40),
+	       bb.lly() - 20 + rnd (bb.wy() + 40),
+	       1 + rnd (200), 1 + rnd (200));
+    got.clear ();
+    top->query (w, [&] (const struct blob_rect *r) {
+	got.push_back (R (r->llx, r->lly, r->urx, r->ury, r->t->getNet(),
+			  r->l));
+      });
+    want.clear ();
+    for (R r : exp) {
+      Rectangle x;
+      x.setRectCoords (std::get<0>(r), std::get<1>(r),
+		       std::get<2>(r), std::get<3>(r));
+      if (x.overlaps (w)) {
+	want.push_back (r);
+      }
+    }
+    snprintf (msg, 100, "orientation %d: query (%ld,%ld) -> (%ld,%ld)", topo,
+	      w.llx(), w.lly(), w.urx(), w.ury());
+    check (msg, got, want);
+  }
+}
+
+int main (int argc, char **argv)
+{
+  Act::Init (&argc, &argv, "layout:layout.conf");
+  Layout::Init ();
+
+  diff_attr = TILE_FLGS_TO_ATTR (0, EDGE_NFET, DIFF_OFFSET);
+
+  for (int o=0; o < 8; o++) {
+    run (o);
+  }
+  return report ("query");
+}
@@ -17,6 +17,11 @@ if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../act2lef.$EXT ]; then
 else
   ACTTOOL=../act2lef.$EXT
 fi
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../rectconv.$EXT ]; then
+  RECTCONV=$ACT_HOME/bin/rectconv
+else
+  RECTCONV=../rectconv.$EXT
+fi
 
 check_echo=0
 
@@ -112,6 +117,40 @@ do
 	    fi
 	    mv $i runs/gen/${file}-${i}
 	done
+	# the multi-threaded run must match the serial run exactly
+	$ACTTOOL -cnf=m.conf -j 4 -p 'test<>' -c cells.act ${file}.act > runs/${file}.act.j.stdout 2> runs/${file}.act.j.stderr
+	for i in stdout stderr
+	do
+	    if ! cmp runs/${file}.act.j.${i} runs/${file}.act.t.${i} >/dev/null 2>/dev/null
+	    then
+		if [ $ok -eq 1 ]
+		then
+		    echo
+		    myecho "** FAILED TEST ${file}.act:"
+		fi
+		myecho " -j ${i}"
+		fail=`expr $fail + 1`
+		ok=0
+	    fi
+	done
+	for i in out.lef out.def out.cell *.rect
+	do
+	    if ! cmp $i runs/gen/${file}-${i} > /dev/null 2>/dev/null
+	    then
+		if [ $ok -eq 1 ]
+		then
+		    echo
+		    myecho "** FAILED TEST ${file}.act:"
+		fi
+		myecho " -j ${i}"
+		fail=`expr $fail + 1`
+		ok=0
+		if [ ! x$ACT_TEST_VERBOSE = x ]; then
+		    diff $i runs/gen/${file}-${i}
+		fi
+	    fi
+	    rm -f $i
+	done
 	if [ $ok -eq 1 ]
 	then
 		if [ $num -eq $lim ]
@@ -132,6 +171,165 @@ then
 	echo
 fi
 
+# lefdef.tile_merge only changes how the geometry is cut into
+# rectangles: the messages, DEF and .cell output must not change
+count=0
+while [ -f ${count}.act ]
+do
+	file=${count}
+	count=`expr $count + 1`
+	$ACTTOOL -cnf=mt.conf -p 'test<>' -c cells.act ${file}.act > runs/${file}.act.m.stdout 2> runs/${file}.act.m.stderr
+	for i in stdout stderr
+	do
+	    if ! cmp runs/${file}.act.m.${i} runs/${file}.act.t.${i} >/dev/null 2>/dev/null
+	    then
+		echo "** FAILED TEST ${file}.act: tile_merge ${i}"
+		fail=`expr $fail + 1`
+	    fi
+	done
+	for i in out.def out.cell
+	do
+	    if ! cmp $i runs/gen/${file}-${i} >/dev/null 2>/dev/null
+	    then
+		echo "** FAILED TEST ${file}.act: tile_merge ${i}"
+		fail=`expr $fail + 1`
+		if [ ! x$ACT_TEST_VERBOSE = x ]; then
+		    diff $i runs/gen/${file}-${i}
+		fi
+	    fi
+	done
+	rm -f out.lef out.def out.cell *.rect
+done
+
+# lefdef.cache_dir: a "fill" run starts from an empty cache, a "hit"
+# run reads its leaf cells from the cache the previous run filled.
+# Neither, serial or with -j, may change the output.
+cache=runs/cache.$$
+(cat m.conf; echo; echo "begin lefdef"; echo "  string cache_dir \"$cache\""; echo "end") > cache.conf
+cached=0
+count=0
+while [ -f ${count}.act ]
+do
+	file=${count}
+	count=`expr $count + 1`
+	for run in fill hit fill-j hit-j
+	do
+	    case $run in
+		fill*) rm -rf $cache; mkdir $cache;;
+	    esac
+	    case $run in
+		*-j) jobs="-j 4";;
+		*) jobs=;;
+	    esac
+	    $ACTTOOL -cnf=cache.conf $jobs -p 'test<>' -c cells.act ${file}.act > runs/${file}.act.c.stdout 2> runs/${file}.act.c.stderr
+	    for i in out.lef out.def out.cell
+	    do
+		if ! cmp $i runs/${file}-${i} >/dev/null 2>/dev/null
+		then
+		    echo "** FAILED TEST ${file}.act: cache ${run} ${i}"
+		    fail=`expr $fail + 1`
+		    if [ ! x$ACT_TEST_VERBOSE = x ]; then
+			diff $i runs/${file}-${i}
+		    fi
+		fi
+	    done
+	    rm -f out.lef out.def out.cell *.rect
+	    if [ $run = fill ]
+	    then
+		n=`ls $cache | wc -l`
+		cached=`expr $cached + $n`
+	    fi
+	done
+done
+rm -rf $cache cache.conf
+if [ $cached -eq 0 ]
+then
+	echo "** FAILED TEST cache: nothing was written to the cache"
+	fail=`expr $fail + 1`
+fi
+
+# hierarchical DEF: the COMPONENTS and NETS counts must match the
+# entries that follow them, and neither -j nor tile_merge may change
+# the output
+defcount()
+{
+	awk '
+/^COMPONENTS/ { nc = $2; sec = 1; next }
+/^END COMPONENTS/ { sec = 0 }
+/^NETS/ { nn = $2; sec = 2; next }
+/^END NETS/ { sec = 0 }
+sec == 1 && /^- / { c++ }
+sec == 2 && /^- / { n++ }
+END { if (c == 0 || nc != c || n == 0 || nn != n) exit 1 }' $1
+}
+
+for t in hier
+do
+	$ACTTOOL -cnf=m.conf -p 'test<>' -c cells.act def/${t}.act > runs/def-${t}.t.stdout 2> runs/def-${t}.t.stderr
+	if ! defcount out.def
+	then
+		echo "** FAILED TEST def/${t}.act: DEF counts"
+		fail=`expr $fail + 1`
+	fi
+	for i in out.lef out.def out.cell *.rect
+	do
+	    mv $i runs/gen/def-${t}-${i}
+	done
+	$ACTTOOL -cnf=m.conf -j 4 -p 'test<>' -c cells.act def/${t}.act > runs/def-${t}.j.stdout 2> runs/def-${t}.j.stderr
+	for i in out.lef out.def out.cell *.rect
+	do
+	    if ! cmp $i runs/gen/def-${t}-${i} >/dev/null 2>/dev/null
+	    then
+		echo "** FAILED TEST def/${t}.act: -j ${i}"
+		fail=`expr $fail + 1`
+	    fi
+	    rm -f $i
+	done
+	$ACTTOOL -cnf=mt.conf -p 'test<>' -c cells.act def/${t}.act > runs/def-${t}.m.stdout 2> runs/def-${t}.m.stderr
+	for i in out.def out.cell
+	do
+	    if ! cmp $i runs/gen/def-${t}-${i} >/dev/null 2>/dev/null
+	    then
+		echo "** FAILED TEST def/${t}.act: tile_merge ${i}"
+		fail=`expr $fail + 1`
+	    fi
+	done
+	rm -f out.lef out.def out.cell *.rect
+done
+
+# .rect -> .rectb -> .rect must give back the same file, both for the
+# fixtures and for everything generated above
+for i in rect/*.rect runs/gen/*.rect
+do
+	rm -f runs/rt.rectb runs/rt.rect
+	$RECTCONV $i runs/rt.rectb > /dev/null 2>&1
+	$RECTCONV runs/rt.rectb runs/rt.rect > /dev/null 2>&1
+	if ! cmp runs/rt.rect $i >/dev/null 2>/dev/null
+	then
+		echo "** FAILED TEST rectconv: $i"
+		fail=`expr $fail + 1`
+	fi
+done
+rm -f runs/rt.rectb runs/rt.rect
+
+# unit tests (built with "make tests")
+for t in subcell tile query
+do
+	if [ -f ${t}_test.$EXT ]
+	then
+		if ! ./${t}_test.$EXT > runs/${t}_test.t.stdout 2>&1
+		then
+			echo "** FAILED TEST ${t}_test"
+			fail=`expr $fail + 1`
+			if [ ! x$ACT_TEST_VERBOSE = x ]; then
+			    cat runs/${t}_test.t.stdout
+			fi
+		fi
+	else
+		echo "(${t}_test not built; skipped)"
+	fi
+done
+
 
 if [ $fail -ne 0 ]
 then
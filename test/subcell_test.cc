@@ -0,0 +1,172 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include "../subcell.h"
+#include "unit.h"
+
+/*
+ * Checks the LayerSubcell R-tree against a brute-force scan of the
+ * same subcells: bulk load, incremental inserts (including the
+ * re-packs they trigger), deletes, and window searches. The masters
+ * are pure bounding-box blobs, so no technology file is needed.
+ */
+
+static void check_window (LayerSubcell *t, std::vector<SubcellInst *> &live,
+			  const Rectangle &w)
+{
+  std::vector<SubcellInst *> got, exp;
+
+  t->search (w, [&] (SubcellInst *s) { got.push_back (s); });
+  for (SubcellInst *s : live) {
+    if (s->getBBox().overlaps (w)) {
+      exp.push_back (s);
+    }
+  }
+  std::sort (got.begin(), got.end());
+  std::sort (exp.begin(), exp.end());
+  if (got != exp) {
+    fail ("window (%ld,%ld) -> (%ld,%ld): found %d, expected %d",
+	  w.llx(), w.lly(), w.urx(), w.ury(),
+	  (int)got.size(), (int)exp.size());
+  }
+}
+
+static void check_tree (const char *msg, LayerSubcell *t,
+			std::vector<SubcellInst *> &live)
+{
+  Rectangle bbox;
+  int nerr = errors;
+
+  if (t->numSubcells() != (int)live.size()) {
+    fail ("%s: %d subcells, expected %d", msg, t->numSubcells(),
+	  (int)live.size());
+  }
+  for (SubcellInst *s : live) {
+    bbox = bbox ^ s->getBBox ();
+  }
+  if (t->getBBox() != bbox) {
+    fail ("%s: bounding box mismatch", msg);
+  }
+  for (int i=0; i < 500; i++) {
+    Rectangle w;
+    long x = rnd (220000) - 110000;
+    long y = rnd (220000) - 110000;
+    w.setRect (x, y, 1 + rnd (20000), 1 + rnd (20000));
+    check_window (t, live, w);
+  }
+  /* everything, and a single point */
+  Rectangle all;
+  all.setRect (-200000, -200000, 400000, 400000);
+  check_window (t, live, all);
+  if (!live.empty()) {
+    Rectangle pt;
+    Rectangle b = live[0]->getBBox ();
+    pt.setRect (b.llx(), b.lly(), 1, 1);
+    check_window (t, live, pt);
+  }
+  if (errors != nerr) {
+    printf ("%s: failed\n", msg);
+  }
+}
+
+static void run (int fanout, int recompute, int n)
+{
+  std::vector<LayoutBlob *> masters;
+  std::vector<SubcellInst *> cells, live;
+  char msg[100];
+
+  LayerSubcell::subcell_level_threshold = fanout;
+  LayerSubcell::subcell_recompute_threshold = recompute;
+
+  for (int i=0; i < 20; i++) {
+    LayoutBlob *b = new LayoutBlob (BLOB_BASE);
+    b->setBBox (0, 0, rnd (2000), rnd (2000));
+    masters.push_back (b);
+  }
+
+  for (int i=0; i < n; i++) {
+    TransformMat m;
+    LayoutBlob *b = masters[rnd (masters.size())];
+    m.translate (rnd (200000) - 100000, rnd (200000) - 100000);
+    SubcellInst *s = new SubcellInst (b, "x", "cell", &m);
+    if (rnd (8) == 0) {
+      Rectangle r = b->getBBox ();
+      s->mkArray (1 + rnd (5), r.wx() + rnd (100),
+		  1 + rnd (5), r.wy() + rnd (100));
+    }
+    cells.push_back (s);
+  }
+
+  LayerSubcell *t = new LayerSubcell ();
+  t->initGlobal ();
+
+  /* half bulk-loaded, the rest inserted one at a time */
+  t->bulkLoad (n/2, cells.data());
+  live.insert (live.end(), cells.begin(), cells.begin() + n/2);
+  snprintf (msg, 100, "fanout %d: bulk load", fanout);
+  check_tree (msg, t, live);
+
+  for (int i=n/2; i < n; i++) {
+    t->addSubcell (cells[i]);
+    live.push_back (cells[i]);
+  }
+  snprintf (msg, 100, "fanout %d: insert", fanout);
+  check_tree (msg, t, live);
+
+  /* delete a third of them */
+  std::vector<SubcellInst *> keep;
+  for (int i=0; i < (int)live.size(); i++) {
+    if (i % 3 == 1) {
+      t->delSubcell (live[i]);
+    }
+    else {
+      keep.push_back (live[i]);
+    }
+  }
+  live = keep;
+  snprintf (msg, 100, "fanout %d: delete", fanout);
+  check_tree (msg, t, live);
+
+  /* ... and then the rest */
+  while (!live.empty()) {
+    t->delSubcell (live.back());
+    live.pop_back ();
+  }
+  snprintf (msg, 100, "fanout %d: empty", fanout);
+  check_tree (msg, t, live);
+
+  delete t;
+  for (LayoutBlob *b : masters) {
+    delete b;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  run (10, 200, 2000);
+  run (4, 50, 2000);
+  run (2, 3, 300);
+
+  return report ("subcell");
+}
@@ -0,0 +1,168 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <set>
+#include <common/misc.h>
+#include "../tile.h"
+#include "unit.h"
+
+/*
+ * Checks Tile::mergeStrips (lefdef.tile_merge) on random paint: the
+ * plane must describe the same region before and after the merge,
+ * and afterwards be in maximal horizontal strip form. Tiles are told
+ * apart by their net, which is all that mergeStrips compares here.
+ */
+
+#define N 48
+
+static int colors[4];
+static int grid[N][N];
+
+static void *net_of (int c)
+{
+  return c == 0 ? NULL : &colors[c];
+}
+
+/* point location using only the public stitches */
+static Tile *locate (Tile *t, long x, long y)
+{
+  while (1) {
+    while (y < t->getlly()) t = t->llyTile();
+    while (y > t->getury()) t = t->uryTile();
+    if (x < t->getllx()) {
+      t = t->llxTile();
+    }
+    else if (x > t->geturx()) {
+      t = t->urxTile();
+    }
+    else {
+      return t;
+    }
+  }
+}
+
+static void check_paint (const char *msg, Tile *root)
+{
+  for (int x=-1; x <= N; x++) {
+    for (int y=-1; y <= N; y++) {
+      int c = (x < 0 || y < 0 || x == N || y == N) ? 0 : grid[x][y];
+      if (locate (root, x, y)->getNet() != net_of (c)) {
+	fail ("%s: wrong paint at (%d,%d)", msg, x, y);
+      }
+    }
+  }
+}
+
+static void check_strips (const char *msg, Tile *root)
+{
+  std::set<Tile *> tiles;
+
+  for (int x=-1; x <= N; x++) {
+    for (int y=-1; y <= N; y++) {
+      tiles.insert (locate (root, x, y));
+    }
+  }
+  for (Tile *t : tiles) {
+    /* no same-net tile along the right edge */
+    for (Tile *r = t->urxTile(); r; r = r->llyTile()) {
+      if (r->getNet() == t->getNet()) {
+	fail ("%s: not maximal at (%ld,%ld)", msg, t->getllx(), t->getlly());
+      }
+      if (r->getlly() <= t->getlly()) break;
+    }
+    /* no same-net tile with the same x extent just above */
+    Tile *u = t->uryTile();
+    if (u && u->getllx() == t->getllx() && u->geturx() == t->geturx()
+	&& u->getNet() == t->getNet()) {
+      fail ("%s: unmerged strip at (%ld,%ld)", msg,
+	    t->getllx(), t->getlly());
+    }
+  }
+}
+
+static void run (int nrect, int maxw)
+{
+  TilePool *pool = new TilePool ();
+  Tile *root = pool->alloc ();
+  char msg[100];
+
+  for (int x=0; x < N; x++) {
+    for (int y=0; y < N; y++) {
+      grid[x][y] = 0;
+    }
+  }
+
+  for (int i=0; i < nrect; i++) {
+    long llx = rnd (N);
+    long lly = rnd (N);
+    long wx = 1 + rnd (maxw);
+    long wy = 1 + rnd (maxw);
+    int c = rnd (4);
+    Tile *t;
+
+    if (llx + wx > N) wx = N - llx;
+    if (lly + wy > N) wy = N - lly;
+
+    t = root->addRect (pool, llx, lly, wx, wy, true);
+    if (!t) {
+      fail ("addRect failed");
+      continue;
+    }
+    t->setNet (net_of (c));
+    for (long x=llx; x < llx + wx; x++) {
+      for (long y=lly; y < lly + wy; y++) {
+	grid[x][y] = c;
+      }
+    }
+  }
+
+  snprintf (msg, 100, "%d rects: paint", nrect);
+  check_paint (msg, root);
+
+  unsigned long n = pool->numTiles ();
+  root->mergeStrips (pool);
+  snprintf (msg, 100, "%d rects: merge", nrect);
+  check_paint (msg, root);
+  check_strips (msg, root);
+  if (pool->numTiles () > n) {
+    fail ("%s: %lu tiles, was %lu", msg, pool->numTiles (), n);
+  }
+
+  /* merging again is a no-op */
+  n = pool->numTiles ();
+  root->mergeStrips (pool);
+  if (pool->numTiles () != n) {
+    fail ("%d rects: second merge changed the tile count", nrect);
+  }
+
+  delete pool;
+}
+
+int main (int argc, char **argv)
+{
+  run (1, 8);
+  run (20, 16);
+  run (200, 8);
+  run (500, 4);
+
+  return report ("tile");
+}
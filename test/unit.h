@@ -0,0 +1,68 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2024 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_LAYOUT_TEST_UNIT_H__
+#define __ACT_LAYOUT_TEST_UNIT_H__
+
+#include <stdio.h>
+#include <stdarg.h>
+
+/*
+ * Helpers shared by the unit tests in this directory; each test is a
+ * single translation unit that includes this file once.
+ */
+
+static unsigned long _seed = 1;
+
+/* deterministic, so failures can be reproduced */
+static long rnd (long n)
+{
+  _seed = _seed * 6364136223846793005UL + 1442695040888963407UL;
+  return (long) ((_seed >> 33) % (unsigned long) n);
+}
+
+static int errors = 0;
+
+/* record a failure; only the first few are printed */
+static void fail (const char *fmt, ...)
+{
+  va_list ap;
+
+  if (errors++ < 10) {
+    va_start (ap, fmt);
+    vprintf (fmt, ap);
+    va_end (ap);
+    printf ("\n");
+  }
+}
+
+/* summary line; returns the exit status */
+static int report (const char *name)
+{
+  if (errors) {
+    printf ("%s: %d errors\n", name, errors);
+    return 1;
+  }
+  printf ("%s: ok\n", name);
+  return 0;
+}
+
+#endif /* __ACT_LAYOUT_TEST_UNIT_H__ */
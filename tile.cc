@@ -20,6 +20,7 @@
  **************************************************************************
  */
 #include <stdio.h>
+#include <new>
 #include <common/list.h>
 #include <common/misc.h>
 #include "tile.h"
@@ -27,6 +28,9 @@
 
 //static int tcnt = 0;
 
+thread_local unsigned long Tile::_nfind = 0;
+thread_local unsigned long Tile::_nhops = 0;
+
 Tile::Tile ()
 {
   //idx = tcnt++;
@@ -63,6 +67,66 @@ Tile::~Tile()
   attr = 0;
   net = NULL;
 }
+
+
+TilePool::TilePool ()
+{
+  _slabs = NULL;
+  _free = NULL;
+  _live = 0;
+  _peak = 0;
+  _nslabs = 0;
+}
+
+TilePool::~TilePool ()
+{
+  struct tile_slab *s;
+
+  while (_slabs) {
+    s = _slabs;
+    _slabs = _slabs->next;
+    FREE (s->t);
+    FREE (s);
+  }
+  _free = NULL;
+  _live = 0;
+}
+
+Tile *TilePool::alloc ()
+{
+  Tile *t;
+
+  if (_free) {
+    t = _free;
+    _free = t->ll.x;
+  }
+  else {
+    if (!_slabs || _slabs->used == TILE_SLAB_SIZE) {
+      struct tile_slab *s;
+      NEW (s, struct tile_slab);
+      MALLOC (s->t, Tile, TILE_SLAB_SIZE);
+      s->used = 0;
+      s->next = _slabs;
+      _slabs = s;
+      _nslabs++;
+    }
+    t = &_slabs->t[_slabs->used++];
+  }
+  _live++;
+  if (_live > _peak) {
+    _peak = _live;
+  }
+  return new (t) Tile ();
+}
+
+void TilePool::release (Tile *t)
+{
+  Assert (_live > 0, "Tile pool underflow");
+  t->~Tile ();
+  t->ll.x = _free;
+  _free = t;
+  _live--;
+}
   
 
 #define SCALE 8
@@ -138,16 +202,19 @@ Tile *Tile::find (long x, long y)
 #endif
   
   Tile *t = this;
+  unsigned long hops = 0;
   do {
     if (x < t->llx) {
       while (x < t->llx) {
 	t = t->ll.x;
+	hops++;
       }
       Assert (t->xmatch (x), "Invariant failed");
     }
     else if (!t->xmatch (x)) {
       while (x > t->geturx()) {
 	t = t->ur.x;
+	hops++;
       }
       Assert (t->xmatch (x), "Invariant failed");
     }
@@ -155,121 +222,59 @@ Tile *Tile::find (long x, long y)
     if (y < t->lly) {
       while (y < t->lly) {
 	t = t->ll.y;
+	hops++;
       }
       Assert (t->ymatch (y), "Invariant failed");
     }
     else if (!t->ymatch (y)) {
       while (y > t->getury()) {
 	t = t->ur.y;
+	hops++;
       }
       Assert (t->ymatch (y), "Invariant failed");
     }
   } while (!t->xmatch (x));
+  _nfind++;
+  _nhops += hops;
   return t;
 }
 
 
-//static int debug_apply = 0;
-
-/*
-  Returns a list of all the tiles that overlap with the specified region
-*/
-void Tile::applyTiles (long _llx, long _lly, unsigned long wx, unsigned long wy,
-		       void *cookie, void (*f) (void *, Tile *))
-
+void TileStack::_grow ()
 {
-  Tile *t;
-  list_t *frontier;
-  long _urx, _ury;
-
-  _urx = _llx + (signed long)wx - 1;
-  _ury = _lly + (signed long)wy - 1;
+  Tile **nbuf;
 
-#if 0
-  if (debug_apply) {
-    printf (" search: (%ld,%ld) -> (%ld,%ld)\n", _llx, _lly, _urx, _ury);
+  MALLOC (nbuf, Tile *, 2*_max);
+  for (unsigned int i=0; i < _n; i++) {
+    nbuf[i] = _buf[(_hd + i) & (_max - 1)];
   }
-#endif  
-
-  t = find (_llx, _lly);
-
-  frontier = list_new ();
-  list_append (frontier, t);
-
-  /* 1. create vertical wavefront */
-  while (t->getury() < _ury) {
-    t = t->find (_llx, t->getury() + 1);
-    list_append (frontier, t);
+  if (_buf != _inl) {
+    FREE (_buf);
   }
-  
-  while (!list_isempty (frontier)) {
-    Tile *tmp;
-    t = (Tile *) list_delete_tail (frontier);
+  _buf = nbuf;
+  _hd = 0;
+  _max = 2*_max;
+}
 
-#if 0
-    if (debug_apply) {
-      printf ("  :: "); t->print();
-    }
-#endif    
-    /* traverse right edge downward. 
-       if this tile might be added by someone else on the frontier,
-       done.
-       
-    */
-    tmp = t->ur.x;
-    /* right edge downward traversal */
-    while (tmp) {
-      if (_llx <= tmp->llx && tmp->llx <= _urx &&
-	  !(tmp->getury() < _lly || tmp->lly > _ury)) {
-	/* another tile might add this one if:
-	   1. it goes below t->lly
-	   2. t->lly is not at the bottom limit
-	*/
-	if (tmp->getlly() < t->lly && t->lly > _lly)
-	  break;
-	
-#if 0
-	if (debug_apply) {
-	  printf ("     -> add: "); tmp->print();
-	}
-#endif
-	list_append_head (frontier, tmp);
-      }
-      else {
-	if (!(_llx <= tmp->llx && tmp->llx <= _urx))
-	  break;
-      }
 
-      if (tmp->getlly() > t->getlly()) {
-	tmp = tmp->ll.y;
-      }
-      else {
-	tmp = NULL;
-      }
-    }
-    (*f) (cookie, t); 		/* apply function */
-  }
-  list_free (frontier);
-}
+/*
+  Applies f to all the tiles that overlap with the specified region
+*/
+void Tile::applyTiles (long _llx, long _lly, unsigned long wx, unsigned long wy,
+		       void *cookie, void (*f) (void *, Tile *))
 
-static void append_tile (void *cookie, Tile *t)
 {
-  list_t *l = (list_t *) cookie;
-  list_append (l, t);
+  visitTiles (_llx, _lly, wx, wy, [=] (Tile *t) { (*f) (cookie, t); });
 }
 
+
 /*
-  Returns a list of all the tiles that overlap with the specified region
+  Collects all the tiles that overlap with the specified region
 */
-list_t *Tile::collectRect (long _llx, long _lly,
-			   unsigned long wx, unsigned long wy)
+void Tile::collectRect (long _llx, long _lly,
+			unsigned long wx, unsigned long wy, TileStack &s)
 {
-  list_t *l;
-
-  l = list_new ();
-  applyTiles (_llx, _lly, wx, wy, l, append_tile);
-  
-  return l;
+  visitTiles (_llx, _lly, wx, wy, [&] (Tile *t) { s.push (t); });
 }
 
 
@@ -347,7 +352,8 @@ void Tile::printall ()
 }
 #endif
 
-Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
+Tile *Tile::addRect (TilePool *p,
+		     long _llx, long _lly, unsigned long wx, unsigned long wy,
 		     bool force)
 {
 #if 0
@@ -364,23 +370,20 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
   /*
     we first collect all the tiles within the region.
   */
-  list_t *l = collectRect (_llx, _lly, wx, wy);
-
-  list_t *ml;
-  listitem_t *li;
+  TileStack l, ml;
+  collectRect (_llx, _lly, wx, wy, l);
 
-  if (list_isempty (l)) {
+  if (l.empty()) {
     fatal_error ("Tile::collectRect() failed!");
   }
 
-  Tile *t = (Tile *) list_value (list_first (l));
+  Tile *t = l[0];
   void *tnet = NULL;
 
 #if 0
-  printf ("   Region has %d tiles\n", list_length (l));
-  for (li = list_first (l); li; li = list_next (li)) {
-    Tile *tmp = (Tile *) list_value (li);
-    printf ("  -> "); tmp->print (stdout);
+  printf ("   Region has %d tiles\n", l.size());
+  for (unsigned int i=0; i < l.size(); i++) {
+    printf ("  -> "); l[i]->print (stdout);
     printf ("\n");
   }
   fflush (stdout);
@@ -390,16 +393,14 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
      check that all the tile types match
   */
   if (!force) {
-    for (li = list_first (l); li; li = list_next (li)) {
-      Tile *tmp = (Tile *) list_value (li);
+    for (unsigned int i=0; i < l.size(); i++) {
+      Tile *tmp = l[i];
       if (t->space != tmp->space || t->virt != tmp->virt || t->attr != tmp->attr) {
 	warning ("Tile::addRect() failed; inconsistent tile types being merged");
-	list_free (l);
 	return NULL;
       }
       if (tmp->net && tnet && tnet != tmp->net) {
 	warning ("Tile::addRect() failed; inconsistent nets being merged");
-	list_free (l);
 	return NULL;
       }
       if (!tnet && tmp->net) {
@@ -408,10 +409,8 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
     }
   }
 
-  ml = list_new ();
-
   /* create new rectangle */
-  Tile *rt = new Tile();
+  Tile *rt = p->alloc ();
   rt->net = tnet;
   rt->space = t->space;
   rt->virt = t->virt;
@@ -429,22 +428,22 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
      we have created a region that is the specified rectangle 
   */
   
-  while (!list_isempty (l)) {
-    t = (Tile *) list_delete_tail (l);
+  while (!l.empty()) {
+    t = l.pop ();
 
 #if 0
     printf ("   Tile: "); t->print();
 #endif
     
     if (t->llx < _llx) {
-      t = t->splitX (_llx);	/* left edge prune */ 
+      t = t->splitX (p, _llx);	/* left edge prune */ 
 #if 0
       printf ("   splitX -> ");
       t->print ();
 #endif      
    }
     if (t->lly < _lly) {
-      t = t->splitY (_lly);	/* bottom edge prune */
+      t = t->splitY (p, _lly);	/* bottom edge prune */
 #if 0
       printf ("   splitY -> ");
       t->print();
@@ -453,7 +452,7 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
 
     if (t->nextx() > _llx + (signed long)wx) {
       Tile *tmp;
-      tmp = t->splitX (_llx+(signed long)wx);	/* right edge prune */
+      tmp = t->splitX (p, _llx+(signed long)wx);	/* right edge prune */
 #if 0
       printf ("   splitX => ");
       tmp->print ();
@@ -461,7 +460,7 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
     }
     if (t->nexty() > _lly + (signed long)wy) {
       Tile *tmp;
-      tmp = t->splitY (_lly + (signed long)wy);	/* top edge prune */
+      tmp = t->splitY (p, _lly + (signed long)wy);	/* top edge prune */
 #if 0
       printf ("   splitY => ");
       tmp->print();
@@ -472,7 +471,7 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
     printf ("   final chunk: "); t->print();
     fflush (stdout);
 #endif    
-    list_append (ml, t);
+    ml.push (t);
   }
 
 #if 0
@@ -484,9 +483,9 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
 
   int flag = 0;
 
-  while (!list_isempty (ml)) {
+  while (!ml.empty()) {
     /* repair stitches */
-    Tile *tmp = (Tile *) list_delete_tail (ml);
+    Tile *tmp = ml.pop ();
 
     if (tmp->llx == _llx && tmp->lly == _lly) {
       /* ll corner tile; import stitches */
@@ -541,9 +540,8 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
 	x = x->ll.x;
       }
     }
-    list_append (l, tmp);
+    l.push (tmp);
   }
-  list_free (ml);
 
   if (flag != 3) {
     warning ("new tile link error: ll = %d ; ur = %d", flag & 1, (flag >> 1));
@@ -558,15 +556,14 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
   fflush (stdout);
 #endif
   
-  for (li = list_first (l); li; li = list_next (li)) {
-    Tile *tmp = (Tile *) list_value (li);
+  for (unsigned int i=0; i < l.size(); i++) {
+    Tile *tmp = l[i];
 #if 0
     printf ("delete #%d\n", tmp->idx);
     fflush (stdout);
 #endif
-    delete tmp;
+    p->release (tmp);
   }
-  list_free (l);
 
 #if 0
   printf ("--- after ----\n");
@@ -579,16 +576,17 @@ Tile *Tile::addRect (long _llx, long _lly, unsigned long wx, unsigned long wy,
 }
 
 
-int Tile::addVirt (int flavor, int type,
+int Tile::addVirt (TilePool *p, int flavor, int type,
 		   long _llx, long _lly, unsigned long wx, unsigned long wy)
 
 {
   /*
     collect all tiles
   */
-  list_t *l = collectRect (_llx, _lly, wx, wy);
+  TileStack l;
+  collectRect (_llx, _lly, wx, wy, l);
 
-  if (list_isempty (l)) {
+  if (l.empty()) {
     fatal_error ("Tile::collectRect() failed!");
   }
 
@@ -597,10 +595,10 @@ int Tile::addVirt (int flavor, int type,
      we have created a region that is the specified rectangle 
   */
   
-  while (!list_isempty (l)) {
+  while (!l.empty()) {
     Tile *t;
     int new_attr;
-    t = (Tile *) list_delete_tail (l);
+    t = l.pop ();
 
     /* check virt flag */
     if (t->virt) return 0; /* failure! */
@@ -625,16 +623,16 @@ int Tile::addVirt (int flavor, int type,
     }
 
     if (t->llx < _llx) {
-      t = t->splitX (_llx);	/* left edge prune */ 
+      t = t->splitX (p, _llx);	/* left edge prune */ 
     }
     if (t->lly < _lly) {
-      t = t->splitY (_lly);	/* bottom edge prune */
+      t = t->splitY (p, _lly);	/* bottom edge prune */
     }
     if (t->nextx() > _llx + (signed long)wx) {
-      t->splitX (_llx+(signed long)wx);	/* right edge prune */
+      t->splitX (p, _llx+(signed long)wx);	/* right edge prune */
     }
     if (t->nexty() > _lly + (signed long)wy) {
-      t->splitY (_lly + (signed long)wy);	/* top edge prune */
+      t->splitY (p, _lly + (signed long)wy);	/* top edge prune */
     }
     t->virt = 1;
     t->space = 0;
@@ -647,7 +645,7 @@ int Tile::addVirt (int flavor, int type,
 /*
  *  Split a tile at X coordinate specified. Returns the new tile.
  */
-Tile *Tile::splitX (long x)
+Tile *Tile::splitX (TilePool *p, long x)
 {
 #if 0
   printf ("--- split X @ %ld ---------------------\n", x);
@@ -659,7 +657,7 @@ Tile *Tile::splitX (long x)
   
   Assert (llx < x && xmatch (x), "What?");
 
-  Tile *t = new Tile ();
+  Tile *t = p->alloc ();
 
   t->space = space;
   t->virt = virt;
@@ -726,7 +724,7 @@ Tile *Tile::splitX (long x)
 /*
  * Split a tile at the y-coordinate specified
  */
-Tile *Tile::splitY (long y)
+Tile *Tile::splitY (TilePool *p, long y)
 {
 #if 0
   printf ("----- split Y @ %ld -------------------\n", y);
@@ -738,7 +736,7 @@ Tile *Tile::splitY (long y)
   
   Assert (lly < y && ymatch (y), "What?");
 
-  Tile *t = new Tile ();
+  Tile *t = p->alloc ();
 
   t->space = space;
   t->virt = virt;
@@ -800,6 +798,169 @@ Tile *Tile::splitY (long y)
 }
 
 
+/*
+ * Merge r, the tile to the right of this one with the same vertical
+ * extent, into this tile. r is deleted.
+ */
+void Tile::joinX (TilePool *p, Tile *r)
+{
+  Tile *tmp;
+
+  Assert (r->llx == nextx() && r->lly == lly && r->nexty() == nexty(),
+	  "What?");
+
+  /* top edge */
+  tmp = r->ur.y;
+  while (tmp && tmp->llx >= r->llx) {
+    tmp->ll.y = this;
+    tmp = tmp->ll.x;
+  }
+
+  /* bottom edge */
+  tmp = r->ll.y;
+  while (tmp && tmp->llx <= r->geturx()) {
+    if (tmp->ur.y == r) {
+      tmp->ur.y = this;
+    }
+    tmp = tmp->ur.x;
+  }
+
+  /* right edge */
+  tmp = r->ur.x;
+  while (tmp && tmp->lly >= r->lly) {
+    tmp->ll.x = this;
+    tmp = tmp->ll.y;
+  }
+
+  ur.x = r->ur.x;
+  ur.y = r->ur.y;
+  p->release (r);
+}
+
+
+/*
+ * Merge u, the tile above this one with the same horizontal extent,
+ * into this tile. u is deleted.
+ */
+void Tile::joinY (TilePool *p, Tile *u)
+{
+  Tile *tmp;
+
+  Assert (u->lly == nexty() && u->llx == llx && u->nextx() == nextx(),
+	  "What?");
+
+  /* left edge */
+  tmp = u->ll.x;
+  while (tmp && tmp->lly <= u->getury()) {
+    if (tmp->ur.x == u) {
+      tmp->ur.x = this;
+    }
+    tmp = tmp->ur.y;
+  }
+
+  /* right edge */
+  tmp = u->ur.x;
+  while (tmp && tmp->lly >= u->lly) {
+    tmp->ll.x = this;
+    tmp = tmp->ll.y;
+  }
+
+  /* top edge */
+  tmp = u->ur.y;
+  while (tmp && tmp->llx >= u->llx) {
+    tmp->ll.y = this;
+    tmp = tmp->ll.x;
+  }
+
+  ur.x = u->ur.x;
+  ur.y = u->ur.y;
+  p->release (u);
+}
+
+
+/*
+  First every tile is widened by merging it with same-type tiles to
+  its right (splitting both to their common vertical extent), and
+  then tiles with identical horizontal extents are merged vertically.
+  This is the maximal horizontal strip form, which is unique for a
+  given set of regions.
+
+  Tiles are deleted as they are merged, so pending work is kept as
+  lower left corners and re-located with find().
+*/
+void Tile::mergeStrips (TilePool *p)
+{
+  long *pts;
+  int npts, maxpts;
+  Tile *t, *r;
+
+  maxpts = 64;
+  npts = 0;
+  MALLOC (pts, long, 2*maxpts);
+
+  auto push = [&] (Tile *x) {
+    if (npts == maxpts) {
+      maxpts *= 2;
+      REALLOC (pts, long, 2*maxpts);
+    }
+    pts[2*npts] = x->llx;
+    pts[2*npts+1] = x->lly;
+    npts++;
+  };
+
+  /* 1. maximal horizontal extent */
+  visitAll ([&] (Tile *x) { push (x); });
+  t = this;
+  while (npts > 0) {
+    npts--;
+    t = t->find (pts[2*npts], pts[2*npts+1]);
+    while (1) {
+      /* look for a same-type tile along the right edge */
+      for (r = t->ur.x; r; r = r->ll.y) {
+	if (t->sameType (r)) break;
+	if (r->lly <= t->lly) {
+	  r = NULL;
+	  break;
+	}
+      }
+      if (!r) break;
+
+      long ylo = MAX (t->lly, r->lly);
+      long yhi = MIN (t->nexty(), r->nexty());
+
+      if (t->lly < ylo) {
+	push (t);
+	t = t->splitY (p, ylo);
+      }
+      if (t->nexty() > yhi) {
+	push (t->splitY (p, yhi));
+      }
+      if (r->lly < ylo) {
+	push (r);
+	r = r->splitY (p, ylo);
+      }
+      if (r->nexty() > yhi) {
+	push (r->splitY (p, yhi));
+      }
+      t->joinX (p, r);
+    }
+  }
+
+  /* 2. maximal vertical extent */
+  visitAll ([&] (Tile *x) { push (x); });
+  t = this;
+  while (npts > 0) {
+    npts--;
+    t = t->find (pts[2*npts], pts[2*npts+1]);
+    while ((r = t->ur.y) && r->llx == t->llx && r->nextx() == t->nextx()
+	   && t->sameType (r)) {
+      t->joinY (p, r);
+    }
+  }
+  FREE (pts);
+}
+
+
 int Tile::isConnected (Layer *l, Tile *t1, Tile *t2)
 {
   unsigned int a1, a2;
@@ -98,6 +98,74 @@ Order:
 #define TILE_ATTR_ISROUTE(x) ((x) == 0)
 
 class Layer;
+class TilePool;
+class Tile;
+
+
+/*------------------------------------------------------------------------
+ *
+ *  A double-ended buffer of tile pointers used during plane walks.
+ *  The first TILE_STACK_INLINE entries live inside the object, so
+ *  a TileStack on the C++ stack only touches the heap when a walk
+ *  is unusually wide.
+ *
+ *------------------------------------------------------------------------
+ */
+#define TILE_STACK_INLINE 64	// must be a power of 2
+
+class TileStack {
+ private:
+  Tile *_inl[TILE_STACK_INLINE];
+  Tile **_buf;
+  unsigned int _max;		// capacity; always a power of 2
+  unsigned int _hd;		// ring buffer index of the first entry
+  unsigned int _n;		// # of entries
+
+  void _grow ();
+
+ public:
+  TileStack () {
+    _buf = _inl;
+    _max = TILE_STACK_INLINE;
+    _hd = 0;
+    _n = 0;
+  }
+  ~TileStack () {
+    if (_buf != _inl) {
+      FREE (_buf);
+    }
+  }
+
+  bool empty () { return _n == 0; }
+  unsigned int size () { return _n; }
+  void clear () { _hd = 0; _n = 0; }
+
+  /* add to the tail */
+  void push (Tile *t) {
+    if (_n == _max) _grow ();
+    _buf[(_hd + _n) & (_max - 1)] = t;
+    _n++;
+  }
+
+  /* add to the head */
+  void pushHead (Tile *t) {
+    if (_n == _max) _grow ();
+    _hd = (_hd + _max - 1) & (_max - 1);
+    _buf[_hd] = t;
+    _n++;
+  }
+
+  /* remove from the tail */
+  Tile *pop () {
+    Assert (_n > 0, "TileStack underflow");
+    _n--;
+    return _buf[(_hd + _n) & (_max - 1)];
+  }
+
+  Tile *operator[] (unsigned int i) {
+    return _buf[(_hd + i) & (_max - 1)];
+  }
+};
 
 #ifndef MAX
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -155,6 +223,14 @@ public:
     fprintf (fp, "(%ld,%ld) -> (%ld,%ld)", llx(), lly(), urx(), ury());
   }
 
+  bool overlaps (const Rectangle &r) const {
+    if (empty() || r.empty()) {
+      return false;
+    }
+    return (llx() <= r.urx() && r.llx() <= urx() &&
+	    lly() <= r.ury() && r.lly() <= ury());
+  }
+
   bool contains (const Rectangle &r) const {
     if (llx() <= r.llx() && lly() <= r.lly() &&
 	r.urx() <= urx() && r.ury() <= ury()) {
@@ -258,12 +334,13 @@ class Tile {
 				// if it is not a space tile. NULL = no net
 
   Tile *find (long x, long y);
-  Tile *splitX (long x);
-  Tile *splitY (long y);
-  list_t *collectRect (long _llx, long _lly,
-		       unsigned long wx, unsigned long wy);
-  list_t *collectRect (Rectangle &r) { return collectRect (r.llx(), r.lly(),
-							   r.wx(), r.wy()); }
+  Tile *splitX (TilePool *p, long x);
+  Tile *splitY (TilePool *p, long y);
+  void collectRect (long _llx, long _lly,
+		    unsigned long wx, unsigned long wy, TileStack &s);
+  void collectRect (Rectangle &r, TileStack &s) {
+    collectRect (r.llx(), r.lly(), r.wx(), r.wy(), s);
+  }
   
   int xmatch (long x) { return (llx <= x) && (!ur.x || (x < ur.x->llx)); }
   int ymatch (long y) { return (lly <= y) && (!ur.y || (y < ur.y->lly)); }
@@ -271,6 +348,26 @@ class Tile {
   long nexty() { return ur.y ? ur.y->lly : MAX_VALUE; }
 
 
+  /*
+    Calls f(t) for every tile t that overlaps the specified region.
+    f can be any function object (typically a lambda); the frontier
+    is kept in a TileStack, so this does not allocate for normal
+    queries.
+  */
+  template<class F>
+  void visitTiles (long _llx, long _lly, unsigned long wx, unsigned long wy,
+		   F f);
+  template<class F>
+  void visitTiles (Rectangle &r, F f) {
+    visitTiles (r.llx(), r.lly(), r.wx(), r.wy(), f);
+  }
+  template<class F>
+  void visitAll (F f) {
+    visitTiles (MIN_VALUE, MIN_VALUE,
+		(unsigned long)MAX_VALUE - (MIN_VALUE + 1),
+		(unsigned long)MAX_VALUE - (MIN_VALUE + 1), f);
+  }
+
   void applyTiles (long _llx, long _lly, unsigned long wx, unsigned long wy,
 		   void *cookie, void (*f) (void *, Tile *));
   void applyTiles (Rectangle &r, void *cookie, void (*f)(void *, Tile *)) {
@@ -279,6 +376,18 @@ class Tile {
 
   int isPin() { return TILE_ATTR_ISPIN(attr); }
 
+  /* 1 if t has the same type and net as this tile */
+  int sameType (Tile *t) {
+    return space == t->space && virt == t->virt && attr == t->attr
+      && net == t->net;
+  }
+  void joinX (TilePool *p, Tile *r);
+  void joinY (TilePool *p, Tile *u);
+
+  /* point-location statistics, across all planes in this thread */
+  static thread_local unsigned long _nfind;
+  static thread_local unsigned long _nhops;
+
  public:
   Tile ();
   ~Tile ();
@@ -287,21 +396,31 @@ class Tile {
     Cuts tiles and returns a tile with this precise shape
     If it would involve two different tiles of different types, then
     it will flag it as an error.
+    New tiles are allocated from, and deleted tiles returned to, the
+    tile pool p.
   */
-  Tile *addRect (long _llx, long _lly,
+  Tile *addRect (TilePool *p, long _llx, long _lly,
 		 unsigned long wx, unsigned long wy,
 		 bool force = false);
-  Tile *addRect (Rectangle &r, bool force = false) {
-    return addRect (r.llx(), r.lly(), r.wx(), r.wy(), force);
+  Tile *addRect (TilePool *p, Rectangle &r, bool force = false) {
+    return addRect (p, r.llx(), r.lly(), r.wx(), r.wy(), force);
   }
   
-  int addVirt (int flavor, int type,
+  int addVirt (TilePool *p, int flavor, int type,
 	       long _llx, long _lly,
 	       unsigned long wx, unsigned long wy);
-  int addVirt (int flavor, int type, Rectangle &r) {
-    return addVirt (flavor, type, r.llx(), r.lly(), r.wx(), r.wy());
+  int addVirt (TilePool *p, int flavor, int type, Rectangle &r) {
+    return addVirt (p, flavor, type, r.llx(), r.lly(), r.wx(), r.wy());
   }
 
+  /*
+    Merges tiles of the same type and net into maximal horizontal
+    strips. Must be called on the tile containing (MIN_VALUE,
+    MIN_VALUE), which is never deleted; any other tile pointer into
+    the plane may be invalid after this call.
+  */
+  void mergeStrips (TilePool *p);
+
   Tile *llxTile() { return ll.x; }
   Tile *urxTile() { return ur.x; }
   Tile *llyTile() { return ll.y; }
@@ -329,7 +448,104 @@ class Tile {
   static int isConnected (Layer *l, Tile *t1, Tile *t2);
   
   friend class Layer;
+  friend class LayoutBlob;
+  friend class TilePool;
 };
 
 
+/*------------------------------------------------------------------------
+ *
+ *  Slab allocator for tiles. Each layer owns a pool; tiles are carved
+ *  out of TILE_SLAB_SIZE-sized slabs, deleted tiles are kept on a free
+ *  list for re-use, and all the slabs are released together when the
+ *  pool is deleted.
+ *
+ *------------------------------------------------------------------------
+ */
+#define TILE_SLAB_SIZE 512
+
+class TilePool {
+ private:
+  struct tile_slab {
+    Tile *t;			// raw storage for TILE_SLAB_SIZE tiles
+    int used;			// # of tiles handed out from this slab
+    struct tile_slab *next;
+  } *_slabs;
+
+  Tile *_free;			// free list, linked through ll.x
+
+  unsigned long _live;		// # of tiles currently in use
+  unsigned long _peak;		// max # of tiles in use at any point
+  unsigned long _nslabs;	// # of slabs allocated
+
+ public:
+  TilePool ();
+  ~TilePool ();
+
+  Tile *alloc ();
+  void release (Tile *t);
+
+  unsigned long numTiles () { return _live; }
+  unsigned long peakTiles () { return _peak; }
+  unsigned long numBytes () { return _nslabs*TILE_SLAB_SIZE*sizeof (Tile); }
+};
+
+
+template<class F>
+void Tile::visitTiles (long _llx, long _lly, unsigned long wx, unsigned long wy,
+		       F f)
+{
+  Tile *t;
+  TileStack frontier;
+  long _urx, _ury;
+
+  _urx = _llx + (signed long)wx - 1;
+  _ury = _lly + (signed long)wy - 1;
+
+  t = find (_llx, _lly);
+  frontier.push (t);
+
+  /* 1. create vertical wavefront */
+  while (t->getury() < _ury) {
+    t = t->find (_llx, t->getury() + 1);
+    frontier.push (t);
+  }
+
+  while (!frontier.empty()) {
+    Tile *tmp;
+    t = frontier.pop ();
+
+    /* traverse right edge downward. 
+       if this tile might be added by someone else on the frontier,
+       done.
+    */
+    tmp = t->ur.x;
+    while (tmp) {
+      if (_llx <= tmp->llx && tmp->llx <= _urx &&
+	  !(tmp->getury() < _lly || tmp->lly > _ury)) {
+	/* another tile might add this one if:
+	   1. it goes below t->lly
+	   2. t->lly is not at the bottom limit
+	*/
+	if (tmp->getlly() < t->lly && t->lly > _lly)
+	  break;
+	frontier.pushHead (tmp);
+      }
+      else {
+	if (!(_llx <= tmp->llx && tmp->llx <= _urx))
+	  break;
+      }
+
+      if (tmp->getlly() > t->getlly()) {
+	tmp = tmp->ll.y;
+      }
+      else {
+	tmp = NULL;
+      }
+    }
+    f (t);			/* apply function */
+  }
+}
+
+
 #endif /* __ACT_TILE_H__ */